@@ -0,0 +1,68 @@
+// Decodes PNGs and writes them out as C source for embedded_assets.h
+//
+// usage: bake_assets FILE.png... >embedded_assets.c
+//
+// Filenames are stored as given so they match the paths the game asks for
+
+#define _POSIX_C_SOURCE 200809L // for cute_png's posix_madvise
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#define CUTE_PNG_IMPLEMENTATION
+#include "cute_png.h"
+
+
+// Turn a filename into a C identifier, assets/board.png -> assets_board_png
+void print_identifier(const char *filename) {
+  for(const char *c = filename; *c; c++)
+    putchar(isalnum((unsigned char)*c) ? *c : '_');
+}
+
+
+int main(int argc, char *argv[]) {
+  if(argc < 2) {
+    fprintf(stderr, "usage: %s FILE.png...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  int *sizes = malloc(sizeof(int) * 2 * argc);
+
+  printf("// Generated by bake_assets, do not edit\n");
+  printf("#include \"embedded_assets.h\"\n");
+
+  for(int i = 1; i < argc; i++) {
+    cp_image_t img = cp_load_png(argv[i]);
+    if(img.pix == 0) {
+      fprintf(stderr, "%s: %s\n", argv[i],
+          cp_error_reason ? cp_error_reason : "unable to read");
+      return EXIT_FAILURE;
+    }
+
+    const unsigned char *pix = (const unsigned char*)img.pix;
+    int size = img.w * img.h * 4;
+    sizes[i*2] = img.w;
+    sizes[i*2+1] = img.h;
+
+    printf("\nstatic const unsigned char ");
+    print_identifier(argv[i]);
+    printf("[%d] = {", size);
+    for(int j = 0; j < size; j++)
+      printf("%s0x%02x,", j % 16 ? "" : "\n  ", pix[j]);
+    printf("\n};\n");
+
+    cp_free_png(&img);
+  }
+
+  printf("\nconst EmbeddedAsset embedded_assets[] = {\n");
+  for(int i = 1; i < argc; i++) {
+    printf("  {\"%s\", %d, %d, ", argv[i], sizes[i*2], sizes[i*2+1]);
+    print_identifier(argv[i]);
+    printf("},\n");
+  }
+  printf("};\n\n");
+  printf("const int embedded_asset_count = %d;\n", argc - 1);
+
+  free(sizes);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,641 @@
+// Benchmarks for the rules in checkers.c
+//
+// usage: bench_checkers [-j RESULTS.json]
+//
+// Random games are played from a fixed seed and every position along the
+// way is kept, along with the moves that are legal in it and a handful
+// that aren't. is_move_valid is timed separately over the legal moves and
+// over the rejected ones, which take the error path through snprintf.
+// move_piece replays the games, get_piece and set_piece go over random
+// coordinates, some of them off the board, and init_board is timed on its
+// own. evaluate_board and recompute_evaluation are timed over the
+// positions. Loading each position onto the board isn't part of the times.
+//
+// Then each rule variant's move generator is timed over positions from its
+// own random games, and by how many perft leaf nodes it counts a second,
+// followed by the bitboard generator for international draughts over the
+// same positions as the international variant.
+//
+// Last, English positions are searched to a range of depths with and
+// without quiescence and move ordering, counting the nodes each takes, how
+// close it gets to the minimal tree and how often it picks a move as good
+// as a deeper search does.
+//
+// Each benchmark takes SAMPLES samples of at least SAMPLE_TIME seconds
+// after one to warm up, and reports the mean ns per call with a 95%
+// confidence interval and the fastest sample. -j writes the same numbers
+// out as JSON to compare between versions of checkers.c.
+
+#define _POSIX_C_SOURCE 200809L
+#include "checkers.h"
+#include "variants.h"
+#include "draughts.h"
+#include "search.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SEED 1
+#define GAMES 64
+#define MAX_PLIES 200 // games that get this long are kings shuffling about
+#define MAX_LEGAL 96 // 12 pieces with 8 moves each
+#define REJECTS_PER_POSITION 16
+#define COORDS 4096
+#define REPEATS 8 // passes over a position's moves per clock read
+
+// Calls per clock read, enough that reading the clock doesn't show in the
+// times, as evaluate_board only takes a few ns
+#define EVALUATE_REPEATS 1024
+#define RECOMPUTE_REPEATS 16
+
+#define VARIANT_GAMES 16
+
+// Perft deep enough for around a million leaf nodes in each variant
+const int perft_depths[VARIANT_COUNT] = { 8, 7, 8, 7 };
+#define DRAUGHTS_PERFT_DEPTH 8
+
+#define SEARCH_POSITIONS 64
+#define REFERENCE_DEPTH 10 // with quiescence, what the other searches are held to
+#define REFERENCE_FLAGS (SEARCH_QUIESCENCE | SEARCH_ORDERING | SEARCH_DEEPENING)
+const int search_depths[] = { 2, 4, 6, 8 };
+const int search_flags[] = {
+  0,
+  SEARCH_QUIESCENCE,
+  SEARCH_QUIESCENCE | SEARCH_ORDERING,
+  SEARCH_QUIESCENCE | SEARCH_ORDERING | SEARCH_DEEPENING
+};
+
+#define SAMPLES 30
+#define T_95 2.045 // Student's t for 95% with SAMPLES - 1 degrees of freedom
+#define SAMPLE_TIME 0.02
+
+typedef struct {
+  int x1, y1, x2, y2;
+  char p;
+} MoveArgs;
+
+typedef struct {
+  char squares[BOARD_HEIGHT][BOARD_WIDTH];
+  char side;
+  MoveArgs legal[MAX_LEGAL];
+  int legal_count;
+  MoveArgs rejected[REJECTS_PER_POSITION];
+  MoveArgs played;
+} Position;
+
+typedef struct {
+  int start, count; // positions, the last one has no move played
+} Game;
+
+Position *positions;
+int position_count;
+Board *boards[VARIANT_COUNT];
+int board_counts[VARIANT_COUNT];
+const Variant *bench_variant;
+DraughtsBoard *draughts_boards;
+Game games[GAMES];
+int coords[COORDS][2];
+char coord_pieces[COORDS];
+
+// Cleared before each position timed, outside the time taken. The reference
+// searches just keep theirs, it only changes how long they take.
+SearchContext search_context, reference_context;
+
+// Results go here so the calls can't be optimised out
+volatile long sink;
+
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void save_position(Position *pos) {
+  for(int y = 0; y < BOARD_HEIGHT; y++)
+    for(int x = 0; x < BOARD_WIDTH; x++)
+      pos->squares[y][x] = get_piece(x, y);
+}
+
+
+void load_position(const Position *pos) {
+  for(int y = 0; y < BOARD_HEIGHT; y++)
+    for(int x = 0; x < BOARD_WIDTH; x++)
+      set_piece(x, y, pos->squares[y][x]);
+}
+
+
+// Fills in the moves is_move_valid accepts for the side to move
+void find_legal_moves(Position *pos) {
+  static const int dirs[4][2] = { {-1,-1}, {1,-1}, {-1,1}, {1,1} };
+  pos->legal_count = 0;
+
+  for(int y = 0; y < BOARD_HEIGHT; y++) {
+    for(int x = 0; x < BOARD_WIDTH; x++) {
+      for(int d = 0; d < 4; d++) {
+        for(int distance = 1; distance <= 2; distance++) {
+          MoveArgs m = { x, y, x + dirs[d][0] * distance, y + dirs[d][1] * distance, pos->side };
+          if(is_move_valid(m.x1, m.y1, m.x2, m.y2, m.p) == NULL)
+            pos->legal[pos->legal_count++] = m;
+        }
+      }
+    }
+  }
+}
+
+
+// Moves that is_move_valid turns down. Mostly from a square near a piece
+// so they get past the location checks, a few from anywhere at all.
+void find_rejected_moves(Position *pos) {
+  for(int i = 0; i < REJECTS_PER_POSITION; ) {
+    MoveArgs m;
+    m.p = rand() % 2 ? 'w' : 'b';
+    if(rand() % 4 == 0) {
+      m.x1 = rand() % (BOARD_WIDTH + 2) - 1;
+      m.y1 = rand() % (BOARD_HEIGHT + 2) - 1;
+      m.x2 = rand() % (BOARD_WIDTH + 2) - 1;
+      m.y2 = rand() % (BOARD_HEIGHT + 2) - 1;
+    } else {
+      m.x1 = rand() % BOARD_WIDTH;
+      m.y1 = rand() % BOARD_HEIGHT;
+      m.x2 = m.x1 + rand() % 5 - 2;
+      m.y2 = m.y1 + rand() % 5 - 2;
+    }
+
+    if(is_move_valid(m.x1, m.y1, m.x2, m.y2, m.p) != NULL)
+      pos->rejected[i++] = m;
+  }
+}
+
+
+// Plays random legal moves from the start until a side can't move
+void make_corpus(void) {
+  positions = malloc(sizeof(Position) * GAMES * (MAX_PLIES + 1));
+  srand(SEED);
+
+  for(int g = 0; g < GAMES; g++) {
+    init_board();
+    games[g].start = position_count;
+
+    char side = 'b';
+    for(int ply = 0; ply <= MAX_PLIES; ply++) {
+      Position *pos = &positions[position_count++];
+      pos->side = side;
+      save_position(pos);
+      find_legal_moves(pos);
+      find_rejected_moves(pos);
+      if(pos->legal_count == 0 || ply == MAX_PLIES)
+        break;
+
+      pos->played = pos->legal[rand() % pos->legal_count];
+      move_piece(pos->played.x1, pos->played.y1, pos->played.x2, pos->played.y2);
+      side = side == 'b' ? 'w' : 'b';
+    }
+
+    games[g].count = position_count - games[g].start;
+  }
+
+  const char pieces[] = " wWbB";
+  for(int i = 0; i < COORDS; i++) {
+    coords[i][0] = rand() % (BOARD_WIDTH + 2) - 1;
+    coords[i][1] = rand() % (BOARD_HEIGHT + 2) - 1;
+    coord_pieces[i] = pieces[rand() % 5];
+  }
+}
+
+
+// Plays random games under each variant, keeping the positions for the
+// move generators
+void make_variant_corpus(void) {
+  static Move moves[MAX_MOVES];
+
+  for(int v = 0; v < VARIANT_COUNT; v++) {
+    boards[v] = malloc(sizeof(Board) * VARIANT_GAMES * (MAX_PLIES + 1));
+    for(int g = 0; g < VARIANT_GAMES; g++) {
+      Board b;
+      variants[v].init_board(&b);
+      for(int ply = 0; ply <= MAX_PLIES; ply++) {
+        boards[v][board_counts[v]++] = b;
+        int count = variants[v].generate_moves(&b, moves);
+        if(count == 0)
+          break;
+        variants[v].make_move(&b, &moves[rand() % count]);
+      }
+    }
+  }
+
+  const Variant *v = &variants[VARIANT_INTERNATIONAL];
+  int count = board_counts[VARIANT_INTERNATIONAL];
+  draughts_boards = calloc(count, sizeof(DraughtsBoard));
+  for(int i = 0; i < count; i++) {
+    const Board *b = &boards[VARIANT_INTERNATIONAL][i];
+    draughts_boards[i].side = b->side;
+    for(int y = 0; y < DRAUGHTS_SIZE; y++)
+      for(int x = 0; x < DRAUGHTS_SIZE; x++)
+        draughts_set_piece(&draughts_boards[i], x, y, b->squares[variant_square(v, x, y)]);
+  }
+}
+
+
+// Each of these makes one pass over the corpus, adding the number of calls
+// it timed to ops and returning the seconds they took
+
+double bench_accept(long *ops) {
+  double elapsed = 0;
+  for(int i = 0; i < position_count; i++) {
+    const Position *pos = &positions[i];
+    load_position(pos);
+
+    double start = now();
+    for(int r = 0; r < REPEATS; r++) {
+      for(int m = 0; m < pos->legal_count; m++) {
+        const MoveArgs *move = &pos->legal[m];
+        sink += is_move_valid(move->x1, move->y1, move->x2, move->y2, move->p) == NULL;
+      }
+    }
+    elapsed += now() - start;
+    *ops += pos->legal_count * REPEATS;
+  }
+  return elapsed;
+}
+
+
+double bench_reject(long *ops) {
+  double elapsed = 0;
+  for(int i = 0; i < position_count; i++) {
+    const Position *pos = &positions[i];
+    load_position(pos);
+
+    double start = now();
+    for(int r = 0; r < REPEATS; r++) {
+      for(int m = 0; m < REJECTS_PER_POSITION; m++) {
+        const MoveArgs *move = &pos->rejected[m];
+        sink += is_move_valid(move->x1, move->y1, move->x2, move->y2, move->p) != NULL;
+      }
+    }
+    elapsed += now() - start;
+    *ops += REJECTS_PER_POSITION * REPEATS;
+  }
+  return elapsed;
+}
+
+
+double bench_move_piece(long *ops) {
+  double elapsed = 0;
+  for(int g = 0; g < GAMES; g++) {
+    const Position *pos = &positions[games[g].start];
+    int moves = games[g].count - 1;
+    init_board();
+
+    double start = now();
+    for(int i = 0; i < moves; i++)
+      sink += move_piece(pos[i].played.x1, pos[i].played.y1, pos[i].played.x2, pos[i].played.y2);
+    elapsed += now() - start;
+    *ops += moves;
+  }
+  return elapsed;
+}
+
+
+double bench_get_piece(long *ops) {
+  double start = now();
+  for(int i = 0; i < COORDS; i++)
+    sink += get_piece(coords[i][0], coords[i][1]);
+  *ops += COORDS;
+  return now() - start;
+}
+
+
+double bench_set_piece(long *ops) {
+  double start = now();
+  for(int i = 0; i < COORDS; i++)
+    sink += set_piece(coords[i][0], coords[i][1], coord_pieces[i]);
+  *ops += COORDS;
+  return now() - start;
+}
+
+
+#define INIT_BOARD_CALLS 256
+
+double bench_init_board(long *ops) {
+  double start = now();
+  for(int i = 0; i < INIT_BOARD_CALLS; i++)
+    init_board();
+  *ops += INIT_BOARD_CALLS;
+  return now() - start;
+}
+
+
+// evaluate_board reads the terms kept by set_piece, recompute_evaluation
+// adds them up from the whole board as evaluating used to have to
+double bench_evaluate_board(long *ops) {
+  double elapsed = 0;
+  for(int i = 0; i < position_count; i++) {
+    load_position(&positions[i]);
+
+    double start = now();
+    for(int r = 0; r < EVALUATE_REPEATS; r++)
+      sink += evaluate_board(positions[i].side);
+    elapsed += now() - start;
+    *ops += EVALUATE_REPEATS;
+  }
+  return elapsed;
+}
+
+
+double bench_recompute_evaluation(long *ops) {
+  double elapsed = 0;
+  for(int i = 0; i < position_count; i++) {
+    load_position(&positions[i]);
+
+    double start = now();
+    for(int r = 0; r < RECOMPUTE_REPEATS; r++)
+      sink += recompute_evaluation().material;
+    elapsed += now() - start;
+    *ops += RECOMPUTE_REPEATS;
+  }
+  return elapsed;
+}
+
+
+double bench_generate_moves(long *ops) {
+  static Move moves[MAX_MOVES];
+  const Board *b = boards[bench_variant - variants];
+  int count = board_counts[bench_variant - variants];
+
+  double start = now();
+  for(int i = 0; i < count; i++)
+    sink += bench_variant->generate_moves(&b[i], moves);
+  *ops += count;
+  return now() - start;
+}
+
+
+double bench_draughts_generate_moves(long *ops) {
+  static DraughtsMove moves[DRAUGHTS_MAX_MOVES];
+  int count = board_counts[VARIANT_INTERNATIONAL];
+
+  double start = now();
+  for(int i = 0; i < count; i++)
+    sink += draughts_generate_moves(&draughts_boards[i], moves);
+  *ops += count;
+  return now() - start;
+}
+
+
+typedef struct {
+  double mean, ci, min; // ns per call, ci is the half width
+  long ops; // calls timed over all the samples
+} Stats;
+
+typedef double bench_fn(long *ops);
+
+
+// Returns ns per call of one sample, at least SAMPLE_TIME long
+double take_sample(bench_fn *fn, long *total_ops) {
+  long ops = 0;
+  double elapsed = 0, start = now();
+  do {
+    elapsed += fn(&ops);
+  } while(now() - start < SAMPLE_TIME);
+
+  *total_ops += ops;
+  return elapsed / ops * 1e9;
+}
+
+
+Stats run_benchmark(bench_fn *fn) {
+  Stats s = {0};
+  double samples[SAMPLES], sum = 0, squares = 0;
+
+  take_sample(fn, &s.ops);
+  s.ops = 0;
+  for(int i = 0; i < SAMPLES; i++) {
+    samples[i] = take_sample(fn, &s.ops);
+    sum += samples[i];
+  }
+
+  s.mean = sum / SAMPLES;
+  s.min = samples[0];
+  for(int i = 0; i < SAMPLES; i++) {
+    squares += (samples[i] - s.mean) * (samples[i] - s.mean);
+    if(samples[i] < s.min)
+      s.min = samples[i];
+  }
+  s.ci = T_95 * sqrt(squares / (SAMPLES - 1)) / sqrt(SAMPLES);
+  return s;
+}
+
+
+// Prints one move generator's results and adds them to json
+void report_generator(FILE *json, const char *name, int positions, Stats s,
+    int depth, unsigned long nodes, double elapsed, bool last) {
+  printf("  %-24s %10.2f %10.2f %5.1f%% %10.2f %4d %13lu %12.0f\n", name,
+      s.mean, s.ci, s.ci / s.mean * 100, s.min, depth, nodes, nodes / elapsed);
+
+  if(json)
+    fprintf(json, "    { \"name\": \"%s\", \"positions\": %d, \"ns_per_call\": %.3f, "
+        "\"ci95\": %.3f, \"fastest\": %.3f, \"perft_depth\": %d, \"perft_nodes\": %lu, "
+        "\"perft_nodes_per_sec\": %.0f }%s\n", name, positions, s.mean, s.ci, s.min,
+        depth, nodes, nodes / elapsed, last ? "" : ",");
+}
+
+
+// Score of playing move m, searched to one less than the reference depth
+// so it's comparable with the reference search's own score
+int score_move(const Board *b, const Move *m) {
+  const Variant *v = &variants[VARIANT_ENGLISH];
+  Board next = *b;
+  v->make_move(&next, m);
+  int score = -search(v, &next, REFERENCE_DEPTH - 1, REFERENCE_FLAGS,
+      &reference_context, NULL, NULL);
+
+  // Wins and losses are a ply nearer from after the move
+  if(score > WIN_SCORE / 2)
+    score--;
+  else if(score < -WIN_SCORE / 2)
+    score++;
+  return score;
+}
+
+
+// Searches SEARCH_POSITIONS English positions to each depth, with and without
+// quiescence and move ordering. Reports the nodes and time it took, how often
+// the first move tried failed high, the effective branching factor and how
+// often the move picked was as good as the reference search's.
+void bench_search(FILE *json) {
+  const Variant *v = &variants[VARIANT_ENGLISH];
+  const Board *picked[SEARCH_POSITIONS];
+  int references[SEARCH_POSITIONS], count = 0;
+  Move moves[MAX_MOVES];
+
+  for(int i = 0; i < board_counts[VARIANT_ENGLISH] && count < SEARCH_POSITIONS;
+      i += board_counts[VARIANT_ENGLISH] / SEARCH_POSITIONS) {
+    const Board *b = &boards[VARIANT_ENGLISH][i];
+    if(v->generate_moves(b, moves) == 0)
+      continue;
+    picked[count] = b;
+    references[count++] = search(v, b, REFERENCE_DEPTH, REFERENCE_FLAGS,
+        &reference_context, NULL, NULL);
+  }
+
+  printf("\nsearch, %d english positions against depth %d with quiescence\n",
+      count, REFERENCE_DEPTH);
+  printf("  %-36s %12s %12s %10s %10s %10s %10s\n", "", "nodes", "quiescence", "ms",
+      "first cut", "branching", "as good");
+  if(json)
+    fprintf(json, "  \"search\": {\n    \"positions\": %d,\n    \"reference_depth\": %d,\n"
+        "    \"results\": [\n", count, REFERENCE_DEPTH);
+
+  const int depths = sizeof(search_depths) / sizeof(search_depths[0]);
+  const int flag_sets = sizeof(search_flags) / sizeof(search_flags[0]);
+  for(int d = 0; d < depths; d++) {
+    for(int f = 0; f < flag_sets; f++) {
+      int flags = search_flags[f];
+      SearchStats stats = { 0, 0, 0, 0 };
+      double elapsed = 0;
+      int as_good = 0;
+      for(int i = 0; i < count; i++) {
+        Move best;
+        search_clear(&search_context, v);
+        double start = now();
+        search(v, picked[i], search_depths[d], flags, &search_context, &best, &stats);
+        elapsed += now() - start;
+        as_good += score_move(picked[i], &best) >= references[i];
+      }
+
+      double first_cut = (double)stats.first_move_cutoffs / stats.cutoffs;
+      double branching = pow((double)stats.nodes / count, 1.0 / search_depths[d]);
+
+      char name[48];
+      snprintf(name, sizeof(name), "depth %d%s%s%s", search_depths[d],
+          flags & SEARCH_QUIESCENCE ? " quiescence" : "",
+          flags & SEARCH_ORDERING ? " ordered" : "",
+          flags & SEARCH_DEEPENING ? " deepened" : "");
+      printf("  %-36s %12lu %12lu %10.2f %9.1f%% %10.2f %9.1f%%\n", name, stats.nodes,
+          stats.quiescence_nodes, elapsed * 1000, first_cut * 100, branching,
+          100.0 * as_good / count);
+
+      if(json)
+        fprintf(json, "      { \"depth\": %d, \"quiescence\": %s, \"ordering\": %s, "
+            "\"deepening\": %s, "
+            "\"nodes\": %lu, \"quiescence_nodes\": %lu, \"cutoffs\": %lu, "
+            "\"first_move_cutoffs\": %lu, \"effective_branching_factor\": %.3f, "
+            "\"seconds\": %.6f, \"as_good\": %d }%s\n", search_depths[d],
+            flags & SEARCH_QUIESCENCE ? "true" : "false",
+            flags & SEARCH_ORDERING ? "true" : "false",
+            flags & SEARCH_DEEPENING ? "true" : "false", stats.nodes,
+            stats.quiescence_nodes, stats.cutoffs, stats.first_move_cutoffs, branching,
+            elapsed, as_good, d + 1 < depths || f + 1 < flag_sets ? "," : "");
+    }
+  }
+
+  if(json)
+    fprintf(json, "    ]\n  }\n");
+}
+
+
+void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-j RESULTS.json]\n", prog);
+  exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[]) {
+  FILE *json = NULL;
+
+  int opt;
+  while((opt = getopt(argc, argv, "j:")) != -1) {
+    switch(opt) {
+      case 'j':
+        if((json = fopen(optarg, "w")) == NULL) {
+          perror(optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      default: usage(argv[0]);
+    }
+  }
+
+  const struct {
+    const char *name;
+    bench_fn *fn;
+  } benchmarks[] = {
+    { "is_move_valid accept", bench_accept },
+    { "is_move_valid reject", bench_reject },
+    { "move_piece", bench_move_piece },
+    { "get_piece", bench_get_piece },
+    { "set_piece", bench_set_piece },
+    { "init_board", bench_init_board },
+    { "evaluate_board", bench_evaluate_board },
+    { "recompute_evaluation", bench_recompute_evaluation },
+  };
+  const int count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+  make_corpus();
+  printf("%d positions from %d random games, %d samples of each\n",
+      position_count, GAMES, SAMPLES);
+  printf("  %-22s %10s %18s %10s\n", "", "ns/call", "95% confidence", "fastest");
+
+  if(json)
+    fprintf(json, "{\n  \"seed\": %d,\n  \"games\": %d,\n  \"positions\": %d,\n"
+        "  \"samples\": %d,\n  \"benchmarks\": [\n",
+        SEED, GAMES, position_count, SAMPLES);
+
+  for(int i = 0; i < count; i++) {
+    Stats s = run_benchmark(benchmarks[i].fn);
+    printf("  %-22s %10.2f %10.2f %5.1f%% %10.2f\n", benchmarks[i].name,
+        s.mean, s.ci, s.ci / s.mean * 100, s.min);
+
+    if(json)
+      fprintf(json, "    { \"name\": \"%s\", \"ns_per_call\": %.3f, \"ci95\": %.3f, "
+          "\"fastest\": %.3f, \"calls\": %ld }%s\n", benchmarks[i].name,
+          s.mean, s.ci, s.min, s.ops, i + 1 < count ? "," : "");
+  }
+
+  make_variant_corpus();
+  printf("\nmove generation, %d random games of each variant\n", VARIANT_GAMES);
+  printf("  %-24s %10s %18s %10s %18s %12s\n", "generate_moves", "ns/call",
+      "95% confidence", "fastest", "perft", "nodes/sec");
+  if(json)
+    fprintf(json, "  ],\n  \"variants\": [\n");
+
+  for(int v = 0; v < VARIANT_COUNT; v++) {
+    bench_variant = &variants[v];
+    Stats s = run_benchmark(bench_generate_moves);
+
+    Board b;
+    variants[v].init_board(&b);
+    double start = now();
+    unsigned long nodes = variants[v].perft(&b, perft_depths[v]);
+    double elapsed = now() - start;
+
+    report_generator(json, variants[v].name, board_counts[v], s,
+        perft_depths[v], nodes, elapsed, false);
+  }
+
+  Stats s = run_benchmark(bench_draughts_generate_moves);
+  DraughtsBoard d;
+  draughts_init_board(&d);
+  double start = now();
+  unsigned long nodes = draughts_perft(&d, DRAUGHTS_PERFT_DEPTH);
+  report_generator(json, "international bitboards", board_counts[VARIANT_INTERNATIONAL],
+      s, DRAUGHTS_PERFT_DEPTH, nodes, now() - start, true);
+  if(json)
+    fprintf(json, "  ],\n");
+
+  bench_search(json);
+  if(json) {
+    fprintf(json, "}\n");
+    fclose(json);
+  }
+
+  for(int v = 0; v < VARIANT_COUNT; v++)
+    free(boards[v]);
+  free(draughts_boards);
+  free(positions);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,1139 @@
+// Benchmarks for the cute_png.h code paths the game relies on
+//
+// usage: bench_png [-j RESULTS.json] [FILE.png...]
+//
+// Defaults to the PNGs in assets/. Each benchmark repeats for at least
+// MIN_BENCH_TIME seconds per file and reports throughput of uncompressed
+// data. Build with -DCUTE_PNG_NO_FAST_INFLATE to compare against the
+// careful, fully bounds checked decode loop.
+//
+// Whole image decodes compare cp_load_png_mem with streaming rows into a
+// buffer allocated once with cp_load_png_mem_into, and with loading out of
+// an arena that is reset between images.
+//
+// The pixel kernels behind conversion, premultiplying and flipping are
+// timed on a large image with each of the portable, SSE2 and AVX2 versions
+// the build and CPU have.
+//
+// CRC-32 and Adler-32 are timed over the same data, against the nibble
+// table and per byte modulo versions cp_save_png started out with.
+//
+// Atlas packing is timed for thousands of randomly sized sprites, along
+// with how many pages they took and how much of the pages they cover.
+//
+// Encoding is measured at a few compression levels, level 0 being the
+// run length encoder cp_save_png used to be limited to. Then the first
+// file is tiled into a large image to see how encoding scales with
+// threads.
+//
+// Last comes a corpus generated from a fixed seed, every colour type cute_png
+// decodes with noisy, smooth and flat sprite-like content, each filter type
+// and a few sizes. Each image is decoded, inflated and encoded, then all of
+// them are packed into atlas pages. Along with MB/s this reports how many
+// allocations each call makes and the most heap it holds at once, counted
+// by routing CUTE_PNG_ALLOC through the bench, and the peak RSS of the run.
+// Decodes are checked against the generated pixels so a broken build shows
+// up as a failure rather than a speedup. -j writes these results out as JSON
+// to compare between versions.
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+
+// Every allocation cute_png makes comes through here, with the size kept in
+// front of the block so frees can be counted too. The encoder allocates
+// from its worker threads, hence the atomics.
+#define ALLOC_HEADER 16
+
+atomic_long alloc_count, alloc_bytes, heap_in_use, heap_peak;
+
+void *bench_alloc(size_t size) {
+  char *p = malloc(size + ALLOC_HEADER);
+  if(p == NULL)
+    return NULL;
+
+  *(size_t*)p = size;
+  atomic_fetch_add(&alloc_count, 1);
+  atomic_fetch_add(&alloc_bytes, size);
+  long in_use = atomic_fetch_add(&heap_in_use, size) + size;
+  long peak = atomic_load(&heap_peak);
+  while(in_use > peak && !atomic_compare_exchange_weak(&heap_peak, &peak, in_use))
+    ;
+  return p + ALLOC_HEADER;
+}
+
+
+void *bench_calloc(size_t count, size_t size) {
+  void *p = bench_alloc(count * size);
+  if(p != NULL)
+    memset(p, 0, count * size);
+  return p;
+}
+
+
+void bench_free(void *p) {
+  if(p == NULL)
+    return;
+
+  char *block = (char*)p - ALLOC_HEADER;
+  atomic_fetch_sub(&heap_in_use, *(size_t*)block);
+  free(block);
+}
+
+#define CUTE_PNG_ALLOC bench_alloc
+#define CUTE_PNG_CALLOC bench_calloc
+#define CUTE_PNG_FREE bench_free
+
+#define CUTE_PNG_IMPLEMENTATION
+#define CUTE_PNG_THREADS
+#include "cute_png.h"
+
+#define MIN_BENCH_TIME 0.25
+#define TILES 8 // the large image is TILES x TILES copies of the first file
+
+#define KERNEL_WIDTH 2048
+#define KERNEL_HEIGHT 1024
+
+#define ATLAS_SIZE 2048 // largest atlas page
+#define ATLAS_MAX_PAGES 64
+#define SPRITE_MIN 8
+#define SPRITE_MAX 64
+
+const int atlas_sprite_counts[] = { 1000, 4000, 16000 };
+#define ATLAS_RUNS (int)(sizeof(atlas_sprite_counts) / sizeof(atlas_sprite_counts[0]))
+
+#define CORPUS_BENCH_TIME 0.1 // per image and operation, there are a lot of them
+#define CORPUS_SEED 1
+
+const int bench_levels[] = { 0, 1, 6, 9 };
+#define LEVEL_COUNT (int)(sizeof(bench_levels) / sizeof(bench_levels[0]))
+
+const char *default_files[] = {
+  "assets/board.png",
+  "assets/white.png",
+  "assets/white_king.png",
+  "assets/black.png",
+  "assets/black_king.png",
+  "assets/good_neighbors.png",
+};
+
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// Bytes per pixel of an 8-bit PNG colour type, or 0 if cute_png can't decode it
+int png_bytes_per_pixel(int color_type) {
+  switch(color_type) {
+    case 0: case 3: return 1;
+    case 2: return 3;
+    case 4: return 2;
+    case 6: return 4;
+    default: return 0;
+  }
+}
+
+
+// Join a PNG's IDAT chunks into the raw DEFLATE stream, minus the zlib
+// header and checksum, and work out how large it is uncompressed.
+// Returns NULL if the file can't be parsed.
+uint8_t *get_deflate_stream(const uint8_t *png, int len, int *stream_len, int *raw_len) {
+  int w, h;
+  cp_load_png_wh(png, len, &w, &h);
+  if(w == 0 || h == 0)
+    return NULL;
+
+  int bpp = png_bytes_per_pixel(png[25]);
+  if(bpp == 0)
+    return NULL;
+  *raw_len = (w * bpp + 1) * h;
+
+  cp_raw_png_t raw = { png + 8, png + len };
+  uint8_t *data = malloc(len);
+  int data_len = 0;
+  for(const uint8_t *idat = cp_find(&raw, "IDAT", 0); idat; idat = cp_find(&raw, "IDAT", 0)) {
+    uint32_t chunk_len = cp_get_chunk_byte_length(idat);
+    memcpy(data + data_len, idat, chunk_len);
+    data_len += chunk_len;
+  }
+
+  if(data_len < 6) {
+    free(data);
+    return NULL;
+  }
+
+  memmove(data, data + 2, data_len - 6);
+  *stream_len = data_len - 6;
+  return data;
+}
+
+
+// Returns MB/s of output, or 0 if the stream doesn't decode
+double bench_inflate(uint8_t *stream, int stream_len, int raw_len) {
+  char *out = malloc(raw_len);
+  double bytes = 0, start = now(), elapsed;
+
+  do {
+    if(!cp_inflate(stream, stream_len, out, raw_len)) {
+      free(out);
+      return 0;
+    }
+    bytes += raw_len;
+  } while((elapsed = now() - start) < MIN_BENCH_TIME);
+
+  free(out);
+  return bytes / elapsed / 1e6;
+}
+
+
+enum { DECODE_WHOLE, DECODE_STREAMING, DECODE_ARENA };
+
+// Returns MB/s of RGBA output for one of the ways of decoding above
+double bench_decode(const uint8_t *png, int len, int how) {
+  int w, h;
+  cp_load_png_wh(png, len, &w, &h);
+  cp_pixel_t *dst = malloc(sizeof(cp_pixel_t) * w * h);
+  double bytes = 0, start = now(), elapsed = 0;
+
+  // Room for the pixels, a filter byte per row and the inflater's tables
+  size_t arena_size = (size_t)(w + 1) * h * sizeof(cp_pixel_t) + len + (1 << 20);
+  void *block = how == DECODE_ARENA ? malloc(arena_size) : NULL;
+  cp_arena_t arena;
+  cp_arena_init(&arena, block, arena_size);
+
+  do {
+    if(how == DECODE_STREAMING) {
+      if(!cp_load_png_mem_into(png, len, dst, w * sizeof(cp_pixel_t)))
+        break;
+    } else if(how == DECODE_ARENA) {
+      cp_arena_reset(&arena);
+      if(cp_load_png_mem_arena(png, len, &arena).pix == NULL)
+        break;
+    } else {
+      cp_image_t img = cp_load_png_mem(png, len);
+      if(img.pix == NULL)
+        break;
+      cp_free_png(&img);
+    }
+    bytes += sizeof(cp_pixel_t) * w * h;
+  } while((elapsed = now() - start) < MIN_BENCH_TIME);
+
+  free(block);
+  free(dst);
+  return bytes ? bytes / elapsed / 1e6 : 0;
+}
+
+
+void run_decode_benchmarks(const char **files, int file_count) {
+  printf("\ncp_load_png_mem                      whole image      streaming          arena\n");
+  for(int i = 0; i < file_count; i++) {
+    int len;
+    uint8_t *png = (uint8_t*)cp_read_file_to_memory(files[i], &len);
+    if(png == NULL)
+      continue;
+
+    printf("  %-32s %8.1f MB/s  %8.1f MB/s  %8.1f MB/s\n", files[i],
+        bench_decode(png, len, DECODE_WHOLE),
+        bench_decode(png, len, DECODE_STREAMING),
+        bench_decode(png, len, DECODE_ARENA));
+    CUTE_PNG_FREE(png);
+  }
+}
+
+
+enum {
+  KERNEL_GREY = 1, KERNEL_GREY_ALPHA, KERNEL_RGB, KERNEL_RGBA,
+  KERNEL_DEPALETTE, KERNEL_PREMULTIPLY, KERNEL_FLIP, KERNEL_COUNT
+};
+
+const char *kernel_names[KERNEL_COUNT] = {
+  NULL, "grey to RGBA", "grey+alpha to RGBA", "RGB to RGBA", "RGBA copy",
+  "depalette", "premultiply", "flip",
+};
+
+const char *kernel_level_names[] = { "portable", "SSE2", "AVX2" };
+
+
+// Returns MB/s of RGBA pixels written by one kernel over the whole image
+double bench_kernel(const cp_kernels_t *k, int kernel, const uint8_t *src,
+    cp_pixel_t *pix, const cp_pixel_t *palette) {
+  const int w = KERNEL_WIDTH, h = KERNEL_HEIGHT;
+  double bytes = 0, start = now(), elapsed;
+
+  do {
+    switch(kernel) {
+      case KERNEL_DEPALETTE:
+        for(int y = 0; y < h; y++)
+          k->depalette(src + y * w, pix + y * w, w, palette);
+        break;
+      case KERNEL_PREMULTIPLY:
+        k->premultiply(pix, w * h);
+        break;
+      case KERNEL_FLIP:
+        for(int y = 0; y < h / 2; y++)
+          k->swap(pix + y * w, pix + (h - y - 1) * w, w);
+        break;
+      default:
+        for(int y = 0; y < h; y++)
+          k->convert[kernel](src + y * w * kernel, pix + y * w, w);
+    }
+    bytes += sizeof(cp_pixel_t) * w * h;
+  } while((elapsed = now() - start) < MIN_BENCH_TIME);
+
+  return bytes / elapsed / 1e6;
+}
+
+
+void run_kernel_benchmarks(void) {
+  uint8_t *src = malloc(KERNEL_WIDTH * KERNEL_HEIGHT * 4);
+  cp_pixel_t *pix = malloc(sizeof(cp_pixel_t) * KERNEL_WIDTH * KERNEL_HEIGHT);
+  cp_pixel_t palette[256];
+  for(int i = 0; i < KERNEL_WIDTH * KERNEL_HEIGHT * 4; i++)
+    src[i] = rand();
+  memcpy(palette, src, sizeof(palette));
+  memcpy(pix, src, sizeof(cp_pixel_t) * KERNEL_WIDTH * KERNEL_HEIGHT);
+
+  // Levels the CPU doesn't have pick the same kernels as the one below
+  cp_kernels_t kernels[3];
+  int level_count = 1;
+  cp_select_kernels(&kernels[0], CUTE_PNG_KERNELS_PORTABLE);
+  for(int level = 1; level < 3; level++) {
+    cp_select_kernels(&kernels[level], level);
+    if(memcmp(&kernels[level], &kernels[level - 1], sizeof(cp_kernels_t)))
+      level_count = level + 1;
+  }
+
+  printf("\npixel kernels, %dx%d", KERNEL_WIDTH, KERNEL_HEIGHT);
+  for(int level = 0; level < level_count; level++)
+    printf("%21s", kernel_level_names[level]);
+  printf("\n");
+
+  for(int kernel = 1; kernel < KERNEL_COUNT; kernel++) {
+    printf("  %-22s", kernel_names[kernel]);
+    double base = 0;
+    for(int level = 0; level < level_count; level++) {
+      double mbps = bench_kernel(&kernels[level], kernel, src, pix, palette);
+      if(level == 0) {
+        base = mbps;
+        printf(" %8.1f MB/s       ", mbps);
+      } else {
+        printf(" %8.1f MB/s %5.2fx", mbps, mbps / base);
+      }
+    }
+    printf("\n");
+  }
+
+  free(pix);
+  free(src);
+}
+
+
+// The checksums cp_save_png used to have, kept as a baseline
+uint32_t crc32_nibble(uint32_t crc, const uint8_t *p, int len) {
+  static const uint32_t table[16] = {
+    0, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+  };
+  crc = ~crc;
+  while(len--) {
+    crc = (crc >> 4) ^ table[(crc & 15) ^ (*p & 15)];
+    crc = (crc >> 4) ^ table[(crc & 15) ^ (*p++ >> 4)];
+  }
+  return ~crc;
+}
+
+
+uint32_t adler32_per_byte(uint32_t adler, const uint8_t *p, int len) {
+  uint32_t s1 = adler & 0xFFFF, s2 = adler >> 16;
+  while(len--) {
+    s1 = (s1 + *p++) % 65521;
+    s2 = (s2 + s1) % 65521;
+  }
+  return (s2 << 16) | s1;
+}
+
+
+typedef uint32_t checksum_fn(uint32_t sum, const uint8_t *p, int len);
+
+// Returns MB/s checksummed and the checksum in sum
+double bench_checksum(checksum_fn *fn, uint32_t init, const uint8_t *p,
+    int len, uint32_t *sum) {
+  double bytes = 0, start = now(), elapsed;
+
+  do {
+    *sum = fn(init, p, len);
+    bytes += len;
+  } while((elapsed = now() - start) < MIN_BENCH_TIME);
+
+  return bytes / elapsed / 1e6;
+}
+
+
+void run_checksum_benchmarks(void) {
+  const int len = KERNEL_WIDTH * KERNEL_HEIGHT * 4;
+  uint8_t *data = malloc(len);
+  for(int i = 0; i < len; i++)
+    data[i] = rand();
+
+  // cp_crc32 and cp_adler32 pick PCLMULQDQ, SSE2 or AVX2 when they can
+  const struct {
+    const char *name;
+    uint32_t init;
+    checksum_fn *fn[3];
+  } checksums[] = {
+    { "CRC-32", 0, { crc32_nibble, cp_crc32_portable, cp_crc32 } },
+    { "Adler-32", 1, { adler32_per_byte, cp_adler32_portable, cp_adler32 } },
+  };
+
+  char title[32];
+  snprintf(title, sizeof(title), "checksums, %d MB", len >> 20);
+  printf("\n%-24s%21s%21s%21s\n", title, "old", "portable", "best");
+  for(int i = 0; i < 2; i++) {
+    double base = 0;
+    uint32_t expect = 0, sum;
+    printf("  %-22s", checksums[i].name);
+    for(int j = 0; j < 3; j++) {
+      double mbps = bench_checksum(checksums[i].fn[j], checksums[i].init,
+          data, len, &sum);
+      if(j == 0) {
+        base = mbps;
+        expect = sum;
+        printf(" %8.1f MB/s       ", mbps);
+      } else {
+        printf(" %8.1f MB/s %5.2fx", mbps, mbps / base);
+      }
+      if(sum != expect)
+        printf(" MISMATCH");
+    }
+    printf("\n");
+  }
+
+  free(data);
+}
+
+
+void run_atlas_benchmarks(void) {
+  static cp_pixel_t sprite_pixels[SPRITE_MAX * SPRITE_MAX];
+  int max_count = atlas_sprite_counts[ATLAS_RUNS - 1];
+  cp_image_t *sprites = malloc(sizeof(cp_image_t) * max_count);
+  cp_atlas_image_t *placed = malloc(sizeof(cp_atlas_image_t) * max_count);
+  cp_image_t pages[ATLAS_MAX_PAGES];
+
+  // The sprites only need sizes, they can all share the pixels
+  for(int i = 0; i < max_count; i++) {
+    sprites[i].w = SPRITE_MIN + rand() % (SPRITE_MAX - SPRITE_MIN + 1);
+    sprites[i].h = SPRITE_MIN + rand() % (SPRITE_MAX - SPRITE_MIN + 1);
+    sprites[i].pix = sprite_pixels;
+  }
+
+  printf("\natlas packing, %d-%d pixel sprites on pages up to %dx%d\n",
+      SPRITE_MIN, SPRITE_MAX, ATLAS_SIZE, ATLAS_SIZE);
+  for(int run = 0; run < ATLAS_RUNS; run++) {
+    int count = atlas_sprite_counts[run];
+    double start = now();
+    int page_count = cp_make_atlas_pages(ATLAS_SIZE, ATLAS_SIZE, sprites,
+        count, placed, pages, ATLAS_MAX_PAGES);
+    double elapsed = now() - start;
+    if(page_count == 0) {
+      printf("  %6d sprites  %s\n", count, cp_error_reason);
+      continue;
+    }
+
+    double sprite_area = 0, page_area = 0;
+    for(int i = 0; i < count; i++)
+      sprite_area += (double)sprites[i].w * sprites[i].h;
+    for(int i = 0; i < page_count; i++) {
+      page_area += (double)pages[i].w * pages[i].h;
+      cp_free_png(&pages[i]);
+    }
+
+    printf("  %6d sprites %8.2f ms %4d pages %7.1f%% filled\n",
+        count, elapsed * 1e3, page_count, sprite_area / page_area * 100);
+  }
+
+  free(placed);
+  free(sprites);
+}
+
+
+// Returns MB/s of RGBA input and the size of the PNG in size, or 0 if
+// encoding fails or the PNG doesn't decode back to the same pixels
+double bench_encode(const cp_image_t *img, int level, int threads, int *size) {
+  double bytes = 0, start = now(), elapsed;
+  int pixel_bytes = img->w * img->h * sizeof(cp_pixel_t);
+
+  do {
+    void *png = cp_save_png_mem_parallel(img, level, threads, size);
+    if(png == NULL)
+      return 0;
+
+    if(bytes == 0) {
+      cp_image_t check = cp_load_png_mem(png, *size);
+      int same = check.pix && memcmp(check.pix, img->pix, pixel_bytes) == 0;
+      cp_free_png(&check);
+      if(!same) {
+        CUTE_PNG_FREE(png);
+        cp_error_reason = "round trip mismatch";
+        return 0;
+      }
+    }
+
+    CUTE_PNG_FREE(png);
+    bytes += pixel_bytes;
+  } while((elapsed = now() - start) < MIN_BENCH_TIME);
+
+  return bytes / elapsed / 1e6;
+}
+
+
+void run_encode_benchmarks(const char **files, int file_count) {
+  double total_bytes = 0, total_time[LEVEL_COUNT] = {0};
+  long total_size[LEVEL_COUNT] = {0};
+
+  printf("\ncp_save_png_mem");
+  for(int l = 0; l < LEVEL_COUNT; l++)
+    printf("%*s level %d", l ? 12 : 19, "", bench_levels[l]);
+  printf("\n");
+
+  for(int i = 0; i < file_count; i++) {
+    cp_image_t img = cp_load_png(files[i]);
+    if(img.pix == NULL)
+      continue;
+
+    double mbps[LEVEL_COUNT];
+    int size[LEVEL_COUNT];
+    for(int l = 0; l < LEVEL_COUNT; l++)
+      mbps[l] = bench_encode(&img, bench_levels[l], 1, &size[l]);
+
+    printf("  %-32s", files[i]);
+    for(int l = 0; l < LEVEL_COUNT; l++) {
+      if(mbps[l] == 0)
+        printf(" %19s", cp_error_reason);
+      else
+        printf(" %8d %7.1f MB/s", size[l], mbps[l]);
+    }
+    printf("\n");
+
+    if(mbps[0] > 0) {
+      double pixel_bytes = img.w * img.h * sizeof(cp_pixel_t);
+      total_bytes += pixel_bytes;
+      for(int l = 0; l < LEVEL_COUNT; l++) {
+        total_size[l] += size[l];
+        total_time[l] += mbps[l] > 0 ? pixel_bytes / (mbps[l] * 1e6) : 0;
+      }
+    }
+
+    cp_free_png(&img);
+  }
+
+  if(total_bytes == 0)
+    return;
+
+  printf("  %-32s", "overall");
+  for(int l = 0; l < LEVEL_COUNT; l++)
+    printf(" %8ld %7.1f MB/s", total_size[l], total_bytes / total_time[l] / 1e6);
+  printf("\n  %-32s", "size vs level 0");
+  for(int l = 0; l < LEVEL_COUNT; l++)
+    printf(" %18.1f%%", 100.0 * total_size[l] / total_size[0]);
+  printf("\n");
+}
+
+
+void run_parallel_benchmarks(const char *file) {
+  cp_image_t tile = cp_load_png(file);
+  if(tile.pix == NULL)
+    return;
+
+  cp_image_t img = { tile.w * TILES, tile.h * TILES, NULL };
+  img.pix = malloc(sizeof(cp_pixel_t) * img.w * img.h);
+  for(int y = 0; y < img.h; y++)
+    for(int x = 0; x < img.w; x += tile.w)
+      memcpy(&img.pix[y * img.w + x], &tile.pix[(y % tile.h) * tile.w],
+          sizeof(cp_pixel_t) * tile.w);
+
+  printf("\ncp_save_png_mem_parallel, %s tiled to %dx%d, level %d\n",
+      file, img.w, img.h, CUTE_PNG_DEFAULT_LEVEL);
+
+  int cores = sysconf(_SC_NPROCESSORS_ONLN);
+  double base = 0;
+  for(int threads = 1; ; threads *= 2) {
+    if(threads > cores)
+      threads = cores;
+
+    int size;
+    double mbps = bench_encode(&img, CUTE_PNG_DEFAULT_LEVEL, threads, &size);
+    if(mbps == 0) {
+      printf("  %2d threads %s\n", threads, cp_error_reason);
+      break;
+    }
+
+    if(base == 0)
+      base = mbps;
+    printf("  %2d threads %10d bytes %8.1f MB/s %6.2fx\n",
+        threads, size, mbps, mbps / base);
+
+    if(threads >= cores)
+      break;
+  }
+
+  free(img.pix);
+  cp_free_png(&tile);
+}
+
+
+// The generated corpus, each image is described by one of these
+typedef struct {
+  int color_type, w, h, content, filter;
+} CorpusImage;
+
+enum { CONTENT_NOISE, CONTENT_GRADIENT, CONTENT_SPRITES };
+const char *content_names[] = { "noise", "gradient", "sprites" };
+
+#define FILTER_ADAPTIVE 5 // 0-4 filter every row the same way
+const char *filter_names[] = { "none", "sub", "up", "average", "paeth", "adaptive" };
+
+const CorpusImage corpus_images[] = {
+  { 0, 512, 512, CONTENT_NOISE, FILTER_ADAPTIVE },
+  { 0, 512, 512, CONTENT_GRADIENT, FILTER_ADAPTIVE },
+  { 0, 512, 512, CONTENT_SPRITES, FILTER_ADAPTIVE },
+  { 2, 512, 512, CONTENT_NOISE, FILTER_ADAPTIVE },
+  { 2, 512, 512, CONTENT_GRADIENT, FILTER_ADAPTIVE },
+  { 2, 512, 512, CONTENT_SPRITES, FILTER_ADAPTIVE },
+  { 3, 512, 512, CONTENT_NOISE, FILTER_ADAPTIVE },
+  { 3, 512, 512, CONTENT_GRADIENT, FILTER_ADAPTIVE },
+  { 3, 512, 512, CONTENT_SPRITES, FILTER_ADAPTIVE },
+  { 4, 512, 512, CONTENT_NOISE, FILTER_ADAPTIVE },
+  { 4, 512, 512, CONTENT_GRADIENT, FILTER_ADAPTIVE },
+  { 4, 512, 512, CONTENT_SPRITES, FILTER_ADAPTIVE },
+  { 6, 512, 512, CONTENT_NOISE, FILTER_ADAPTIVE },
+  { 6, 512, 512, CONTENT_GRADIENT, FILTER_ADAPTIVE },
+  { 6, 512, 512, CONTENT_SPRITES, FILTER_ADAPTIVE },
+
+  { 6, 512, 512, CONTENT_GRADIENT, 0 },
+  { 6, 512, 512, CONTENT_GRADIENT, 1 },
+  { 6, 512, 512, CONTENT_GRADIENT, 2 },
+  { 6, 512, 512, CONTENT_GRADIENT, 3 },
+  { 6, 512, 512, CONTENT_GRADIENT, 4 },
+
+  { 6, 16, 16, CONTENT_SPRITES, FILTER_ADAPTIVE },
+  { 6, 64, 64, CONTENT_SPRITES, FILTER_ADAPTIVE },
+  { 6, 2048, 1024, CONTENT_SPRITES, FILTER_ADAPTIVE },
+  { 6, 2048, 8, CONTENT_NOISE, FILTER_ADAPTIVE },
+  { 2, 8, 2048, CONTENT_GRADIENT, FILTER_ADAPTIVE },
+};
+#define CORPUS_SIZE (int)(sizeof(corpus_images) / sizeof(corpus_images[0]))
+
+// Colours for the sprite content and the start of every palette
+const cp_pixel_t sprite_colors[8] = {
+  { 0, 0, 0, 0 }, { 200, 40, 40, 255 }, { 240, 230, 210, 255 },
+  { 30, 30, 30, 255 }, { 60, 140, 60, 255 }, { 250, 200, 40, 255 },
+  { 40, 80, 200, 128 }, { 120, 70, 30, 255 },
+};
+
+
+const char *color_type_name(int color_type) {
+  switch(color_type) {
+    case 0: return "grey";
+    case 2: return "RGB";
+    case 3: return "palette";
+    case 4: return "grey+alpha";
+    default: return "RGBA";
+  }
+}
+
+
+// Raw pixels for an image in its own colour type, and the RGBA they should
+// decode to in expect
+uint8_t *make_pixels(const CorpusImage *c, const cp_pixel_t *palette, cp_image_t *expect) {
+  int bpp = png_bytes_per_pixel(c->color_type);
+  uint8_t *raw = malloc(c->w * c->h * bpp);
+  expect->w = c->w;
+  expect->h = c->h;
+  expect->pix = malloc(sizeof(cp_pixel_t) * c->w * c->h);
+
+  for(int y = 0; y < c->h; y++) {
+    for(int x = 0; x < c->w; x++) {
+      uint8_t *p = raw + (y * c->w + x) * bpp;
+      cp_pixel_t *e = &expect->pix[y * c->w + x];
+
+      // Flat circles on a transparent background, one per 16x16 cell
+      int dx = x % 16 - 8, dy = y % 16 - 8;
+      int color = (x / 16 * 7 + y / 16 * 13) % 7 + 1;
+      if(dx * dx + dy * dy > 36)
+        color = 0;
+
+      for(int i = 0; i < bpp; i++) {
+        // Which of r, g, b and a this byte is, for the colour types without index
+        int channel = bpp == 2 && i == 1 ? 3 : i;
+        switch(c->content) {
+          case CONTENT_NOISE:
+            p[i] = rand();
+            break;
+          case CONTENT_GRADIENT:
+            p[i] = (x * (i + 1) + y * (bpp - i)) * 255 / (c->w * (i + 1) + c->h * (bpp - i));
+            break;
+          default:
+            p[i] = c->color_type == 3 ? color : (&sprite_colors[color].r)[channel];
+        }
+      }
+
+      switch(c->color_type) {
+        case 0: *e = (cp_pixel_t){ p[0], p[0], p[0], 255 }; break;
+        case 2: *e = (cp_pixel_t){ p[0], p[1], p[2], 255 }; break;
+        case 3: *e = palette[p[0]]; break;
+        case 4: *e = (cp_pixel_t){ p[0], p[0], p[0], p[1] }; break;
+        default: *e = (cp_pixel_t){ p[0], p[1], p[2], p[3] };
+      }
+    }
+  }
+
+  return raw;
+}
+
+
+// Same as cp_filter_row, which only handles RGBA
+void filter_row(int filter, int bpp, int len, const uint8_t *raw, const uint8_t *prev, uint8_t *out) {
+  for(int x = 0; x < len; x++) {
+    int a = x >= bpp ? raw[x - bpp] : 0, b = prev[x], c = x >= bpp ? prev[x - bpp] : 0;
+    switch(filter) {
+      case 0: out[x] = raw[x]; break;
+      case 1: out[x] = raw[x] - a; break;
+      case 2: out[x] = raw[x] - b; break;
+      case 3: out[x] = raw[x] - (a + b) / 2; break;
+      default: out[x] = raw[x] - cp_paeth(a, b, c);
+    }
+  }
+}
+
+
+// Filters the rows one way, or picks the filter per row with the smallest
+// sum of absolute differences, like cp_save_png does
+uint8_t *filter_pixels(const CorpusImage *c, const uint8_t *raw, int *filtered_len) {
+  int len = c->w * png_bytes_per_pixel(c->color_type);
+  int bpp = png_bytes_per_pixel(c->color_type);
+  uint8_t *filtered = malloc((len + 1) * c->h);
+  uint8_t *zero = calloc(len, 1), *candidate = malloc(len);
+
+  for(int y = 0; y < c->h; y++) {
+    const uint8_t *row = raw + y * len, *prev = y ? row - len : zero;
+    uint8_t *out = filtered + y * (len + 1);
+    int best = c->filter;
+
+    if(c->filter == FILTER_ADAPTIVE) {
+      long best_sum = -1;
+      for(int filter = 0; filter < 5; filter++) {
+        long sum = 0;
+        filter_row(filter, bpp, len, row, prev, candidate);
+        for(int x = 0; x < len; x++)
+          sum += abs((int8_t)candidate[x]);
+        if(best_sum < 0 || sum < best_sum) {
+          best_sum = sum;
+          best = filter;
+        }
+      }
+    }
+
+    out[0] = best;
+    filter_row(best, bpp, len, row, prev, out + 1);
+  }
+
+  free(candidate);
+  free(zero);
+  *filtered_len = (len + 1) * c->h;
+  return filtered;
+}
+
+
+// Builds a PNG for a corpus image out of the encoder's pieces, as
+// cp_save_png only writes RGBA. Returns the RGBA it should decode to in
+// expect.
+uint8_t *make_png(const CorpusImage *c, int *len, cp_image_t *expect) {
+  cp_pixel_t palette[256];
+  memcpy(palette, sprite_colors, sizeof(sprite_colors));
+  for(int i = 8; i < 256; i++)
+    palette[i] = (cp_pixel_t){ rand(), rand(), rand(), rand() };
+
+  int filtered_len;
+  uint8_t *raw = make_pixels(c, palette, expect);
+  uint8_t *filtered = filter_pixels(c, raw, &filtered_len);
+
+  cp_save_png_data_t zlib = {0}, png = {0};
+  cp_deflate_t *d = malloc(sizeof(cp_deflate_t));
+  cp_deflate_init(d, CUTE_PNG_DEFAULT_LEVEL);
+  cp_put8(&zlib, 0x78);
+  cp_put8(&zlib, 0x9C);
+  cp_deflate(d, &zlib, filtered, 0, filtered_len, 1);
+  cp_align_bits(&zlib);
+  cp_put32(&zlib, cp_adler32(1, filtered, filtered_len));
+
+  uint8_t ihdr[13] = {
+    c->w >> 24, c->w >> 16, c->w >> 8, c->w,
+    c->h >> 24, c->h >> 16, c->h >> 8, c->h,
+    8, c->color_type, 0, 0, 0,
+  };
+  cp_put_bytes(&png, "\211PNG\r\n\032\n", 8);
+  cp_put_chunk(&png, "IHDR", ihdr, 13);
+  if(c->color_type == 3) {
+    uint8_t plte[256 * 3], trns[256];
+    for(int i = 0; i < 256; i++) {
+      plte[i * 3] = palette[i].r;
+      plte[i * 3 + 1] = palette[i].g;
+      plte[i * 3 + 2] = palette[i].b;
+      trns[i] = palette[i].a;
+    }
+    cp_put_chunk(&png, "PLTE", plte, sizeof(plte));
+    cp_put_chunk(&png, "tRNS", trns, sizeof(trns));
+  }
+  cp_put_chunk(&png, "IDAT", zlib.out, zlib.len);
+  cp_put_chunk(&png, "IEND", NULL, 0);
+
+  free(d);
+  free(filtered);
+  free(raw);
+  CUTE_PNG_FREE(zlib.out);
+  *len = png.len;
+  return png.out;
+}
+
+
+// A corpus image in all the forms the operations below need
+typedef struct {
+  char name[64];
+  uint8_t *png;
+  int len;
+  uint8_t *stream, *inflated;
+  int stream_len, raw_len;
+  cp_image_t expect;
+  int ok;
+} CorpusFile;
+
+enum { OP_DECODE, OP_INFLATE, OP_ENCODE, OP_COUNT };
+const char *op_names[OP_COUNT] = { "decode", "inflate", "encode" };
+
+// Heap used by one call, peak is on top of whatever was already in use
+typedef struct {
+  long allocs, bytes, peak;
+} HeapUse;
+
+typedef struct {
+  double mbps;
+  HeapUse heap;
+  int size;
+} OpResult;
+
+
+// Starts counting heap use, returns the counters to pass to heap_use
+HeapUse heap_mark(void) {
+  long in_use = atomic_load(&heap_in_use);
+  atomic_store(&heap_peak, in_use);
+  return (HeapUse){ atomic_load(&alloc_count), atomic_load(&alloc_bytes), in_use };
+}
+
+
+HeapUse heap_use(HeapUse mark) {
+  return (HeapUse){
+    atomic_load(&alloc_count) - mark.allocs,
+    atomic_load(&alloc_bytes) - mark.bytes,
+    atomic_load(&heap_peak) - mark.peak,
+  };
+}
+
+
+// Runs an operation once, returns how many bytes it produced or took in,
+// or 0 if it failed
+int run_corpus_op(int op, CorpusFile *f, int *size) {
+  switch(op) {
+    case OP_DECODE: {
+      cp_image_t img = cp_load_png_mem(f->png, f->len);
+      if(img.pix == NULL)
+        return 0;
+      cp_free_png(&img);
+      return sizeof(cp_pixel_t) * f->expect.w * f->expect.h;
+    }
+    case OP_INFLATE:
+      return cp_inflate(f->stream, f->stream_len, f->inflated, f->raw_len) ? f->raw_len : 0;
+    default: {
+      void *png = cp_save_png_mem(&f->expect, CUTE_PNG_DEFAULT_LEVEL, size);
+      if(png == NULL)
+        return 0;
+      CUTE_PNG_FREE(png);
+      return sizeof(cp_pixel_t) * f->expect.w * f->expect.h;
+    }
+  }
+}
+
+
+OpResult bench_corpus_op(int op, CorpusFile *f) {
+  OpResult r = {0};
+  HeapUse mark = heap_mark();
+  if(run_corpus_op(op, f, &r.size) == 0)
+    return r;
+  r.heap = heap_use(mark);
+
+  double bytes = 0, start = now(), elapsed;
+  do {
+    bytes += run_corpus_op(op, f, &r.size);
+  } while((elapsed = now() - start) < CORPUS_BENCH_TIME);
+
+  r.mbps = bytes / elapsed / 1e6;
+  return r;
+}
+
+
+// Decodes the file and the encoder's output of it, both must match the
+// generated pixels
+int check_corpus_file(CorpusFile *f) {
+  size_t pixel_bytes = sizeof(cp_pixel_t) * f->expect.w * f->expect.h;
+  cp_image_t img = cp_load_png_mem(f->png, f->len);
+  int ok = img.pix && memcmp(img.pix, f->expect.pix, pixel_bytes) == 0;
+  cp_free_png(&img);
+
+  int size;
+  void *png = ok ? cp_save_png_mem(&f->expect, CUTE_PNG_DEFAULT_LEVEL, &size) : NULL;
+  if(png) {
+    img = cp_load_png_mem(png, size);
+    ok = img.pix && memcmp(img.pix, f->expect.pix, pixel_bytes) == 0;
+    cp_free_png(&img);
+    CUTE_PNG_FREE(png);
+  }
+
+  return ok && png;
+}
+
+
+void write_heap_json(FILE *json, HeapUse heap) {
+  fprintf(json, "\"allocs\": %ld, \"alloc_bytes\": %ld, \"peak_heap_bytes\": %ld",
+      heap.allocs, heap.bytes, heap.peak);
+}
+
+
+// Returns how many of the corpus images failed, results go to json if it
+// isn't NULL
+int run_corpus_benchmarks(FILE *json) {
+  CorpusFile *files = calloc(CORPUS_SIZE, sizeof(CorpusFile));
+  int failures = 0;
+
+  srand(CORPUS_SEED);
+  for(int i = 0; i < CORPUS_SIZE; i++) {
+    const CorpusImage *c = &corpus_images[i];
+    CorpusFile *f = &files[i];
+    snprintf(f->name, sizeof(f->name), "%s %dx%d %s %s", color_type_name(c->color_type),
+        c->w, c->h, content_names[c->content], filter_names[c->filter]);
+    f->png = make_png(c, &f->len, &f->expect);
+    f->stream = get_deflate_stream(f->png, f->len, &f->stream_len, &f->raw_len);
+    f->inflated = malloc(f->raw_len);
+    f->ok = check_corpus_file(f);
+  }
+
+  printf("\ngenerated corpus, encoding at level %d\n", CUTE_PNG_DEFAULT_LEVEL);
+  printf("  %-38s%10s", "", "png bytes");
+  for(int op = 0; op < OP_COUNT; op++)
+    printf(" %13s %6s %8s", op_names[op], "allocs", "peak");
+  printf("\n");
+
+  if(json)
+    fprintf(json, "  \"corpus\": [\n");
+
+  for(int i = 0; i < CORPUS_SIZE; i++) {
+    CorpusFile *f = &files[i];
+    OpResult r[OP_COUNT];
+    for(int op = 0; op < OP_COUNT; op++)
+      r[op] = bench_corpus_op(op, f);
+
+    printf("  %-38s%10d", f->name, f->len);
+    for(int op = 0; op < OP_COUNT; op++)
+      printf(" %8.1f MB/s %6ld %7ldK", r[op].mbps, r[op].heap.allocs, r[op].heap.peak >> 10);
+    if(!f->ok) {
+      printf(" FAILED");
+      failures++;
+    }
+    printf("\n");
+
+    if(json == NULL)
+      continue;
+
+    const CorpusImage *c = &corpus_images[i];
+    fprintf(json, "    { \"name\": \"%s\", \"color_type\": %d, \"width\": %d, \"height\": %d, "
+        "\"content\": \"%s\", \"filter\": \"%s\", \"png_bytes\": %d, \"ok\": %s",
+        f->name, c->color_type, c->w, c->h, content_names[c->content],
+        filter_names[c->filter], f->len, f->ok ? "true" : "false");
+    for(int op = 0; op < OP_COUNT; op++) {
+      fprintf(json, ",\n      \"%s\": { \"mb_per_sec\": %.1f, ", op_names[op], r[op].mbps);
+      write_heap_json(json, r[op].heap);
+      if(op == OP_ENCODE)
+        fprintf(json, ", \"png_bytes\": %d", r[op].size);
+      fprintf(json, " }");
+    }
+    fprintf(json, " }%s\n", i + 1 < CORPUS_SIZE ? "," : "");
+  }
+
+  // All of the images at once, on the largest pages
+  cp_image_t *images = malloc(sizeof(cp_image_t) * CORPUS_SIZE);
+  cp_atlas_image_t *placed = malloc(sizeof(cp_atlas_image_t) * CORPUS_SIZE);
+  cp_image_t pages[ATLAS_MAX_PAGES];
+  double image_area = 0, page_area = 0;
+  for(int i = 0; i < CORPUS_SIZE; i++) {
+    images[i] = files[i].expect;
+    image_area += (double)images[i].w * images[i].h;
+  }
+
+  int page_count = 0, runs = 0;
+  HeapUse heap = {0};
+  double start = now(), elapsed;
+  do {
+    HeapUse mark = heap_mark();
+    page_count = cp_make_atlas_pages(ATLAS_SIZE, ATLAS_SIZE, images, CORPUS_SIZE,
+        placed, pages, ATLAS_MAX_PAGES);
+    if(runs++ == 0)
+      heap = heap_use(mark);
+
+    page_area = 0;
+    for(int i = 0; i < page_count; i++) {
+      page_area += (double)pages[i].w * pages[i].h;
+      cp_free_png(&pages[i]);
+    }
+  } while(page_count && (elapsed = now() - start) < CORPUS_BENCH_TIME);
+
+  if(page_count == 0) {
+    printf("  %-38s %s FAILED\n", "cp_make_atlas_pages", cp_error_reason);
+    failures++;
+  } else {
+    printf("  %-38s%8.2f ms %4d pages %7.1f%% filled %6ld allocs %7ldK peak\n",
+        "cp_make_atlas_pages", elapsed / runs * 1e3, page_count,
+        image_area / page_area * 100, heap.allocs, heap.peak >> 10);
+  }
+
+  if(json) {
+    fprintf(json, "  ],\n  \"atlas\": { \"images\": %d, \"ok\": %s, \"ms\": %.3f, "
+        "\"pages\": %d, \"filled\": %.4f, ", CORPUS_SIZE, page_count ? "true" : "false",
+        page_count ? elapsed / runs * 1e3 : 0, page_count,
+        page_count ? image_area / page_area : 0);
+    write_heap_json(json, heap);
+    fprintf(json, " },\n");
+  }
+
+  for(int i = 0; i < CORPUS_SIZE; i++) {
+    free(files[i].expect.pix);
+    free(files[i].inflated);
+    free(files[i].stream);
+    CUTE_PNG_FREE(files[i].png);
+  }
+  free(placed);
+  free(images);
+  free(files);
+  return failures;
+}
+
+
+// Peak resident set of the whole run in KB, ru_maxrss is in bytes on macOS
+long peak_rss_kb(void) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+}
+
+
+void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-j RESULTS.json] [FILE.png...]\n", prog);
+  exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[]) {
+  const char **files = default_files;
+  int file_count = sizeof(default_files) / sizeof(default_files[0]);
+  FILE *json = NULL;
+
+  int opt;
+  while((opt = getopt(argc, argv, "j:")) != -1) {
+    switch(opt) {
+      case 'j':
+        if((json = fopen(optarg, "w")) == NULL) {
+          perror(optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      default: usage(argv[0]);
+    }
+  }
+
+  if(optind < argc) {
+    files = (const char**)argv + optind;
+    file_count = argc - optind;
+  }
+
+#ifdef CUTE_PNG_NO_FAST_INFLATE
+  printf("cp_inflate (careful loop only)\n");
+#else
+  printf("cp_inflate\n");
+#endif
+
+  double total_bytes = 0, total_time = 0;
+  for(int i = 0; i < file_count; i++) {
+    int len, stream_len, raw_len;
+    uint8_t *png = (uint8_t*)cp_read_file_to_memory(files[i], &len);
+    uint8_t *stream = png ? get_deflate_stream(png, len, &stream_len, &raw_len) : NULL;
+    if(stream == NULL) {
+      fprintf(stderr, "%s: not a readable PNG\n", files[i]);
+      CUTE_PNG_FREE(png);
+      continue;
+    }
+
+    double mbps = bench_inflate(stream, stream_len, raw_len);
+    if(mbps == 0)
+      printf("  %-32s %s\n", files[i], cp_error_reason);
+    else
+      printf("  %-32s %8d -> %8d bytes %10.1f MB/s\n",
+          files[i], stream_len, raw_len, mbps);
+
+    if(mbps > 0) {
+      total_bytes += raw_len;
+      total_time += raw_len / (mbps * 1e6);
+    }
+
+    free(stream);
+    CUTE_PNG_FREE(png);
+  }
+
+  if(total_time > 0)
+    printf("  %-32s %37.1f MB/s\n", "overall", total_bytes / total_time / 1e6);
+
+  run_decode_benchmarks(files, file_count);
+  run_kernel_benchmarks();
+  run_checksum_benchmarks();
+  run_atlas_benchmarks();
+  run_encode_benchmarks(files, file_count);
+  run_parallel_benchmarks(files[0]);
+
+#ifdef CUTE_PNG_NO_FAST_INFLATE
+  int careful = 1;
+#else
+  int careful = 0;
+#endif
+  if(json)
+    fprintf(json, "{\n  \"careful_inflate\": %s,\n  \"seed\": %d,\n",
+        careful ? "true" : "false", CORPUS_SEED);
+  int failures = run_corpus_benchmarks(json);
+
+  long rss = peak_rss_kb();
+  printf("\npeak RSS %ld KB\n", rss);
+  if(json) {
+    fprintf(json, "  \"peak_rss_kb\": %ld\n}\n", rss);
+    fclose(json);
+  }
+
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,4 +1,5 @@
 #include "checkers.h"
+#include <assert.h>
 #include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -7,9 +8,26 @@ int sign(int x) {
   return (x > 0) - (x < 0);
 }
 
+#define BOARD_SQUARES (BOARD_WIDTH * BOARD_HEIGHT)
+#define LIVE_SQUARES (BOARD_SQUARES / 2)
+#define SQUARE(x,y) ((y) * BOARD_WIDTH + (x))
+
+// Direction from x1,y1 towards x2,y2, as numbered in the tables
+#define DIRECTION(x1,y1,x2,y2) (((x2) > (x1)) | ((y2) > (y1)) << 1)
+
+// Evaluation weights, the piece-square ones are in the tables
+#define MAN_WORTH 100
+#define KING_WORTH 50 // on top of what it's worth as a piece
+
+// Square, neighbour, jump, promotion and piece-square tables from gen_tables
+#include "checkers_tables.h"
+
 // Empty spaces are ' ', occupied spaces are w,W,b,B
 static char board[BOARD_WIDTH][BOARD_HEIGHT];
 
+// Kept up to date with the board by set_piece
+static Evaluation evaluation;
+
 
 // Return true if the location is valid
 bool is_location_valid(int x, int y) {
@@ -19,7 +37,7 @@ bool is_location_valid(int x, int y) {
 
 // Return true if the location is live (dark squares where pieces may move)
 bool is_location_live(int x, int y) {
-  return is_location_valid(x,y) && ((x%2) != (y%2));
+  return is_location_valid(x,y) && live_index[SQUARE(x,y)] >= 0;
 }
 
 
@@ -33,12 +51,69 @@ int get_piece(int x, int y) {
 }
 
 
+// Adds what piece on square s is worth to each term of e, or takes it
+// away again if weight is -1. Black's pieces use the tables turned round.
+static void add_terms(Evaluation *e, char piece, int s, int weight) {
+  bool king = piece == 'W' || piece == 'B';
+  if(piece == 'b' || piece == 'B') {
+    weight = -weight;
+    s = BOARD_SQUARES - 1 - s;
+  } else if(piece != 'w' && piece != 'W') {
+    return;
+  }
+
+  e->material += weight * MAN_WORTH;
+  e->centre += weight * centre[s];
+  if(king) {
+    e->kings += weight * KING_WORTH;
+  } else {
+    e->advancement += weight * advancement[s];
+    e->back_rank += weight * back_rank[s];
+  }
+}
+
+
+// The evaluation terms for the board as it stands
+Evaluation get_evaluation(void) {
+  return evaluation;
+}
+
+
+// The same terms added up from every square, to check the ones kept
+// by set_piece
+Evaluation recompute_evaluation(void) {
+  Evaluation e = { 0, 0, 0, 0, 0 };
+  for(int s = 0; s < BOARD_SQUARES; s++)
+    add_terms(&e, board[locations[s].y][locations[s].x], s, 1);
+  return e;
+}
+
+
+// Score of the board for player p, 'w' or 'b'
+// Built with CHECKERS_DEBUG_EVAL it checks the terms against
+// recompute_evaluation first.
+int evaluate_board(char p) {
+  const Evaluation *e = &evaluation;
+#ifdef CHECKERS_DEBUG_EVAL
+  Evaluation full = recompute_evaluation();
+  assert(full.material == e->material && full.kings == e->kings &&
+      full.advancement == e->advancement && full.centre == e->centre &&
+      full.back_rank == e->back_rank);
+#endif
+
+  int score = e->material + e->kings + e->advancement + e->centre + e->back_rank;
+  return p == 'w' ? score : -score;
+}
+
+
 // Set piece at board location x, y
 // Returns false on error
 bool set_piece(int x, int y, char piece) {
   if(!is_location_valid(x,y))
     return false;
 
+  add_terms(&evaluation, board[y][x], SQUARE(x,y), -1);
+  add_terms(&evaluation, piece, SQUARE(x,y), 1);
   board[y][x] = piece;
   return true;
 }
@@ -61,18 +136,18 @@ int move_piece(int x1, int y1, int x2, int y2) {
     return -1;
 
   int p = get_piece(x1,y1);
+  int from = SQUARE(x1,y1), to = SQUARE(x2,y2);
+  const Jump *jump = &jumps[from][DIRECTION(x1,y1,x2,y2)];
 
   // Promote
-  if(p == 'b' && y2 == 0)
-    p = 'B';
-  else if(p == 'w' && y2 == BOARD_HEIGHT-1)
-    p = 'W';
+  if(promotions[to] == p)
+    p = toupper(p);
 
   // Move and capture
   set_piece(x2,y2,p);
   set_piece(x1,y1,' ');
-  if(abs(x2-x1) == 2) {
-    set_piece(x1+sign(x2-x1), y1+sign(y2-y1), ' ');
+  if(jump->land == to) {
+    set_piece(locations[jump->over].x, locations[jump->over].y, ' ');
     return 1;
   }
 
@@ -80,24 +155,19 @@ int move_piece(int x1, int y1, int x2, int y2) {
 }
 
 
-static void place_ranks(int y, char piece) {
-  for(int x = 0, p = 0; p < 12; p++) {
-    set_piece(x + (y%2 == 0), y, piece);
-
-    x += 2;
-    if(x >= BOARD_WIDTH) {
-      y++;
-      x = 0;
-    }
-  }
+// Place 12 pieces on the dark squares from first on
+static void place_ranks(int first, char piece) {
+  for(int i = first; i < first + 12; i++)
+    set_piece(live_locations[i].x, live_locations[i].y, piece);
 }
 
 
-// Clears the board
+// Clears the board, and the evaluation with it
 void clear_board() {
   for(int y = 0; y < BOARD_HEIGHT; y++)
     for(int x = 0; x < BOARD_WIDTH; x++)
-      set_piece(x, y, ' ');
+      board[y][x] = ' ';
+  evaluation = (Evaluation){ 0, 0, 0, 0, 0 };
 }
 
 
@@ -106,7 +176,7 @@ void clear_board() {
 void init_board() {
   clear_board();
   place_ranks(0, 'w');
-  place_ranks(5, 'b');
+  place_ranks(LIVE_SQUARES - 12, 'b');
 }
 
 
@@ -146,7 +216,8 @@ const char *is_move_valid(int x1, int y1, int x2, int y2, char p) {
   int piece = get_piece(x1, y1);
   bool is_king = isupper(piece);
   piece = tolower(piece);
-  int distance = abs(x2-x1);
+  int from = SQUARE(x1,y1), to = SQUARE(x2,y2);
+  int dir = DIRECTION(x1,y1,x2,y2);
 
   // It must be a known piece
   if(piece != 'w' && piece != 'b') {
@@ -178,15 +249,17 @@ const char *is_move_valid(int x1, int y1, int x2, int y2, char p) {
     return str;
   }
 
-  // Move must be diagonal
-  if(abs(x2-x1) != abs(y2-y1)) {
-    snprintf(str, BUF, "Move must be diagonal");
+  // Move must be diagonal, one square or a jump over one
+  const Jump *jump = &jumps[from][dir];
+  if(neighbours[from][dir] != to && jump->land != to) {
+    snprintf(str, BUF, "Move must be diagonal, one square or a jump");
     return str;
   }
 
   // Jump piece
-  if(distance == 2) {
-    int jumped_piece = get_piece(x1+sign(x2-x1), y1+sign(y2-y1));
+  if(jump->land == to) {
+    const Location *over = &locations[jump->over];
+    int jumped_piece = get_piece(over->x, over->y);
     if(jumped_piece == ' ') {
       snprintf(str, BUF, "Must jump piece to move 2 squares");
       return str;
@@ -14,4 +14,18 @@ bool set_piece(int x, int y, char piece);
 int move_piece(int x1, int y1, int x2, int y2);
 void init_board();
 
+// Evaluation terms, each white's worth less black's. set_piece and
+// move_piece keep them up to date, so evaluating is O(1).
+typedef struct {
+  int material;    // every piece, men and kings alike
+  int kings;       // what kings are worth on top
+  int advancement; // men moving up the board
+  int centre;      // pieces in the middle of the board
+  int back_rank;   // men still on their own back row
+} Evaluation;
+
+Evaluation get_evaluation(void);
+Evaluation recompute_evaluation(void);
+int evaluate_board(char p);
+
 #endif
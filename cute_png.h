@@ -38,11 +38,29 @@
 			free(img.pix);
 			CUTE_PNG_MEMSET(&img, 0, sizeof(img));
 
+		Loading a batch of PNGs through one block of memory
+			cp_arena_t arena;
+			cp_arena_init(&arena, block, block_size);
+			for (int i = 0; i < count; ++i)
+			{
+				cp_image_t img = cp_load_png_arena(paths[i], &arena);
+				...
+				cp_arena_reset(&arena); // img.pix is gone now
+			}
+
 		Saving a PNG to disk
 			cp_save_png("images/example.png", &img);
 			// img is just a raw RGBA buffer, and can come from anywhere,
 			// not only from cp_load*** functions
 
+		Saving a PNG with a compression level
+			cp_save_png_level("images/example.png", &img, 9);
+			// 9 is smallest and slowest, 0 is a quick run length encoder
+
+		Saving a large PNG on several threads
+			#define CUTE_PNG_THREADS // along with CUTE_PNG_IMPLEMENTATION
+			cp_save_png_parallel("images/big.png", &img, 6, 8);
+
 		Creating a texture atlas in memory
 			int w = 1024;
 			int h = 1024;
@@ -52,6 +70,11 @@
 			// provide an array of `cp_atlas_image_t` for `cp_make_atlas` to output important UV info for the
 			// images that fit into the atlas.
 
+		Packing lots of images onto as many atlas pages as they need
+			cp_image_t pages[8];
+			int page_count = cp_make_atlas_pages(2048, 2048, my_png_array, my_png_count, imgs_out, pages, 8);
+			// imgs_out[i].page is the index into `pages` for each image, pages are power of two sizes
+
 		Using the default atlas saver
 			int errors = cp_default_save_atlas("atlas.png", "atlas.txt", atlas_img, atlas_imgs, img_count, names_of_all_images ? names_of_all_images : 0);
 			if (errors) { ... }
@@ -80,17 +103,40 @@
 
 #endif
 
-#define CUTE_PNG_ATLAS_MUST_FIT           1 // returns error from cp_make_atlas if *any* input image does not fit
+#define CUTE_PNG_ATLAS_MUST_FIT           1 // returns error from cp_make_atlas(_pages) if *any* input image does not fit
 #define CUTE_PNG_ATLAS_FLIP_Y_AXIS_FOR_UV 1 // flips output uv coordinate's y. Can be useful to "flip image on load"
 #define CUTE_PNG_ATLAS_EMPTY_COLOR        0x000000FF
 
+#if !defined(CUTE_PNG_DEFAULT_LEVEL)
+	#define CUTE_PNG_DEFAULT_LEVEL 6 // compression level used by cp_save_png, 0-9
+#endif
+
+#if !defined(CUTE_PNG_MAX_THREADS)
+	#define CUTE_PNG_MAX_THREADS 64 // most threads used by cp_save_png_parallel
+#endif
+
+// SIMD kernels are used for unfiltering RGBA images, for converting, premultiplying and
+// flipping pixels and for the CRC-32 and Adler-32 checksums on x86 when the compiler
+// targets SSE2 (always the case on x64), AVX2 and PCLMULQDQ variants are picked at runtime
+// on GCC/Clang. Define CUTE_PNG_NO_SIMD to force the portable scalar code.
+#if !defined(CUTE_PNG_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+	#define CUTE_PNG_SSE2 1
+
+	#if defined(__GNUC__) || defined(__clang__)
+		#define CUTE_PNG_AVX2 1
+		#define CUTE_PNG_PCLMUL 1
+	#endif
+#endif
+
 #include <stdint.h>
+#include <stddef.h>
 #include <limits.h>
 
 typedef struct cp_pixel_t cp_pixel_t;
 typedef struct cp_image_t cp_image_t;
 typedef struct cp_indexed_image_t cp_indexed_image_t;
 typedef struct cp_atlas_image_t cp_atlas_image_t;
+typedef struct cp_arena_t cp_arena_t;
 
 // Read this in the event of errors from any function
 extern const char* cp_error_reason;
@@ -99,26 +145,65 @@ extern const char* cp_error_reason;
 int cp_inflate(void* in, int in_bytes, void* out, int out_bytes);
 int cp_save_png(const char* file_name, const cp_image_t* img);
 
+// Compression level 0 is a fast run length encoder. Levels 1-9 search for LZ77 matches
+// harder as they go up, and pick a filter per row. cp_save_png uses CUTE_PNG_DEFAULT_LEVEL.
+int cp_save_png_level(const char* file_name, const cp_image_t* img, int level);
+
+// Encodes a png into memory, returns NULL in event of errors. free the result when done
+void* cp_save_png_mem(const cp_image_t* img, int level, int* size);
+
+// Splits the image into bands of rows compressed on up to `threads` threads. Only threaded
+// when CUTE_PNG_THREADS is defined (link with pthreads on POSIX), output is a little larger.
+int cp_save_png_parallel(const char* file_name, const cp_image_t* img, int level, int threads);
+void* cp_save_png_mem_parallel(const cp_image_t* img, int level, int threads, int* size);
+
 // Constructs an atlas image in-memory. The atlas pixels are stored in the returned image. free the pixels
 // when done with them. The user must provide an array of cp_atlas_image_t for the `imgs` param. `imgs` holds
 // information about uv coordinates for an associated image in the `pngs` array. Output image has NULL
 // pixels buffer in the event of errors.
 cp_image_t cp_make_atlas(int atlasWidth, int atlasHeight, const cp_image_t* pngs, int png_count, cp_atlas_image_t* imgs_out);
 
+// Like cp_make_atlas, but sizes the atlas itself and spills onto more pages rather than failing. Each page
+// is the smallest power of two size (up to max_width x max_height) that holds what's left, and images that
+// don't fit go onto the next page, up to max_pages of them. `pages_out` must have room for max_pages images,
+// and cp_atlas_image_t::page says which one each image is on. Returns the number of pages, free each
+// page's pixels when done. Returns 0 in the event of errors, with no pages left to free.
+int cp_make_atlas_pages(int max_width, int max_height, const cp_image_t* pngs, int png_count, cp_atlas_image_t* imgs_out, cp_image_t* pages_out, int max_pages);
+
 // A decent "default" function, ready to use out-of-the-box. Saves out an easy to parse text formatted info file
 // along with an atlas image. `names` param can be optionally NULL.
 int cp_default_save_atlas(const char* out_path_image, const char* out_path_atlas_txt, const cp_image_t* atlas, const cp_atlas_image_t* imgs, int img_count, const char** names);
 
 // these two functions return cp_image_t::pix as 0 in event of errors
 // call free on cp_image_t::pix when done, or call cp_free_png
+// On POSIX files are memory mapped rather than read, define CUTE_PNG_NO_MMAP to always read.
+// Define _POSIX_C_SOURCE 200112L or later before any #include to also pass the kernel a
+// sequential read hint with posix_madvise.
+// Chunk CRCs and the Adler-32 of the image data are only checked when CUTE_PNG_VERIFY_CRC is
+// defined, loading then fails on corrupt files rather than decoding whatever is there.
 cp_image_t cp_load_png(const char *file_name);
 cp_image_t cp_load_png_mem(const void *png_data, int png_length);
 void cp_free_png(cp_image_t* img);
+
+// Gets a file's contents the way cp_load_png does, to hand to the _mem functions. The file is
+// memory mapped read only where possible, otherwise read into memory. Returns NULL in event
+// of errors. *size is the length, and *mapped says which it was: pass the same pointer, size
+// and mapped to cp_unmap_file when done.
+void* cp_map_file(const char* path, int* size, int* mapped);
+void cp_unmap_file(void* data, int size, int mapped);
 void cp_flip_image_horizontal(cp_image_t* img);
 
 // Reads the w/h of the png without doing any other decompression or parsing.
 void cp_load_png_wh(const void* png_data, int png_length, int* w, int* h);
 
+// Streaming loads, only a 32K window of the decompressed data and a couple of rows are held
+// in memory. The callback gets each row of pixels in turn, return 0 from it to stop decoding.
+// cp_load_png_mem_into writes rows `pitch` bytes apart into dst (e.g. locked texture memory),
+// which must be big enough for the size from cp_load_png_wh. These return 1 for success.
+typedef int (cp_row_fn)(const cp_pixel_t* row, int w, int y, void* udata);
+int cp_load_png_mem_rows(const void* png_data, int png_length, cp_row_fn* fn, void* udata);
+int cp_load_png_mem_into(const void* png_data, int png_length, cp_pixel_t* dst, int pitch);
+
 // loads indexed (paletted) pngs, but does not depalette the image into RGBA pixels
 // these two functions return cp_indexed_image_t::pix as 0 in event of errors
 // call free on cp_indexed_image_t::pix when done, or call cp_free_indexed_png
@@ -126,6 +211,17 @@ cp_indexed_image_t cp_load_indexed_png(const char* file_name);
 cp_indexed_image_t cp_load_indexed_png_mem(const void *png_data, int png_length);
 void cp_free_indexed_png(cp_indexed_image_t* img);
 
+// Bump allocator for loading many images out of one block of memory. Give it the block with
+// cp_arena_init, pass it to the _arena load functions and cp_arena_reset it between images.
+// Images loaded this way live in the arena, so don't free them, they are gone on reset. A load
+// that doesn't fit fails rather than touching the heap, peak tells how big the block needs to be.
+void cp_arena_init(cp_arena_t* arena, void* mem, size_t size);
+void cp_arena_reset(cp_arena_t* arena);
+cp_image_t cp_load_png_arena(const char* file_name, cp_arena_t* arena);
+cp_image_t cp_load_png_mem_arena(const void* png_data, int png_length, cp_arena_t* arena);
+cp_indexed_image_t cp_load_indexed_png_arena(const char* file_name, cp_arena_t* arena);
+cp_indexed_image_t cp_load_indexed_png_mem_arena(const void* png_data, int png_length, cp_arena_t* arena);
+
 // converts paletted image into a standard RGBA image
 // call free on cp_image_t::pix when done
 cp_image_t cp_depallete_indexed_image(cp_indexed_image_t* img);
@@ -158,6 +254,15 @@ struct cp_indexed_image_t
 	cp_pixel_t palette[256];
 };
 
+struct cp_arena_t
+{
+	uint8_t* mem;
+	size_t size;
+	size_t used;
+	size_t last; // start of the newest allocation, freeing it hands the space back
+	size_t peak; // most ever used at once
+};
+
 struct cp_atlas_image_t
 {
 	int img_index;    // index into the `imgs` array
@@ -165,6 +270,7 @@ struct cp_atlas_image_t
 	float minx, miny; // u coordinate
 	float maxx, maxy; // v coordinate
 	int fit;          // non-zero if image fit and was placed into the atlas
+	int page;         // index of the atlas page holding the image, -1 if it didn't fit
 };
 
 #define CUTE_PNG_H
@@ -201,6 +307,11 @@ struct cp_atlas_image_t
 	#define CUTE_PNG_MEMSET memset
 #endif
 
+#if !defined(CUTE_PNG_MEMMOVE)
+	#include <string.h> // memmove
+	#define CUTE_PNG_MEMMOVE memmove
+#endif
+
 #if !defined(CUTE_PNG_ASSERT)
 	#include <assert.h> // assert
 	#define CUTE_PNG_ASSERT assert
@@ -208,6 +319,32 @@ struct cp_atlas_image_t
 
 #include <stdio.h>  // fopen, fclose, etc.
 
+#if !defined(CUTE_PNG_NO_MMAP) && !defined(_WIN32) && (defined(__unix__) || defined(__APPLE__))
+	#define CUTE_PNG_MMAP 1
+	#include <sys/mman.h> // mmap, munmap, posix_madvise
+	#include <sys/stat.h> // fstat
+	#include <fcntl.h>    // open
+	#include <unistd.h>   // close
+#endif
+
+#ifdef CUTE_PNG_THREADS
+	#ifdef _WIN32
+		#include <windows.h> // CreateThread
+	#else
+		#include <pthread.h>
+	#endif
+#endif
+
+#ifdef CUTE_PNG_SSE2
+	#include <emmintrin.h>
+#endif
+
+#ifdef CUTE_PNG_AVX2
+	#include <immintrin.h>
+	#define CUTE_PNG_TARGET_AVX2 __attribute__((target("avx2")))
+	#define CUTE_PNG_TARGET_PCLMUL __attribute__((target("sse2,pclmul")))
+#endif
+
 static cp_pixel_t cp_make_pixel_a(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
 {
 	cp_pixel_t p;
@@ -226,11 +363,16 @@ const char* cp_error_reason;
 #define CUTE_PNG_FAIL() do { goto cp_err; } while (0)
 #define CUTE_PNG_CHECK(X, Y) do { if (!(X)) { cp_error_reason = Y; CUTE_PNG_FAIL(); } } while (0)
 #define CUTE_PNG_CALL(X) do { if (!(X)) goto cp_err; } while (0)
-#define CUTE_PNG_LOOKUP_BITS 9
-#define CUTE_PNG_LOOKUP_COUNT (1 << CUTE_PNG_LOOKUP_BITS)
-#define CUTE_PNG_LOOKUP_MASK (CUTE_PNG_LOOKUP_COUNT - 1)
+#define CUTE_PNG_LOOKUP_BITS 11 // primary literal/length decode table bits
+#define CUTE_PNG_DIST_LOOKUP_BITS 8
+#define CUTE_PNG_PRE_LOOKUP_BITS 7 // code length codes are at most 7 bits, never need a subtable
 #define CUTE_PNG_DEFLATE_MAX_BITLEN 15
 
+// Worst case table sizes including subtables, from zlib's enough.c
+// (enough 288 11 15, enough 32 8 15)
+#define CUTE_PNG_LIT_ENOUGH 2342
+#define CUTE_PNG_DIST_ENOUGH 402
+
 // DEFLATE tables from RFC 1951
 uint8_t cp_fixed_table[288 + 32] = {
 	8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,8,
@@ -245,73 +387,91 @@ uint32_t cp_len_base[29 + 2] = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,
 uint8_t cp_dist_extra_bits[30 + 2] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13,  0,0 }; // 3.2.5
 uint32_t cp_dist_base[30 + 2] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577, 0,0 }; // 3.2.5
 
+// Decode table entries are looked up with the next CUTE_PNG_*_LOOKUP_BITS of
+// input, codes longer than that continue into a subtable.
+//   bits  0-4  number of input bits the entry consumes
+//   bits  5-7  kind of entry, one of CUTE_PNG_SYM_*
+//   bits  8-15 extra bits following a length/distance code, or subtable bits
+//   bits 16-31 literal (two for LIT2), base length/distance or subtable offset
+#define CUTE_PNG_SYM_LIT  0
+#define CUTE_PNG_SYM_LIT2 1 // two literals decoded by a single lookup
+#define CUTE_PNG_SYM_LEN  2 // also used for distances
+#define CUTE_PNG_SYM_END  3
+#define CUTE_PNG_SYM_SUB  4
+#define CUTE_PNG_SYM_BAD  5
+
+#define CUTE_PNG_ENTRY(kind, extra, value) (((uint32_t)(value) << 16) | ((uint32_t)(extra) << 8) | ((kind) << 5))
+#define CUTE_PNG_ENTRY_BITS(e) ((e) & 31)
+#define CUTE_PNG_ENTRY_KIND(e) (((e) >> 5) & 7)
+#define CUTE_PNG_ENTRY_EXTRA(e) (((e) >> 8) & 0xFF)
+#define CUTE_PNG_ENTRY_VALUE(e) ((e) >> 16)
+
 typedef struct cp_state_t
 {
+	// Input is read through a 64-bit little-endian bit buffer. Bits past
+	// `count` are either zero or the upcoming input bits, so refilling can
+	// always OR in a whole word.
 	uint64_t bits;
 	int count;
-	uint32_t* words;
-	int word_count;
-	int word_index;
-	int bits_left;
-
-	char* final_bytes;
-	int last_bits;
+	const uint8_t* in;
+	const uint8_t* in_end;
+	int overrun; // zero bytes fed in past the end of input
 
 	char* out;
 	char* out_end;
 	char* begin;
 
-	uint16_t lookup[CUTE_PNG_LOOKUP_COUNT];
-	uint32_t lit[288];
-	uint32_t dst[32];
-	uint32_t len[19];
-	uint32_t nlit;
-	uint32_t ndst;
-	uint32_t nlen;
+	// Optional, called when the output is close to full. Streams take what
+	// they want from the output and move the last 32K (all a match can
+	// reach) back to `begin`. Must leave room for CUTE_PNG_FAST_OUT_MARGIN
+	// bytes, returns 0 to fail decoding.
+	int (*flush)(struct cp_state_t* s);
+	void* udata;
+
+	uint32_t lit[CUTE_PNG_LIT_ENOUGH];
+	uint32_t dst[CUTE_PNG_DIST_ENOUGH];
+	uint32_t len[1 << CUTE_PNG_PRE_LOOKUP_BITS];
 } cp_state_t;
 
-static int cp_would_overflow(int64_t bits_left, int num_bits)
+static uint64_t cp_load64le(const uint8_t* p)
 {
-	return bits_left - num_bits < 0;
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+		((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
 }
 
-static char* cp_ptr(cp_state_t* s)
+// Top the bit buffer up to at least 56 bits. Needs 8 readable input bytes.
+static void cp_refill_fast(cp_state_t* s)
 {
-	CUTE_PNG_ASSERT(!(s->bits_left & 7));
-	return (char*)(s->words + s->word_index) - (s->count / 8);
+	s->bits |= cp_load64le(s->in) << s->count;
+	s->in += (63 - s->count) >> 3;
+	s->count |= 56;
 }
 
-static uint64_t cp_peak_bits(cp_state_t* s, int num_bits_to_read)
+// Byte at a time refill for the end of the input, pads with zeroes
+static void cp_refill(cp_state_t* s)
 {
-	if (s->count < num_bits_to_read)
+	if (s->in_end - s->in >= 8)
 	{
-		if (s->bits_left > s->last_bits)
-		{
-			s->bits |= (uint64_t)s->words[s->word_index] << s->count;
-			s->count += 32;
-			s->word_index += 1;
-		}
-
-		else
-		{
-			CUTE_PNG_ASSERT(s->bits_left <= 3 * 8);
-			int bytes = s->bits_left / 8;
-			for (int i = 0; i < bytes; ++i)
-				s->bits |= (uint64_t)(s->final_bytes[i]) << (i * 8);
-			s->count += s->bits_left;
-		}
+		cp_refill_fast(s);
+		return;
 	}
 
-	return s->bits;
+	while (s->count <= 56)
+	{
+		uint64_t byte = 0;
+		if (s->in < s->in_end) byte = *s->in++;
+		else s->overrun++;
+		s->bits |= byte << s->count;
+		s->count += 8;
+	}
 }
 
 static uint32_t cp_consume_bits(cp_state_t* s, int num_bits_to_read)
 {
 	CUTE_PNG_ASSERT(s->count >= num_bits_to_read);
-	uint32_t bits = s->bits & (((uint64_t)1 << num_bits_to_read) - 1);
+	uint32_t bits = (uint32_t)(s->bits & (((uint64_t)1 << num_bits_to_read) - 1));
 	s->bits >>= num_bits_to_read;
 	s->count -= num_bits_to_read;
-	s->bits_left -= num_bits_to_read;
 	return bits;
 }
 
@@ -319,12 +479,56 @@ static uint32_t cp_read_bits(cp_state_t* s, int num_bits_to_read)
 {
 	CUTE_PNG_ASSERT(num_bits_to_read <= 32);
 	CUTE_PNG_ASSERT(num_bits_to_read >= 0);
-	CUTE_PNG_ASSERT(s->bits_left > 0);
-	CUTE_PNG_ASSERT(s->count <= 64);
-	CUTE_PNG_ASSERT(!cp_would_overflow(s->bits_left, num_bits_to_read));
-	cp_peak_bits(s, num_bits_to_read);
-	uint32_t bits = cp_consume_bits(s, num_bits_to_read);
-	return bits;
+	if (s->count < num_bits_to_read) cp_refill(s);
+	return cp_consume_bits(s, num_bits_to_read);
+}
+
+// Only zero padding may be left in the bit buffer, not any we've read
+static int cp_input_ok(cp_state_t* s)
+{
+	return s->overrun * 8 <= s->count;
+}
+
+void cp_arena_init(cp_arena_t* arena, void* mem, size_t size)
+{
+	arena->mem = (uint8_t*)mem;
+	arena->size = size;
+	arena->used = arena->last = arena->peak = 0;
+}
+
+void cp_arena_reset(cp_arena_t* arena)
+{
+	arena->used = arena->last = 0;
+}
+
+// Allocations come from the arena when there is one, the heap otherwise
+static void* cp_alloc(cp_arena_t* arena, size_t size)
+{
+	size_t start;
+	if (!arena) return CUTE_PNG_ALLOC(size);
+
+	start = (arena->used + 15) & ~(size_t)15;
+	if (start > arena->size || size > arena->size - start) return 0;
+	arena->last = start;
+	arena->used = start + size;
+	if (arena->used > arena->peak) arena->peak = arena->used;
+	return arena->mem + start;
+}
+
+static void* cp_alloc_zero(cp_arena_t* arena, size_t size)
+{
+	void* p;
+	if (!arena) return CUTE_PNG_CALLOC(1, size);
+	p = cp_alloc(arena, size);
+	if (p) CUTE_PNG_MEMSET(p, 0, size);
+	return p;
+}
+
+// Arena space only comes back when freeing the newest allocation, the rest waits for a reset
+static void cp_release(cp_arena_t* arena, void* p)
+{
+	if (!arena) CUTE_PNG_FREE(p);
+	else if (p && (uint8_t*)p == arena->mem + arena->last) arena->used = arena->last;
 }
 
 static char* cp_read_file_to_memory(const char* path, int* size)
@@ -348,76 +552,259 @@ static char* cp_read_file_to_memory(const char* path, int* size)
 	return data;
 }
 
-static uint32_t cp_rev16(uint32_t a)
+void* cp_map_file(const char* path, int* size, int* mapped)
+{
+#ifdef CUTE_PNG_MMAP
+	struct stat st;
+	void* data = MAP_FAILED;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		*mapped = 0;
+		*size = 0;
+		return 0;
+	}
+
+	// Empty files can't be mapped, and anything over INT_MAX is too big to load anyway
+	if (!fstat(fd, &st) && st.st_size > 0 && st.st_size <= INT_MAX)
+		data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data != MAP_FAILED)
+	{
+		// The decoder reads the file front to back once. Strict -std=c11 builds only
+		// get the hint with _POSIX_C_SOURCE >= 200112L defined before the first
+		// #include, as glibc settles which names it declares then.
+		#ifdef POSIX_MADV_SEQUENTIAL
+			posix_madvise(data, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+		#endif
+		*mapped = 1;
+		*size = (int)st.st_size;
+		return data;
+	}
+#endif
+
+	*mapped = 0;
+	return cp_read_file_to_memory(path, size);
+}
+
+void cp_unmap_file(void* data, int size, int mapped)
 {
-	a = ((a & 0xAAAA) >>  1) | ((a & 0x5555) << 1);
-	a = ((a & 0xCCCC) >>  2) | ((a & 0x3333) << 2);
-	a = ((a & 0xF0F0) >>  4) | ((a & 0x0F0F) << 4);
-	a = ((a & 0xFF00) >>  8) | ((a & 0x00FF) << 8);
-	return a;
+#ifdef CUTE_PNG_MMAP
+	if (mapped)
+	{
+		munmap(data, (size_t)size);
+		return;
+	}
+#else
+	(void)size;
+	(void)mapped;
+#endif
+	CUTE_PNG_FREE(data);
+}
+
+// Template decode table entry for symbol `sym` of the literal/length (0),
+// distance (1) or code length (2) alphabet
+static uint32_t cp_symbol_entry(int alphabet, int sym)
+{
+	switch (alphabet)
+	{
+	case 0:
+		if (sym < 256) return CUTE_PNG_ENTRY(CUTE_PNG_SYM_LIT, 0, sym);
+		if (sym == 256) return CUTE_PNG_ENTRY(CUTE_PNG_SYM_END, 0, 0);
+		if (sym < 286) return CUTE_PNG_ENTRY(CUTE_PNG_SYM_LEN, cp_len_extra_bits[sym - 257], cp_len_base[sym - 257]);
+		break;
+
+	case 1:
+		if (sym < 30) return CUTE_PNG_ENTRY(CUTE_PNG_SYM_LEN, cp_dist_extra_bits[sym], cp_dist_base[sym]);
+		break;
+
+	default:
+		return CUTE_PNG_ENTRY(CUTE_PNG_SYM_LIT, 0, sym);
+	}
+
+	return CUTE_PNG_ENTRY(CUTE_PNG_SYM_BAD, 0, 0);
 }
 
 // RFC 1951 section 3.2.2
-static int cp_build(cp_state_t* s, uint32_t* tree, uint8_t* lens, int sym_count)
+// Builds a two level decode table of `table_bits` primary bits, with room for
+// `table_size` entries in all. Incomplete codes are allowed, unused entries
+// decode as errors.
+static int cp_build(uint32_t* table, int table_bits, int table_size, const uint8_t* lens, int sym_count, int alphabet)
 {
-	int n, codes[16], first[16], counts[16] = { 0 };
+	int counts[16] = { 0 }, offsets[16];
+	uint16_t sorted[288];
+	int left = 1;
 
-	// Frequency count
-	for (n = 0; n < sym_count; n++) counts[lens[n]]++;
+	for (int n = 0; n < sym_count; n++) counts[lens[n]]++;
+	counts[0] = 0;
 
-	// Distribute codes
-	counts[0] = codes[0] = first[0] = 0;
-	for (n = 1; n <= 15; ++n)
+	for (int len = 1; len <= 15; ++len)
 	{
-		codes[n] = (codes[n - 1] + counts[n - 1]) << 1;
-		first[n] = first[n - 1] + counts[n - 1];
+		left = (left << 1) - counts[len];
+		CUTE_PNG_CHECK(left >= 0, "Over-subscribed Huffman code.");
 	}
 
-	if (s) CUTE_PNG_MEMSET(s->lookup, 0, sizeof(512 * sizeof(uint32_t)));
-	for (int i = 0; i < sym_count; ++i)
+	// Sort symbols by code length, then by symbol, which is canonical order
+	offsets[1] = 0;
+	for (int len = 1; len < 15; ++len) offsets[len + 1] = offsets[len] + counts[len];
+	for (int n = 0; n < sym_count; n++) if (lens[n]) sorted[offsets[lens[n]]++] = (uint16_t)n;
+
+	for (int i = 0; i < table_size; ++i) table[i] = CUTE_PNG_ENTRY(CUTE_PNG_SYM_BAD, 0, 0) | 1;
+
 	{
-		int len = lens[i];
+		int placed = 0;
+		int next = 1 << table_bits;
+		int sub_prefix = -1, sub_bits = 0, sub_offset = 0;
+		uint32_t code = 0;
+		int mask = (1 << table_bits) - 1;
 
-		if (len != 0)
+		for (int len = 1; len <= 15; ++len)
 		{
-			CUTE_PNG_ASSERT(len < 16);
-			uint32_t code = codes[len]++;
-			uint32_t slot = first[len]++;
-			tree[slot] = (code << (32 - len)) | (i << 4) | len;
-
-			if (s && len <= CUTE_PNG_LOOKUP_BITS)
+			for (int k = 0; k < counts[len]; ++k, ++code)
 			{
-				int j = cp_rev16(code) >> (16 - len);
-				while (j < (1 << CUTE_PNG_LOOKUP_BITS))
+				uint32_t entry = cp_symbol_entry(alphabet, sorted[placed++]);
+
+				// Huffman codes are packed starting from their MSB, so the
+				// table is indexed by the bit reversed code
+				uint32_t rev = 0;
+				for (int b = 0; b < len; ++b) rev |= ((code >> b) & 1) << (len - 1 - b);
+
+				if (len <= table_bits)
+				{
+					for (int j = rev; j <= mask; j += 1 << len) table[j] = entry | len;
+					continue;
+				}
+
+				// Long code, find or make the subtable for its primary prefix
+				if ((int)(rev & mask) != sub_prefix)
 				{
-					s->lookup[j] = (uint16_t)((len << CUTE_PNG_LOOKUP_BITS) | i);
-					j += (1 << len);
+					// Size the subtable to fit every remaining code sharing this prefix
+					int remaining[16];
+					for (int l = 0; l <= 15; ++l) remaining[l] = counts[l];
+					remaining[len] -= k;
+
+					sub_bits = len - table_bits;
+					int room = 1 << sub_bits;
+					while (sub_bits + table_bits < 15)
+					{
+						room -= remaining[sub_bits + table_bits];
+						if (room <= 0) break;
+						sub_bits++;
+						room <<= 1;
+					}
+
+					sub_prefix = rev & mask;
+					sub_offset = next;
+					next += 1 << sub_bits;
+					CUTE_PNG_CHECK(next <= table_size, "Huffman decode table overflow.");
+					table[sub_prefix] = CUTE_PNG_ENTRY(CUTE_PNG_SYM_SUB, sub_bits, sub_offset) | table_bits;
 				}
+
+				for (int j = rev >> table_bits; j < (1 << sub_bits); j += 1 << (len - table_bits))
+					table[sub_offset + j] = entry | (len - table_bits);
 			}
+
+			code <<= 1;
 		}
 	}
 
-	int max_index = first[15];
-	return max_index;
+	return 1;
+
+cp_err:
+	return 0;
 }
 
-static int cp_stored(cp_state_t* s)
+#ifndef CUTE_PNG_NO_FAST_INFLATE
+
+// Where a short literal code is followed by another that still fits in the
+// primary table bits, decode both with the one lookup
+static void cp_pair_literals(uint32_t* table)
+{
+	uint32_t single[1 << CUTE_PNG_LOOKUP_BITS];
+	CUTE_PNG_MEMCPY(single, table, sizeof(single));
+
+	for (int i = 0; i < (1 << CUTE_PNG_LOOKUP_BITS); ++i)
+	{
+		uint32_t a = single[i];
+		if (CUTE_PNG_ENTRY_KIND(a) != CUTE_PNG_SYM_LIT) continue;
+
+		int bits = CUTE_PNG_ENTRY_BITS(a);
+		uint32_t b = single[i >> bits];
+		if (CUTE_PNG_ENTRY_KIND(b) != CUTE_PNG_SYM_LIT) continue;
+		if (bits + CUTE_PNG_ENTRY_BITS(b) > CUTE_PNG_LOOKUP_BITS) continue;
+
+		uint32_t pair = CUTE_PNG_ENTRY_VALUE(a) | (CUTE_PNG_ENTRY_VALUE(b) << 8);
+		table[i] = CUTE_PNG_ENTRY(CUTE_PNG_SYM_LIT2, 0, pair) | (bits + CUTE_PNG_ENTRY_BITS(b));
+	}
+}
+
+#endif
+
+static int cp_build_lit_dst(cp_state_t* s, const uint8_t* lens, int nlit, int ndst)
+{
+	CUTE_PNG_CALL(cp_build(s->lit, CUTE_PNG_LOOKUP_BITS, CUTE_PNG_LIT_ENOUGH, lens, nlit, 0));
+	CUTE_PNG_CALL(cp_build(s->dst, CUTE_PNG_DIST_LOOKUP_BITS, CUTE_PNG_DIST_ENOUGH, lens + nlit, ndst, 1));
+
+#ifndef CUTE_PNG_NO_FAST_INFLATE
+	cp_pair_literals(s->lit);
+#endif
+
+	return 1;
+
+cp_err:
+	return 0;
+}
+
+// Look up the next entry in a table, following a subtable if needed.
+// The bit buffer must hold at least 15 bits.
+static uint32_t cp_decode(cp_state_t* s, const uint32_t* table, int table_bits)
 {
-	char* p;
+	uint32_t entry = table[s->bits & ((1 << table_bits) - 1)];
+
+	if (CUTE_PNG_ENTRY_KIND(entry) == CUTE_PNG_SYM_SUB)
+	{
+		cp_consume_bits(s, table_bits);
+		entry = table[CUTE_PNG_ENTRY_VALUE(entry) + (s->bits & ((1 << CUTE_PNG_ENTRY_EXTRA(entry)) - 1))];
+	}
+
+	cp_consume_bits(s, CUTE_PNG_ENTRY_BITS(entry));
+	return entry;
+}
 
+static int cp_stored(cp_state_t* s)
+{
 	// 3.2.3
 	// skip any remaining bits in current partially processed byte
 	cp_read_bits(s, s->count & 7);
 
+	uint16_t LEN, NLEN;
+
+	// Hand whole bytes still in the bit buffer back to the input
+	CUTE_PNG_CHECK(cp_input_ok(s), "Stored block extends beyond end of input stream.");
+	s->in -= s->count / 8 - s->overrun;
+	s->overrun = 0;
+	s->bits = 0;
+	s->count = 0;
+
 	// 3.2.4
 	// read LEN and NLEN, should complement each other
-	uint16_t LEN = (uint16_t)cp_read_bits(s, 16);
-	uint16_t NLEN = (uint16_t)cp_read_bits(s, 16);
+	CUTE_PNG_CHECK(s->in_end - s->in >= 4, "Stored block extends beyond end of input stream.");
+	LEN = (uint16_t)(s->in[0] | (s->in[1] << 8));
+	NLEN = (uint16_t)(s->in[2] | (s->in[3] << 8));
+	s->in += 4;
 	CUTE_PNG_CHECK(LEN == (uint16_t)(~NLEN), "Failed to find LEN and NLEN as complements within stored (uncompressed) stream.");
-	CUTE_PNG_CHECK(s->bits_left / 8 <= (int)LEN, "Stored block extends beyond end of input stream.");
-	p = cp_ptr(s);
-	CUTE_PNG_MEMCPY(s->out, p, LEN);
-	s->out += LEN;
+	CUTE_PNG_CHECK(s->in_end - s->in >= (int)LEN, "Stored block extends beyond end of input stream.");
+	while (LEN)
+	{
+		if (s->flush && s->out == s->out_end) CUTE_PNG_CALL(s->flush(s));
+		int n = s->out_end - s->out < LEN ? (int)(s->out_end - s->out) : LEN;
+		CUTE_PNG_CHECK(n > 0, "Attempted to overwrite out buffer while outputting a stored block.");
+		CUTE_PNG_MEMCPY(s->out, s->in, n);
+		s->in += n;
+		s->out += n;
+		LEN -= n;
+	}
 	return 1;
 
 cp_err:
@@ -427,85 +814,196 @@ cp_err:
 // 3.2.6
 static int cp_fixed(cp_state_t* s)
 {
-	s->nlit = cp_build(s, s->lit, cp_fixed_table, 288);
-	s->ndst = cp_build(0, s->dst, cp_fixed_table + 288, 32);
-	return 1;
-}
-
-static int cp_decode(cp_state_t* s, uint32_t* tree, int hi)
-{
-	uint64_t bits = cp_peak_bits(s, 16);
-	uint32_t search = (cp_rev16((uint32_t)bits) << 16) | 0xFFFF;
-	int lo = 0;
-	while (lo < hi)
-	{
-		int guess = (lo + hi) >> 1;
-		if (search < tree[guess]) hi = guess;
-		else lo = guess + 1;
-	}
-
-	uint32_t key = tree[lo - 1];
-	uint32_t len = (32 - (key & 0xF));
-	CUTE_PNG_ASSERT((search >> len) == (key >> len));
-
-	int code = cp_consume_bits(s, key & 0xF);
-	(void)code;
-	return (key >> 4) & 0xFFF;
+	return cp_build_lit_dst(s, cp_fixed_table, 288, 32);
 }
 
 // 3.2.7
 static int cp_dynamic(cp_state_t* s)
 {
 	uint8_t lenlens[19] = { 0 };
+	uint8_t lens[288 + 32];
 
 	int nlit = 257 + cp_read_bits(s, 5);
 	int ndst = 1 + cp_read_bits(s, 5);
 	int nlen = 4 + cp_read_bits(s, 4);
+	CUTE_PNG_CHECK(nlit <= 286 && ndst <= 30, "Invalid number of literal/length or distance codes.");
 
 	for (int i = 0 ; i < nlen; ++i)
 		lenlens[cp_permutation_order[i]] = (uint8_t)cp_read_bits(s, 3);
 
-	// Build the tree for decoding code lengths
-	s->nlen = cp_build(0, s->len, lenlens, 19);
-	uint8_t lens[288 + 32];
+	// Build the table for decoding code lengths
+	CUTE_PNG_CALL(cp_build(s->len, CUTE_PNG_PRE_LOOKUP_BITS, 1 << CUTE_PNG_PRE_LOOKUP_BITS, lenlens, 19, 2));
 
 	for (int n = 0; n < nlit + ndst;)
 	{
-		int sym = cp_decode(s, s->len, s->nlen);
+		if (s->count < 16) cp_refill(s);
+		uint32_t entry = cp_decode(s, s->len, CUTE_PNG_PRE_LOOKUP_BITS);
+		CUTE_PNG_CHECK(CUTE_PNG_ENTRY_KIND(entry) == CUTE_PNG_SYM_LIT, "Invalid code length code.");
+
+		int sym = CUTE_PNG_ENTRY_VALUE(entry);
+		int repeat = 0;
+		uint8_t fill = 0;
 		switch (sym)
 		{
-		case 16: for (int i =  3 + cp_read_bits(s, 2); i; --i, ++n) lens[n] = lens[n - 1]; break;
-		case 17: for (int i =  3 + cp_read_bits(s, 3); i; --i, ++n) lens[n] = 0; break;
-		case 18: for (int i = 11 + cp_read_bits(s, 7); i; --i, ++n) lens[n] = 0; break;
-		default: lens[n++] = (uint8_t)sym; break;
+		case 16:
+			CUTE_PNG_CHECK(n > 0, "Repeated code length with no previous length.");
+			repeat = 3 + cp_read_bits(s, 2);
+			fill = lens[n - 1];
+			break;
+		case 17: repeat =  3 + cp_read_bits(s, 3); break;
+		case 18: repeat = 11 + cp_read_bits(s, 7); break;
+		default: lens[n++] = (uint8_t)sym; continue;
 		}
+
+		CUTE_PNG_CHECK(n + repeat <= nlit + ndst, "Code lengths run past the number of codes.");
+		CUTE_PNG_MEMSET(lens + n, fill, repeat);
+		n += repeat;
 	}
 
-	s->nlit = cp_build(s, s->lit, lens, nlit);
-	s->ndst = cp_build(0, s->dst, lens + nlit, ndst);
-	return 1;
+	CUTE_PNG_CHECK(lens[256], "Missing end of block code.");
+	return cp_build_lit_dst(s, lens, nlit, ndst);
+
+cp_err:
+	return 0;
+}
+
+// Bytes of slack the fast loop needs after the output and input positions. A
+// match writes at most 258 bytes and copies may overshoot by up to 7.
+#define CUTE_PNG_FAST_OUT_MARGIN (258 + 8)
+#define CUTE_PNG_FAST_IN_MARGIN 16
+
+#ifndef CUTE_PNG_NO_FAST_INFLATE
+
+// Decodes symbols for as long as there's room to skip bounds checks on the
+// input and output. One refill per symbol is enough for the longest
+// length/distance pair (15 + 5 + 15 + 13 = 48 bits).
+static int cp_block_fast(cp_state_t* s)
+{
+	const uint32_t lit_mask = (1 << CUTE_PNG_LOOKUP_BITS) - 1;
+	const uint32_t dst_mask = (1 << CUTE_PNG_DIST_LOOKUP_BITS) - 1;
+	char* out = s->out;
+	char* out_fast_end = s->out_end - CUTE_PNG_FAST_OUT_MARGIN;
+	const uint8_t* in_fast_end = s->in_end - CUTE_PNG_FAST_IN_MARGIN;
+
+	while (out < out_fast_end && s->in < in_fast_end)
+	{
+		cp_refill_fast(s);
+
+		uint32_t entry = s->lit[s->bits & lit_mask];
+		if (CUTE_PNG_ENTRY_KIND(entry) == CUTE_PNG_SYM_SUB)
+		{
+			cp_consume_bits(s, CUTE_PNG_LOOKUP_BITS);
+			entry = s->lit[CUTE_PNG_ENTRY_VALUE(entry) + (s->bits & ((1 << CUTE_PNG_ENTRY_EXTRA(entry)) - 1))];
+		}
+		cp_consume_bits(s, CUTE_PNG_ENTRY_BITS(entry));
+
+		switch (CUTE_PNG_ENTRY_KIND(entry))
+		{
+		case CUTE_PNG_SYM_LIT2:
+			out[0] = (char)(CUTE_PNG_ENTRY_VALUE(entry) & 0xFF);
+			out[1] = (char)(CUTE_PNG_ENTRY_VALUE(entry) >> 8);
+			out += 2;
+			break;
+
+		case CUTE_PNG_SYM_LIT:
+			*out++ = (char)CUTE_PNG_ENTRY_VALUE(entry);
+			break;
+
+		case CUTE_PNG_SYM_LEN:
+		{
+			int length = CUTE_PNG_ENTRY_VALUE(entry) + cp_consume_bits(s, CUTE_PNG_ENTRY_EXTRA(entry));
+
+			entry = s->dst[s->bits & dst_mask];
+			if (CUTE_PNG_ENTRY_KIND(entry) == CUTE_PNG_SYM_SUB)
+			{
+				cp_consume_bits(s, CUTE_PNG_DIST_LOOKUP_BITS);
+				entry = s->dst[CUTE_PNG_ENTRY_VALUE(entry) + (s->bits & ((1 << CUTE_PNG_ENTRY_EXTRA(entry)) - 1))];
+			}
+			cp_consume_bits(s, CUTE_PNG_ENTRY_BITS(entry));
+			CUTE_PNG_CHECK(CUTE_PNG_ENTRY_KIND(entry) == CUTE_PNG_SYM_LEN, "Invalid distance code.");
+
+			int distance = CUTE_PNG_ENTRY_VALUE(entry) + cp_consume_bits(s, CUTE_PNG_ENTRY_EXTRA(entry));
+			CUTE_PNG_CHECK(out - distance >= s->begin, "Attempted to write before out buffer (invalid backwards distance).");
+
+			char* src = out - distance;
+			char* end = out + length;
+
+			if (distance >= 8)
+			{
+				// Word copies, chunks never overlap and may run past `end`
+				do
+				{
+					CUTE_PNG_MEMCPY(out, src, 8);
+					out += 8;
+					src += 8;
+				}
+				while (out < end);
+			}
+
+			else if (distance == 1) CUTE_PNG_MEMSET(out, *src, length); // very common in images
+			else while (out < end) *out++ = *src++;
+
+			out = end;
+			break;
+		}
+
+		case CUTE_PNG_SYM_END:
+			s->out = out;
+			return 1;
+
+		default:
+			CUTE_PNG_CHECK(0, "Invalid literal/length code.");
+		}
+	}
+
+	s->out = out;
+	return 0;
+
+cp_err:
+	s->out = out;
+	return -1;
 }
 
+#endif // CUTE_PNG_NO_FAST_INFLATE
+
 // 3.2.3
 static int cp_block(cp_state_t* s)
 {
 	while (1)
 	{
-		int symbol = cp_decode(s, s->lit, s->nlit);
+#ifndef CUTE_PNG_NO_FAST_INFLATE
+		// Returns 1 at the end of the block, 0 when nearing the end of a buffer
+		int done = cp_block_fast(s);
+		if (done) return done > 0;
+#endif
+
+		// Make room again when streaming, then the fast loop can carry on
+		if (s->flush && s->out_end - s->out < CUTE_PNG_FAST_OUT_MARGIN) CUTE_PNG_CALL(s->flush(s));
 
-		if (symbol < 256)
+		if (s->count < 48) cp_refill(s);
+		uint32_t entry = cp_decode(s, s->lit, CUTE_PNG_LOOKUP_BITS);
+
+		switch (CUTE_PNG_ENTRY_KIND(entry))
 		{
+		case CUTE_PNG_SYM_LIT2:
+			CUTE_PNG_CHECK(s->out + 2 <= s->out_end, "Attempted to overwrite out buffer while outputting a symbol.");
+			s->out[0] = (char)(CUTE_PNG_ENTRY_VALUE(entry) & 0xFF);
+			s->out[1] = (char)(CUTE_PNG_ENTRY_VALUE(entry) >> 8);
+			s->out += 2;
+			break;
+
+		case CUTE_PNG_SYM_LIT:
 			CUTE_PNG_CHECK(s->out + 1 <= s->out_end, "Attempted to overwrite out buffer while outputting a symbol.");
-			*s->out = (char)symbol;
+			*s->out = (char)CUTE_PNG_ENTRY_VALUE(entry);
 			s->out += 1;
-		}
+			break;
 
-		else if (symbol > 256)
+		case CUTE_PNG_SYM_LEN:
 		{
-			symbol -= 257;
-			int length = cp_read_bits(s, cp_len_extra_bits[symbol]) + cp_len_base[symbol];
-			int distance_symbol = cp_decode(s, s->dst, s->ndst);
-			int backwards_distance = cp_read_bits(s, cp_dist_extra_bits[distance_symbol]) + cp_dist_base[distance_symbol];
+			int length = CUTE_PNG_ENTRY_VALUE(entry) + cp_consume_bits(s, CUTE_PNG_ENTRY_EXTRA(entry));
+			entry = cp_decode(s, s->dst, CUTE_PNG_DIST_LOOKUP_BITS);
+			CUTE_PNG_CHECK(CUTE_PNG_ENTRY_KIND(entry) == CUTE_PNG_SYM_LEN, "Invalid distance code.");
+			int backwards_distance = CUTE_PNG_ENTRY_VALUE(entry) + cp_consume_bits(s, CUTE_PNG_ENTRY_EXTRA(entry));
 			CUTE_PNG_CHECK(s->out - backwards_distance >= s->begin, "Attempted to write before out buffer (invalid backwards distance).");
 			CUTE_PNG_CHECK(s->out + length <= s->out_end, "Attempted to overwrite out buffer while outputting a string.");
 			char* src = s->out - backwards_distance;
@@ -519,41 +1017,40 @@ static int cp_block(cp_state_t* s)
 				break;
 			default: while (length--) *dst++ = *src++;
 			}
+			break;
 		}
 
-		else break;
-	}
+		case CUTE_PNG_SYM_END:
+			return 1;
 
-	return 1;
+		default:
+			CUTE_PNG_CHECK(0, "Invalid literal/length code.");
+		}
+
+		CUTE_PNG_CHECK(cp_input_ok(s), "Compressed data extends beyond end of input stream.");
+	}
 
 cp_err:
 	return 0;
 }
 
 // 3.2.3
-int cp_inflate(void* in, int in_bytes, void* out, int out_bytes)
+static int cp_inflate_stream(const void* in, int in_bytes, void* out, int out_bytes, int (*flush)(cp_state_t*), void* udata, cp_arena_t* arena)
 {
-	cp_state_t* s = (cp_state_t*)CUTE_PNG_CALLOC(1, sizeof(cp_state_t));
+	cp_state_t* s = (cp_state_t*)cp_alloc_zero(arena, sizeof(cp_state_t));
+	CUTE_PNG_CHECK(s, "out of mem");
 	s->bits = 0;
 	s->count = 0;
-	s->word_count = in_bytes / 4;
-	s->word_index = 0;
-	s->bits_left = in_bytes * 8;
-
-	int first_bytes = (int)((size_t)in & 3);
-	s->words = (uint32_t*)((char*)in + first_bytes);
-	s->last_bits = ((in_bytes - first_bytes) & 3) * 8;
-	s->final_bytes = (char*)in + in_bytes - s->last_bits;
-
-	for (int i = 0; i < first_bytes; ++i)
-		s->bits |= (uint64_t)(((uint8_t*)in)[i]) << (i * 8);
-	s->count = first_bytes * 8;
+	s->in = (const uint8_t*)in;
+	s->in_end = s->in + in_bytes;
+	s->overrun = 0;
 
 	s->out = (char*)out;
 	s->out_end = s->out + out_bytes;
 	s->begin = (char*)out;
+	s->flush = flush;
+	s->udata = udata;
 
-	int count = 0;
 	int bfinal;
 	do
 	{
@@ -563,23 +1060,31 @@ int cp_inflate(void* in, int in_bytes, void* out, int out_bytes)
 		switch (btype)
 		{
 		case 0: CUTE_PNG_CALL(cp_stored(s)); break;
-		case 1: cp_fixed(s); CUTE_PNG_CALL(cp_block(s)); break;
-		case 2: cp_dynamic(s); CUTE_PNG_CALL(cp_block(s)); break;
+		case 1: CUTE_PNG_CALL(cp_fixed(s)); CUTE_PNG_CALL(cp_block(s)); break;
+		case 2: CUTE_PNG_CALL(cp_dynamic(s)); CUTE_PNG_CALL(cp_block(s)); break;
 		case 3: CUTE_PNG_CHECK(0, "Detected unknown block type within input stream.");
 		}
 
-		++count;
+		CUTE_PNG_CHECK(cp_input_ok(s), "Compressed data extends beyond end of input stream.");
 	}
 	while (!bfinal);
 
-	CUTE_PNG_FREE(s);
+	// Hand over whatever is left
+	if (flush) CUTE_PNG_CALL(flush(s));
+
+	cp_release(arena, s);
 	return 1;
 
 cp_err:
-	CUTE_PNG_FREE(s);
+	cp_release(arena, s);
 	return 0;
 }
 
+int cp_inflate(void* in, int in_bytes, void* out, int out_bytes)
+{
+	return cp_inflate_stream(in, in_bytes, out, out_bytes, 0, 0, 0);
+}
+
 static uint8_t cp_paeth(uint8_t a, uint8_t b, uint8_t c)
 {
 	int p = a + b - c;
@@ -589,289 +1094,2094 @@ static uint8_t cp_paeth(uint8_t a, uint8_t b, uint8_t c)
 	return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
 }
 
+// Output buffer for the encoder, grown as needed. Bits go in LSB first as
+// DEFLATE wants them, whole bytes are flushed out as soon as they're ready.
 typedef struct cp_save_png_data_t
 {
-	uint32_t crc;
-	uint32_t adler;
-	uint32_t bits;
+	uint64_t bits;
+	int count;
 	uint32_t prev;
 	uint32_t runlen;
-	FILE *fp;
+	uint8_t* out;
+	int len;
+	int cap;
+	int oom;
 } cp_save_png_data_t;
 
-uint32_t tpCRC_TABLE[] = {
-	0, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
-	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+// Slicing-by-8 tables for the reflected CRC-32 polynomial 0xedb88320, cp_crc_table[k][i] is the
+// CRC of byte i followed by k zero bytes
+static const uint32_t cp_crc_table[8][256] = {
+	{
+		0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
+		0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988, 0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
+		0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+		0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9, 0xfa0f3d63, 0x8d080df5,
+		0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172, 0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,
+		0x35b5a8fa, 0x42b2986c, 0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+		0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423, 0xcfba9599, 0xb8bda50f,
+		0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924, 0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,
+		0x76dc4190, 0x01db7106, 0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+		0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d, 0x91646c97, 0xe6635c01,
+		0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e, 0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457,
+		0x65b0d9c6, 0x12b7e950, 0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+		0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7, 0xa4d1c46d, 0xd3d6f4fb,
+		0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0, 0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9,
+		0x5005713c, 0x270241aa, 0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+		0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81, 0xb7bd5c3b, 0xc0ba6cad,
+		0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a, 0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683,
+		0xe3630b12, 0x94643b84, 0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+		0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb, 0x196c3671, 0x6e6b06e7,
+		0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc, 0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5,
+		0xd6d6a3e8, 0xa1d1937e, 0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+		0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55, 0x316e8eef, 0x4669be79,
+		0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236, 0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f,
+		0xc5ba3bbe, 0xb2bd0b28, 0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+		0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f, 0x72076785, 0x05005713,
+		0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38, 0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21,
+		0x86d3d2d4, 0xf1d4e242, 0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+		0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69, 0x616bffd3, 0x166ccf45,
+		0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2, 0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db,
+		0xaed16a4a, 0xd9d65adc, 0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+		0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf,
+		0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d,
+	},
+	{
+		0x00000000, 0x191b3141, 0x32366282, 0x2b2d53c3, 0x646cc504, 0x7d77f445, 0x565aa786, 0x4f4196c7,
+		0xc8d98a08, 0xd1c2bb49, 0xfaefe88a, 0xe3f4d9cb, 0xacb54f0c, 0xb5ae7e4d, 0x9e832d8e, 0x87981ccf,
+		0x4ac21251, 0x53d92310, 0x78f470d3, 0x61ef4192, 0x2eaed755, 0x37b5e614, 0x1c98b5d7, 0x05838496,
+		0x821b9859, 0x9b00a918, 0xb02dfadb, 0xa936cb9a, 0xe6775d5d, 0xff6c6c1c, 0xd4413fdf, 0xcd5a0e9e,
+		0x958424a2, 0x8c9f15e3, 0xa7b24620, 0xbea97761, 0xf1e8e1a6, 0xe8f3d0e7, 0xc3de8324, 0xdac5b265,
+		0x5d5daeaa, 0x44469feb, 0x6f6bcc28, 0x7670fd69, 0x39316bae, 0x202a5aef, 0x0b07092c, 0x121c386d,
+		0xdf4636f3, 0xc65d07b2, 0xed705471, 0xf46b6530, 0xbb2af3f7, 0xa231c2b6, 0x891c9175, 0x9007a034,
+		0x179fbcfb, 0x0e848dba, 0x25a9de79, 0x3cb2ef38, 0x73f379ff, 0x6ae848be, 0x41c51b7d, 0x58de2a3c,
+		0xf0794f05, 0xe9627e44, 0xc24f2d87, 0xdb541cc6, 0x94158a01, 0x8d0ebb40, 0xa623e883, 0xbf38d9c2,
+		0x38a0c50d, 0x21bbf44c, 0x0a96a78f, 0x138d96ce, 0x5ccc0009, 0x45d73148, 0x6efa628b, 0x77e153ca,
+		0xbabb5d54, 0xa3a06c15, 0x888d3fd6, 0x91960e97, 0xded79850, 0xc7cca911, 0xece1fad2, 0xf5facb93,
+		0x7262d75c, 0x6b79e61d, 0x4054b5de, 0x594f849f, 0x160e1258, 0x0f152319, 0x243870da, 0x3d23419b,
+		0x65fd6ba7, 0x7ce65ae6, 0x57cb0925, 0x4ed03864, 0x0191aea3, 0x188a9fe2, 0x33a7cc21, 0x2abcfd60,
+		0xad24e1af, 0xb43fd0ee, 0x9f12832d, 0x8609b26c, 0xc94824ab, 0xd05315ea, 0xfb7e4629, 0xe2657768,
+		0x2f3f79f6, 0x362448b7, 0x1d091b74, 0x04122a35, 0x4b53bcf2, 0x52488db3, 0x7965de70, 0x607eef31,
+		0xe7e6f3fe, 0xfefdc2bf, 0xd5d0917c, 0xcccba03d, 0x838a36fa, 0x9a9107bb, 0xb1bc5478, 0xa8a76539,
+		0x3b83984b, 0x2298a90a, 0x09b5fac9, 0x10aecb88, 0x5fef5d4f, 0x46f46c0e, 0x6dd93fcd, 0x74c20e8c,
+		0xf35a1243, 0xea412302, 0xc16c70c1, 0xd8774180, 0x9736d747, 0x8e2de606, 0xa500b5c5, 0xbc1b8484,
+		0x71418a1a, 0x685abb5b, 0x4377e898, 0x5a6cd9d9, 0x152d4f1e, 0x0c367e5f, 0x271b2d9c, 0x3e001cdd,
+		0xb9980012, 0xa0833153, 0x8bae6290, 0x92b553d1, 0xddf4c516, 0xc4eff457, 0xefc2a794, 0xf6d996d5,
+		0xae07bce9, 0xb71c8da8, 0x9c31de6b, 0x852aef2a, 0xca6b79ed, 0xd37048ac, 0xf85d1b6f, 0xe1462a2e,
+		0x66de36e1, 0x7fc507a0, 0x54e85463, 0x4df36522, 0x02b2f3e5, 0x1ba9c2a4, 0x30849167, 0x299fa026,
+		0xe4c5aeb8, 0xfdde9ff9, 0xd6f3cc3a, 0xcfe8fd7b, 0x80a96bbc, 0x99b25afd, 0xb29f093e, 0xab84387f,
+		0x2c1c24b0, 0x350715f1, 0x1e2a4632, 0x07317773, 0x4870e1b4, 0x516bd0f5, 0x7a468336, 0x635db277,
+		0xcbfad74e, 0xd2e1e60f, 0xf9ccb5cc, 0xe0d7848d, 0xaf96124a, 0xb68d230b, 0x9da070c8, 0x84bb4189,
+		0x03235d46, 0x1a386c07, 0x31153fc4, 0x280e0e85, 0x674f9842, 0x7e54a903, 0x5579fac0, 0x4c62cb81,
+		0x8138c51f, 0x9823f45e, 0xb30ea79d, 0xaa1596dc, 0xe554001b, 0xfc4f315a, 0xd7626299, 0xce7953d8,
+		0x49e14f17, 0x50fa7e56, 0x7bd72d95, 0x62cc1cd4, 0x2d8d8a13, 0x3496bb52, 0x1fbbe891, 0x06a0d9d0,
+		0x5e7ef3ec, 0x4765c2ad, 0x6c48916e, 0x7553a02f, 0x3a1236e8, 0x230907a9, 0x0824546a, 0x113f652b,
+		0x96a779e4, 0x8fbc48a5, 0xa4911b66, 0xbd8a2a27, 0xf2cbbce0, 0xebd08da1, 0xc0fdde62, 0xd9e6ef23,
+		0x14bce1bd, 0x0da7d0fc, 0x268a833f, 0x3f91b27e, 0x70d024b9, 0x69cb15f8, 0x42e6463b, 0x5bfd777a,
+		0xdc656bb5, 0xc57e5af4, 0xee530937, 0xf7483876, 0xb809aeb1, 0xa1129ff0, 0x8a3fcc33, 0x9324fd72,
+	},
+	{
+		0x00000000, 0x01c26a37, 0x0384d46e, 0x0246be59, 0x0709a8dc, 0x06cbc2eb, 0x048d7cb2, 0x054f1685,
+		0x0e1351b8, 0x0fd13b8f, 0x0d9785d6, 0x0c55efe1, 0x091af964, 0x08d89353, 0x0a9e2d0a, 0x0b5c473d,
+		0x1c26a370, 0x1de4c947, 0x1fa2771e, 0x1e601d29, 0x1b2f0bac, 0x1aed619b, 0x18abdfc2, 0x1969b5f5,
+		0x1235f2c8, 0x13f798ff, 0x11b126a6, 0x10734c91, 0x153c5a14, 0x14fe3023, 0x16b88e7a, 0x177ae44d,
+		0x384d46e0, 0x398f2cd7, 0x3bc9928e, 0x3a0bf8b9, 0x3f44ee3c, 0x3e86840b, 0x3cc03a52, 0x3d025065,
+		0x365e1758, 0x379c7d6f, 0x35dac336, 0x3418a901, 0x3157bf84, 0x3095d5b3, 0x32d36bea, 0x331101dd,
+		0x246be590, 0x25a98fa7, 0x27ef31fe, 0x262d5bc9, 0x23624d4c, 0x22a0277b, 0x20e69922, 0x2124f315,
+		0x2a78b428, 0x2bbade1f, 0x29fc6046, 0x283e0a71, 0x2d711cf4, 0x2cb376c3, 0x2ef5c89a, 0x2f37a2ad,
+		0x709a8dc0, 0x7158e7f7, 0x731e59ae, 0x72dc3399, 0x7793251c, 0x76514f2b, 0x7417f172, 0x75d59b45,
+		0x7e89dc78, 0x7f4bb64f, 0x7d0d0816, 0x7ccf6221, 0x798074a4, 0x78421e93, 0x7a04a0ca, 0x7bc6cafd,
+		0x6cbc2eb0, 0x6d7e4487, 0x6f38fade, 0x6efa90e9, 0x6bb5866c, 0x6a77ec5b, 0x68315202, 0x69f33835,
+		0x62af7f08, 0x636d153f, 0x612bab66, 0x60e9c151, 0x65a6d7d4, 0x6464bde3, 0x662203ba, 0x67e0698d,
+		0x48d7cb20, 0x4915a117, 0x4b531f4e, 0x4a917579, 0x4fde63fc, 0x4e1c09cb, 0x4c5ab792, 0x4d98dda5,
+		0x46c49a98, 0x4706f0af, 0x45404ef6, 0x448224c1, 0x41cd3244, 0x400f5873, 0x4249e62a, 0x438b8c1d,
+		0x54f16850, 0x55330267, 0x5775bc3e, 0x56b7d609, 0x53f8c08c, 0x523aaabb, 0x507c14e2, 0x51be7ed5,
+		0x5ae239e8, 0x5b2053df, 0x5966ed86, 0x58a487b1, 0x5deb9134, 0x5c29fb03, 0x5e6f455a, 0x5fad2f6d,
+		0xe1351b80, 0xe0f771b7, 0xe2b1cfee, 0xe373a5d9, 0xe63cb35c, 0xe7fed96b, 0xe5b86732, 0xe47a0d05,
+		0xef264a38, 0xeee4200f, 0xeca29e56, 0xed60f461, 0xe82fe2e4, 0xe9ed88d3, 0xebab368a, 0xea695cbd,
+		0xfd13b8f0, 0xfcd1d2c7, 0xfe976c9e, 0xff5506a9, 0xfa1a102c, 0xfbd87a1b, 0xf99ec442, 0xf85cae75,
+		0xf300e948, 0xf2c2837f, 0xf0843d26, 0xf1465711, 0xf4094194, 0xf5cb2ba3, 0xf78d95fa, 0xf64fffcd,
+		0xd9785d60, 0xd8ba3757, 0xdafc890e, 0xdb3ee339, 0xde71f5bc, 0xdfb39f8b, 0xddf521d2, 0xdc374be5,
+		0xd76b0cd8, 0xd6a966ef, 0xd4efd8b6, 0xd52db281, 0xd062a404, 0xd1a0ce33, 0xd3e6706a, 0xd2241a5d,
+		0xc55efe10, 0xc49c9427, 0xc6da2a7e, 0xc7184049, 0xc25756cc, 0xc3953cfb, 0xc1d382a2, 0xc011e895,
+		0xcb4dafa8, 0xca8fc59f, 0xc8c97bc6, 0xc90b11f1, 0xcc440774, 0xcd866d43, 0xcfc0d31a, 0xce02b92d,
+		0x91af9640, 0x906dfc77, 0x922b422e, 0x93e92819, 0x96a63e9c, 0x976454ab, 0x9522eaf2, 0x94e080c5,
+		0x9fbcc7f8, 0x9e7eadcf, 0x9c381396, 0x9dfa79a1, 0x98b56f24, 0x99770513, 0x9b31bb4a, 0x9af3d17d,
+		0x8d893530, 0x8c4b5f07, 0x8e0de15e, 0x8fcf8b69, 0x8a809dec, 0x8b42f7db, 0x89044982, 0x88c623b5,
+		0x839a6488, 0x82580ebf, 0x801eb0e6, 0x81dcdad1, 0x8493cc54, 0x8551a663, 0x8717183a, 0x86d5720d,
+		0xa9e2d0a0, 0xa820ba97, 0xaa6604ce, 0xaba46ef9, 0xaeeb787c, 0xaf29124b, 0xad6fac12, 0xacadc625,
+		0xa7f18118, 0xa633eb2f, 0xa4755576, 0xa5b73f41, 0xa0f829c4, 0xa13a43f3, 0xa37cfdaa, 0xa2be979d,
+		0xb5c473d0, 0xb40619e7, 0xb640a7be, 0xb782cd89, 0xb2cddb0c, 0xb30fb13b, 0xb1490f62, 0xb08b6555,
+		0xbbd72268, 0xba15485f, 0xb853f606, 0xb9919c31, 0xbcde8ab4, 0xbd1ce083, 0xbf5a5eda, 0xbe9834ed,
+	},
+	{
+		0x00000000, 0xb8bc6765, 0xaa09c88b, 0x12b5afee, 0x8f629757, 0x37def032, 0x256b5fdc, 0x9dd738b9,
+		0xc5b428ef, 0x7d084f8a, 0x6fbde064, 0xd7018701, 0x4ad6bfb8, 0xf26ad8dd, 0xe0df7733, 0x58631056,
+		0x5019579f, 0xe8a530fa, 0xfa109f14, 0x42acf871, 0xdf7bc0c8, 0x67c7a7ad, 0x75720843, 0xcdce6f26,
+		0x95ad7f70, 0x2d111815, 0x3fa4b7fb, 0x8718d09e, 0x1acfe827, 0xa2738f42, 0xb0c620ac, 0x087a47c9,
+		0xa032af3e, 0x188ec85b, 0x0a3b67b5, 0xb28700d0, 0x2f503869, 0x97ec5f0c, 0x8559f0e2, 0x3de59787,
+		0x658687d1, 0xdd3ae0b4, 0xcf8f4f5a, 0x7733283f, 0xeae41086, 0x525877e3, 0x40edd80d, 0xf851bf68,
+		0xf02bf8a1, 0x48979fc4, 0x5a22302a, 0xe29e574f, 0x7f496ff6, 0xc7f50893, 0xd540a77d, 0x6dfcc018,
+		0x359fd04e, 0x8d23b72b, 0x9f9618c5, 0x272a7fa0, 0xbafd4719, 0x0241207c, 0x10f48f92, 0xa848e8f7,
+		0x9b14583d, 0x23a83f58, 0x311d90b6, 0x89a1f7d3, 0x1476cf6a, 0xaccaa80f, 0xbe7f07e1, 0x06c36084,
+		0x5ea070d2, 0xe61c17b7, 0xf4a9b859, 0x4c15df3c, 0xd1c2e785, 0x697e80e0, 0x7bcb2f0e, 0xc377486b,
+		0xcb0d0fa2, 0x73b168c7, 0x6104c729, 0xd9b8a04c, 0x446f98f5, 0xfcd3ff90, 0xee66507e, 0x56da371b,
+		0x0eb9274d, 0xb6054028, 0xa4b0efc6, 0x1c0c88a3, 0x81dbb01a, 0x3967d77f, 0x2bd27891, 0x936e1ff4,
+		0x3b26f703, 0x839a9066, 0x912f3f88, 0x299358ed, 0xb4446054, 0x0cf80731, 0x1e4da8df, 0xa6f1cfba,
+		0xfe92dfec, 0x462eb889, 0x549b1767, 0xec277002, 0x71f048bb, 0xc94c2fde, 0xdbf98030, 0x6345e755,
+		0x6b3fa09c, 0xd383c7f9, 0xc1366817, 0x798a0f72, 0xe45d37cb, 0x5ce150ae, 0x4e54ff40, 0xf6e89825,
+		0xae8b8873, 0x1637ef16, 0x048240f8, 0xbc3e279d, 0x21e91f24, 0x99557841, 0x8be0d7af, 0x335cb0ca,
+		0xed59b63b, 0x55e5d15e, 0x47507eb0, 0xffec19d5, 0x623b216c, 0xda874609, 0xc832e9e7, 0x708e8e82,
+		0x28ed9ed4, 0x9051f9b1, 0x82e4565f, 0x3a58313a, 0xa78f0983, 0x1f336ee6, 0x0d86c108, 0xb53aa66d,
+		0xbd40e1a4, 0x05fc86c1, 0x1749292f, 0xaff54e4a, 0x322276f3, 0x8a9e1196, 0x982bbe78, 0x2097d91d,
+		0x78f4c94b, 0xc048ae2e, 0xd2fd01c0, 0x6a4166a5, 0xf7965e1c, 0x4f2a3979, 0x5d9f9697, 0xe523f1f2,
+		0x4d6b1905, 0xf5d77e60, 0xe762d18e, 0x5fdeb6eb, 0xc2098e52, 0x7ab5e937, 0x680046d9, 0xd0bc21bc,
+		0x88df31ea, 0x3063568f, 0x22d6f961, 0x9a6a9e04, 0x07bda6bd, 0xbf01c1d8, 0xadb46e36, 0x15080953,
+		0x1d724e9a, 0xa5ce29ff, 0xb77b8611, 0x0fc7e174, 0x9210d9cd, 0x2aacbea8, 0x38191146, 0x80a57623,
+		0xd8c66675, 0x607a0110, 0x72cfaefe, 0xca73c99b, 0x57a4f122, 0xef189647, 0xfdad39a9, 0x45115ecc,
+		0x764dee06, 0xcef18963, 0xdc44268d, 0x64f841e8, 0xf92f7951, 0x41931e34, 0x5326b1da, 0xeb9ad6bf,
+		0xb3f9c6e9, 0x0b45a18c, 0x19f00e62, 0xa14c6907, 0x3c9b51be, 0x842736db, 0x96929935, 0x2e2efe50,
+		0x2654b999, 0x9ee8defc, 0x8c5d7112, 0x34e11677, 0xa9362ece, 0x118a49ab, 0x033fe645, 0xbb838120,
+		0xe3e09176, 0x5b5cf613, 0x49e959fd, 0xf1553e98, 0x6c820621, 0xd43e6144, 0xc68bceaa, 0x7e37a9cf,
+		0xd67f4138, 0x6ec3265d, 0x7c7689b3, 0xc4caeed6, 0x591dd66f, 0xe1a1b10a, 0xf3141ee4, 0x4ba87981,
+		0x13cb69d7, 0xab770eb2, 0xb9c2a15c, 0x017ec639, 0x9ca9fe80, 0x241599e5, 0x36a0360b, 0x8e1c516e,
+		0x866616a7, 0x3eda71c2, 0x2c6fde2c, 0x94d3b949, 0x090481f0, 0xb1b8e695, 0xa30d497b, 0x1bb12e1e,
+		0x43d23e48, 0xfb6e592d, 0xe9dbf6c3, 0x516791a6, 0xccb0a91f, 0x740cce7a, 0x66b96194, 0xde0506f1,
+	},
+	{
+		0x00000000, 0x3d6029b0, 0x7ac05360, 0x47a07ad0, 0xf580a6c0, 0xc8e08f70, 0x8f40f5a0, 0xb220dc10,
+		0x30704bc1, 0x0d106271, 0x4ab018a1, 0x77d03111, 0xc5f0ed01, 0xf890c4b1, 0xbf30be61, 0x825097d1,
+		0x60e09782, 0x5d80be32, 0x1a20c4e2, 0x2740ed52, 0x95603142, 0xa80018f2, 0xefa06222, 0xd2c04b92,
+		0x5090dc43, 0x6df0f5f3, 0x2a508f23, 0x1730a693, 0xa5107a83, 0x98705333, 0xdfd029e3, 0xe2b00053,
+		0xc1c12f04, 0xfca106b4, 0xbb017c64, 0x866155d4, 0x344189c4, 0x0921a074, 0x4e81daa4, 0x73e1f314,
+		0xf1b164c5, 0xccd14d75, 0x8b7137a5, 0xb6111e15, 0x0431c205, 0x3951ebb5, 0x7ef19165, 0x4391b8d5,
+		0xa121b886, 0x9c419136, 0xdbe1ebe6, 0xe681c256, 0x54a11e46, 0x69c137f6, 0x2e614d26, 0x13016496,
+		0x9151f347, 0xac31daf7, 0xeb91a027, 0xd6f18997, 0x64d15587, 0x59b17c37, 0x1e1106e7, 0x23712f57,
+		0x58f35849, 0x659371f9, 0x22330b29, 0x1f532299, 0xad73fe89, 0x9013d739, 0xd7b3ade9, 0xead38459,
+		0x68831388, 0x55e33a38, 0x124340e8, 0x2f236958, 0x9d03b548, 0xa0639cf8, 0xe7c3e628, 0xdaa3cf98,
+		0x3813cfcb, 0x0573e67b, 0x42d39cab, 0x7fb3b51b, 0xcd93690b, 0xf0f340bb, 0xb7533a6b, 0x8a3313db,
+		0x0863840a, 0x3503adba, 0x72a3d76a, 0x4fc3feda, 0xfde322ca, 0xc0830b7a, 0x872371aa, 0xba43581a,
+		0x9932774d, 0xa4525efd, 0xe3f2242d, 0xde920d9d, 0x6cb2d18d, 0x51d2f83d, 0x167282ed, 0x2b12ab5d,
+		0xa9423c8c, 0x9422153c, 0xd3826fec, 0xeee2465c, 0x5cc29a4c, 0x61a2b3fc, 0x2602c92c, 0x1b62e09c,
+		0xf9d2e0cf, 0xc4b2c97f, 0x8312b3af, 0xbe729a1f, 0x0c52460f, 0x31326fbf, 0x7692156f, 0x4bf23cdf,
+		0xc9a2ab0e, 0xf4c282be, 0xb362f86e, 0x8e02d1de, 0x3c220dce, 0x0142247e, 0x46e25eae, 0x7b82771e,
+		0xb1e6b092, 0x8c869922, 0xcb26e3f2, 0xf646ca42, 0x44661652, 0x79063fe2, 0x3ea64532, 0x03c66c82,
+		0x8196fb53, 0xbcf6d2e3, 0xfb56a833, 0xc6368183, 0x74165d93, 0x49767423, 0x0ed60ef3, 0x33b62743,
+		0xd1062710, 0xec660ea0, 0xabc67470, 0x96a65dc0, 0x248681d0, 0x19e6a860, 0x5e46d2b0, 0x6326fb00,
+		0xe1766cd1, 0xdc164561, 0x9bb63fb1, 0xa6d61601, 0x14f6ca11, 0x2996e3a1, 0x6e369971, 0x5356b0c1,
+		0x70279f96, 0x4d47b626, 0x0ae7ccf6, 0x3787e546, 0x85a73956, 0xb8c710e6, 0xff676a36, 0xc2074386,
+		0x4057d457, 0x7d37fde7, 0x3a978737, 0x07f7ae87, 0xb5d77297, 0x88b75b27, 0xcf1721f7, 0xf2770847,
+		0x10c70814, 0x2da721a4, 0x6a075b74, 0x576772c4, 0xe547aed4, 0xd8278764, 0x9f87fdb4, 0xa2e7d404,
+		0x20b743d5, 0x1dd76a65, 0x5a7710b5, 0x67173905, 0xd537e515, 0xe857cca5, 0xaff7b675, 0x92979fc5,
+		0xe915e8db, 0xd475c16b, 0x93d5bbbb, 0xaeb5920b, 0x1c954e1b, 0x21f567ab, 0x66551d7b, 0x5b3534cb,
+		0xd965a31a, 0xe4058aaa, 0xa3a5f07a, 0x9ec5d9ca, 0x2ce505da, 0x11852c6a, 0x562556ba, 0x6b457f0a,
+		0x89f57f59, 0xb49556e9, 0xf3352c39, 0xce550589, 0x7c75d999, 0x4115f029, 0x06b58af9, 0x3bd5a349,
+		0xb9853498, 0x84e51d28, 0xc34567f8, 0xfe254e48, 0x4c059258, 0x7165bbe8, 0x36c5c138, 0x0ba5e888,
+		0x28d4c7df, 0x15b4ee6f, 0x521494bf, 0x6f74bd0f, 0xdd54611f, 0xe03448af, 0xa794327f, 0x9af41bcf,
+		0x18a48c1e, 0x25c4a5ae, 0x6264df7e, 0x5f04f6ce, 0xed242ade, 0xd044036e, 0x97e479be, 0xaa84500e,
+		0x4834505d, 0x755479ed, 0x32f4033d, 0x0f942a8d, 0xbdb4f69d, 0x80d4df2d, 0xc774a5fd, 0xfa148c4d,
+		0x78441b9c, 0x4524322c, 0x028448fc, 0x3fe4614c, 0x8dc4bd5c, 0xb0a494ec, 0xf704ee3c, 0xca64c78c,
+	},
+	{
+		0x00000000, 0xcb5cd3a5, 0x4dc8a10b, 0x869472ae, 0x9b914216, 0x50cd91b3, 0xd659e31d, 0x1d0530b8,
+		0xec53826d, 0x270f51c8, 0xa19b2366, 0x6ac7f0c3, 0x77c2c07b, 0xbc9e13de, 0x3a0a6170, 0xf156b2d5,
+		0x03d6029b, 0xc88ad13e, 0x4e1ea390, 0x85427035, 0x9847408d, 0x531b9328, 0xd58fe186, 0x1ed33223,
+		0xef8580f6, 0x24d95353, 0xa24d21fd, 0x6911f258, 0x7414c2e0, 0xbf481145, 0x39dc63eb, 0xf280b04e,
+		0x07ac0536, 0xccf0d693, 0x4a64a43d, 0x81387798, 0x9c3d4720, 0x57619485, 0xd1f5e62b, 0x1aa9358e,
+		0xebff875b, 0x20a354fe, 0xa6372650, 0x6d6bf5f5, 0x706ec54d, 0xbb3216e8, 0x3da66446, 0xf6fab7e3,
+		0x047a07ad, 0xcf26d408, 0x49b2a6a6, 0x82ee7503, 0x9feb45bb, 0x54b7961e, 0xd223e4b0, 0x197f3715,
+		0xe82985c0, 0x23755665, 0xa5e124cb, 0x6ebdf76e, 0x73b8c7d6, 0xb8e41473, 0x3e7066dd, 0xf52cb578,
+		0x0f580a6c, 0xc404d9c9, 0x4290ab67, 0x89cc78c2, 0x94c9487a, 0x5f959bdf, 0xd901e971, 0x125d3ad4,
+		0xe30b8801, 0x28575ba4, 0xaec3290a, 0x659ffaaf, 0x789aca17, 0xb3c619b2, 0x35526b1c, 0xfe0eb8b9,
+		0x0c8e08f7, 0xc7d2db52, 0x4146a9fc, 0x8a1a7a59, 0x971f4ae1, 0x5c439944, 0xdad7ebea, 0x118b384f,
+		0xe0dd8a9a, 0x2b81593f, 0xad152b91, 0x6649f834, 0x7b4cc88c, 0xb0101b29, 0x36846987, 0xfdd8ba22,
+		0x08f40f5a, 0xc3a8dcff, 0x453cae51, 0x8e607df4, 0x93654d4c, 0x58399ee9, 0xdeadec47, 0x15f13fe2,
+		0xe4a78d37, 0x2ffb5e92, 0xa96f2c3c, 0x6233ff99, 0x7f36cf21, 0xb46a1c84, 0x32fe6e2a, 0xf9a2bd8f,
+		0x0b220dc1, 0xc07ede64, 0x46eaacca, 0x8db67f6f, 0x90b34fd7, 0x5bef9c72, 0xdd7beedc, 0x16273d79,
+		0xe7718fac, 0x2c2d5c09, 0xaab92ea7, 0x61e5fd02, 0x7ce0cdba, 0xb7bc1e1f, 0x31286cb1, 0xfa74bf14,
+		0x1eb014d8, 0xd5ecc77d, 0x5378b5d3, 0x98246676, 0x852156ce, 0x4e7d856b, 0xc8e9f7c5, 0x03b52460,
+		0xf2e396b5, 0x39bf4510, 0xbf2b37be, 0x7477e41b, 0x6972d4a3, 0xa22e0706, 0x24ba75a8, 0xefe6a60d,
+		0x1d661643, 0xd63ac5e6, 0x50aeb748, 0x9bf264ed, 0x86f75455, 0x4dab87f0, 0xcb3ff55e, 0x006326fb,
+		0xf135942e, 0x3a69478b, 0xbcfd3525, 0x77a1e680, 0x6aa4d638, 0xa1f8059d, 0x276c7733, 0xec30a496,
+		0x191c11ee, 0xd240c24b, 0x54d4b0e5, 0x9f886340, 0x828d53f8, 0x49d1805d, 0xcf45f2f3, 0x04192156,
+		0xf54f9383, 0x3e134026, 0xb8873288, 0x73dbe12d, 0x6eded195, 0xa5820230, 0x2316709e, 0xe84aa33b,
+		0x1aca1375, 0xd196c0d0, 0x5702b27e, 0x9c5e61db, 0x815b5163, 0x4a0782c6, 0xcc93f068, 0x07cf23cd,
+		0xf6999118, 0x3dc542bd, 0xbb513013, 0x700de3b6, 0x6d08d30e, 0xa65400ab, 0x20c07205, 0xeb9ca1a0,
+		0x11e81eb4, 0xdab4cd11, 0x5c20bfbf, 0x977c6c1a, 0x8a795ca2, 0x41258f07, 0xc7b1fda9, 0x0ced2e0c,
+		0xfdbb9cd9, 0x36e74f7c, 0xb0733dd2, 0x7b2fee77, 0x662adecf, 0xad760d6a, 0x2be27fc4, 0xe0beac61,
+		0x123e1c2f, 0xd962cf8a, 0x5ff6bd24, 0x94aa6e81, 0x89af5e39, 0x42f38d9c, 0xc467ff32, 0x0f3b2c97,
+		0xfe6d9e42, 0x35314de7, 0xb3a53f49, 0x78f9ecec, 0x65fcdc54, 0xaea00ff1, 0x28347d5f, 0xe368aefa,
+		0x16441b82, 0xdd18c827, 0x5b8cba89, 0x90d0692c, 0x8dd55994, 0x46898a31, 0xc01df89f, 0x0b412b3a,
+		0xfa1799ef, 0x314b4a4a, 0xb7df38e4, 0x7c83eb41, 0x6186dbf9, 0xaada085c, 0x2c4e7af2, 0xe712a957,
+		0x15921919, 0xdececabc, 0x585ab812, 0x93066bb7, 0x8e035b0f, 0x455f88aa, 0xc3cbfa04, 0x089729a1,
+		0xf9c19b74, 0x329d48d1, 0xb4093a7f, 0x7f55e9da, 0x6250d962, 0xa90c0ac7, 0x2f987869, 0xe4c4abcc,
+	},
+	{
+		0x00000000, 0xa6770bb4, 0x979f1129, 0x31e81a9d, 0xf44f2413, 0x52382fa7, 0x63d0353a, 0xc5a73e8e,
+		0x33ef4e67, 0x959845d3, 0xa4705f4e, 0x020754fa, 0xc7a06a74, 0x61d761c0, 0x503f7b5d, 0xf64870e9,
+		0x67de9cce, 0xc1a9977a, 0xf0418de7, 0x56368653, 0x9391b8dd, 0x35e6b369, 0x040ea9f4, 0xa279a240,
+		0x5431d2a9, 0xf246d91d, 0xc3aec380, 0x65d9c834, 0xa07ef6ba, 0x0609fd0e, 0x37e1e793, 0x9196ec27,
+		0xcfbd399c, 0x69ca3228, 0x582228b5, 0xfe552301, 0x3bf21d8f, 0x9d85163b, 0xac6d0ca6, 0x0a1a0712,
+		0xfc5277fb, 0x5a257c4f, 0x6bcd66d2, 0xcdba6d66, 0x081d53e8, 0xae6a585c, 0x9f8242c1, 0x39f54975,
+		0xa863a552, 0x0e14aee6, 0x3ffcb47b, 0x998bbfcf, 0x5c2c8141, 0xfa5b8af5, 0xcbb39068, 0x6dc49bdc,
+		0x9b8ceb35, 0x3dfbe081, 0x0c13fa1c, 0xaa64f1a8, 0x6fc3cf26, 0xc9b4c492, 0xf85cde0f, 0x5e2bd5bb,
+		0x440b7579, 0xe27c7ecd, 0xd3946450, 0x75e36fe4, 0xb044516a, 0x16335ade, 0x27db4043, 0x81ac4bf7,
+		0x77e43b1e, 0xd19330aa, 0xe07b2a37, 0x460c2183, 0x83ab1f0d, 0x25dc14b9, 0x14340e24, 0xb2430590,
+		0x23d5e9b7, 0x85a2e203, 0xb44af89e, 0x123df32a, 0xd79acda4, 0x71edc610, 0x4005dc8d, 0xe672d739,
+		0x103aa7d0, 0xb64dac64, 0x87a5b6f9, 0x21d2bd4d, 0xe47583c3, 0x42028877, 0x73ea92ea, 0xd59d995e,
+		0x8bb64ce5, 0x2dc14751, 0x1c295dcc, 0xba5e5678, 0x7ff968f6, 0xd98e6342, 0xe86679df, 0x4e11726b,
+		0xb8590282, 0x1e2e0936, 0x2fc613ab, 0x89b1181f, 0x4c162691, 0xea612d25, 0xdb8937b8, 0x7dfe3c0c,
+		0xec68d02b, 0x4a1fdb9f, 0x7bf7c102, 0xdd80cab6, 0x1827f438, 0xbe50ff8c, 0x8fb8e511, 0x29cfeea5,
+		0xdf879e4c, 0x79f095f8, 0x48188f65, 0xee6f84d1, 0x2bc8ba5f, 0x8dbfb1eb, 0xbc57ab76, 0x1a20a0c2,
+		0x8816eaf2, 0x2e61e146, 0x1f89fbdb, 0xb9fef06f, 0x7c59cee1, 0xda2ec555, 0xebc6dfc8, 0x4db1d47c,
+		0xbbf9a495, 0x1d8eaf21, 0x2c66b5bc, 0x8a11be08, 0x4fb68086, 0xe9c18b32, 0xd82991af, 0x7e5e9a1b,
+		0xefc8763c, 0x49bf7d88, 0x78576715, 0xde206ca1, 0x1b87522f, 0xbdf0599b, 0x8c184306, 0x2a6f48b2,
+		0xdc27385b, 0x7a5033ef, 0x4bb82972, 0xedcf22c6, 0x28681c48, 0x8e1f17fc, 0xbff70d61, 0x198006d5,
+		0x47abd36e, 0xe1dcd8da, 0xd034c247, 0x7643c9f3, 0xb3e4f77d, 0x1593fcc9, 0x247be654, 0x820cede0,
+		0x74449d09, 0xd23396bd, 0xe3db8c20, 0x45ac8794, 0x800bb91a, 0x267cb2ae, 0x1794a833, 0xb1e3a387,
+		0x20754fa0, 0x86024414, 0xb7ea5e89, 0x119d553d, 0xd43a6bb3, 0x724d6007, 0x43a57a9a, 0xe5d2712e,
+		0x139a01c7, 0xb5ed0a73, 0x840510ee, 0x22721b5a, 0xe7d525d4, 0x41a22e60, 0x704a34fd, 0xd63d3f49,
+		0xcc1d9f8b, 0x6a6a943f, 0x5b828ea2, 0xfdf58516, 0x3852bb98, 0x9e25b02c, 0xafcdaab1, 0x09baa105,
+		0xfff2d1ec, 0x5985da58, 0x686dc0c5, 0xce1acb71, 0x0bbdf5ff, 0xadcafe4b, 0x9c22e4d6, 0x3a55ef62,
+		0xabc30345, 0x0db408f1, 0x3c5c126c, 0x9a2b19d8, 0x5f8c2756, 0xf9fb2ce2, 0xc813367f, 0x6e643dcb,
+		0x982c4d22, 0x3e5b4696, 0x0fb35c0b, 0xa9c457bf, 0x6c636931, 0xca146285, 0xfbfc7818, 0x5d8b73ac,
+		0x03a0a617, 0xa5d7ada3, 0x943fb73e, 0x3248bc8a, 0xf7ef8204, 0x519889b0, 0x6070932d, 0xc6079899,
+		0x304fe870, 0x9638e3c4, 0xa7d0f959, 0x01a7f2ed, 0xc400cc63, 0x6277c7d7, 0x539fdd4a, 0xf5e8d6fe,
+		0x647e3ad9, 0xc209316d, 0xf3e12bf0, 0x55962044, 0x90311eca, 0x3646157e, 0x07ae0fe3, 0xa1d90457,
+		0x579174be, 0xf1e67f0a, 0xc00e6597, 0x66796e23, 0xa3de50ad, 0x05a95b19, 0x34414184, 0x92364a30,
+	},
+	{
+		0x00000000, 0xccaa009e, 0x4225077d, 0x8e8f07e3, 0x844a0efa, 0x48e00e64, 0xc66f0987, 0x0ac50919,
+		0xd3e51bb5, 0x1f4f1b2b, 0x91c01cc8, 0x5d6a1c56, 0x57af154f, 0x9b0515d1, 0x158a1232, 0xd92012ac,
+		0x7cbb312b, 0xb01131b5, 0x3e9e3656, 0xf23436c8, 0xf8f13fd1, 0x345b3f4f, 0xbad438ac, 0x767e3832,
+		0xaf5e2a9e, 0x63f42a00, 0xed7b2de3, 0x21d12d7d, 0x2b142464, 0xe7be24fa, 0x69312319, 0xa59b2387,
+		0xf9766256, 0x35dc62c8, 0xbb53652b, 0x77f965b5, 0x7d3c6cac, 0xb1966c32, 0x3f196bd1, 0xf3b36b4f,
+		0x2a9379e3, 0xe639797d, 0x68b67e9e, 0xa41c7e00, 0xaed97719, 0x62737787, 0xecfc7064, 0x205670fa,
+		0x85cd537d, 0x496753e3, 0xc7e85400, 0x0b42549e, 0x01875d87, 0xcd2d5d19, 0x43a25afa, 0x8f085a64,
+		0x562848c8, 0x9a824856, 0x140d4fb5, 0xd8a74f2b, 0xd2624632, 0x1ec846ac, 0x9047414f, 0x5ced41d1,
+		0x299dc2ed, 0xe537c273, 0x6bb8c590, 0xa712c50e, 0xadd7cc17, 0x617dcc89, 0xeff2cb6a, 0x2358cbf4,
+		0xfa78d958, 0x36d2d9c6, 0xb85dde25, 0x74f7debb, 0x7e32d7a2, 0xb298d73c, 0x3c17d0df, 0xf0bdd041,
+		0x5526f3c6, 0x998cf358, 0x1703f4bb, 0xdba9f425, 0xd16cfd3c, 0x1dc6fda2, 0x9349fa41, 0x5fe3fadf,
+		0x86c3e873, 0x4a69e8ed, 0xc4e6ef0e, 0x084cef90, 0x0289e689, 0xce23e617, 0x40ace1f4, 0x8c06e16a,
+		0xd0eba0bb, 0x1c41a025, 0x92cea7c6, 0x5e64a758, 0x54a1ae41, 0x980baedf, 0x1684a93c, 0xda2ea9a2,
+		0x030ebb0e, 0xcfa4bb90, 0x412bbc73, 0x8d81bced, 0x8744b5f4, 0x4beeb56a, 0xc561b289, 0x09cbb217,
+		0xac509190, 0x60fa910e, 0xee7596ed, 0x22df9673, 0x281a9f6a, 0xe4b09ff4, 0x6a3f9817, 0xa6959889,
+		0x7fb58a25, 0xb31f8abb, 0x3d908d58, 0xf13a8dc6, 0xfbff84df, 0x37558441, 0xb9da83a2, 0x7570833c,
+		0x533b85da, 0x9f918544, 0x111e82a7, 0xddb48239, 0xd7718b20, 0x1bdb8bbe, 0x95548c5d, 0x59fe8cc3,
+		0x80de9e6f, 0x4c749ef1, 0xc2fb9912, 0x0e51998c, 0x04949095, 0xc83e900b, 0x46b197e8, 0x8a1b9776,
+		0x2f80b4f1, 0xe32ab46f, 0x6da5b38c, 0xa10fb312, 0xabcaba0b, 0x6760ba95, 0xe9efbd76, 0x2545bde8,
+		0xfc65af44, 0x30cfafda, 0xbe40a839, 0x72eaa8a7, 0x782fa1be, 0xb485a120, 0x3a0aa6c3, 0xf6a0a65d,
+		0xaa4de78c, 0x66e7e712, 0xe868e0f1, 0x24c2e06f, 0x2e07e976, 0xe2ade9e8, 0x6c22ee0b, 0xa088ee95,
+		0x79a8fc39, 0xb502fca7, 0x3b8dfb44, 0xf727fbda, 0xfde2f2c3, 0x3148f25d, 0xbfc7f5be, 0x736df520,
+		0xd6f6d6a7, 0x1a5cd639, 0x94d3d1da, 0x5879d144, 0x52bcd85d, 0x9e16d8c3, 0x1099df20, 0xdc33dfbe,
+		0x0513cd12, 0xc9b9cd8c, 0x4736ca6f, 0x8b9ccaf1, 0x8159c3e8, 0x4df3c376, 0xc37cc495, 0x0fd6c40b,
+		0x7aa64737, 0xb60c47a9, 0x3883404a, 0xf42940d4, 0xfeec49cd, 0x32464953, 0xbcc94eb0, 0x70634e2e,
+		0xa9435c82, 0x65e95c1c, 0xeb665bff, 0x27cc5b61, 0x2d095278, 0xe1a352e6, 0x6f2c5505, 0xa386559b,
+		0x061d761c, 0xcab77682, 0x44387161, 0x889271ff, 0x825778e6, 0x4efd7878, 0xc0727f9b, 0x0cd87f05,
+		0xd5f86da9, 0x19526d37, 0x97dd6ad4, 0x5b776a4a, 0x51b26353, 0x9d1863cd, 0x1397642e, 0xdf3d64b0,
+		0x83d02561, 0x4f7a25ff, 0xc1f5221c, 0x0d5f2282, 0x079a2b9b, 0xcb302b05, 0x45bf2ce6, 0x89152c78,
+		0x50353ed4, 0x9c9f3e4a, 0x121039a9, 0xdeba3937, 0xd47f302e, 0x18d530b0, 0x965a3753, 0x5af037cd,
+		0xff6b144a, 0x33c114d4, 0xbd4e1337, 0x71e413a9, 0x7b211ab0, 0xb78b1a2e, 0x39041dcd, 0xf5ae1d53,
+		0x2c8e0fff, 0xe0240f61, 0x6eab0882, 0xa201081c, 0xa8c40105, 0x646e019b, 0xeae10678, 0x264b06e6,
+	},
 };
 
-static void cp_put8(cp_save_png_data_t* s, uint32_t a)
+// Running CRC-32 and Adler-32, start from 0 and 1 respectively like zlib.
+// CRC-32 is table driven eight bytes at a time, or folded with carry-less multiplies on
+// x86 CPUs with PCLMULQDQ. Adler-32 only reduces mod 65521 every CP_ADLER_NMAX bytes,
+// which is as long as the sums can go without overflowing, and sums 16 or 32 bytes at a
+// time with SSE2 or AVX2.
+static uint32_t cp_crc32_portable(uint32_t crc, const uint8_t* p, int len)
 {
-	fputc(a, s->fp);
-	s->crc = (s->crc >> 4) ^ tpCRC_TABLE[(s->crc & 15) ^ (a & 15)];
-	s->crc = (s->crc >> 4) ^ tpCRC_TABLE[(s->crc & 15) ^ (a >> 4)];
+	crc = ~crc;
+	for (; len >= 8; len -= 8, p += 8)
+	{
+		uint32_t a = crc ^ ((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+		crc = cp_crc_table[7][a & 0xFF] ^ cp_crc_table[6][(a >> 8) & 0xFF] ^ cp_crc_table[5][(a >> 16) & 0xFF] ^ cp_crc_table[4][a >> 24]
+			^ cp_crc_table[3][p[4]] ^ cp_crc_table[2][p[5]] ^ cp_crc_table[1][p[6]] ^ cp_crc_table[0][p[7]];
+	}
+
+	while (len--) crc = (crc >> 8) ^ cp_crc_table[0][(crc ^ *p++) & 0xFF];
+	return ~crc;
 }
 
-static void cp_update_adler(cp_save_png_data_t* s, uint32_t v)
+#ifdef CUTE_PNG_PCLMUL
+
+// Folds 64 bytes at a time into four 128 bit lanes, then folds the lanes together and
+// Barrett reduces down to 32 bits. Constants are powers of x mod the reflected polynomial,
+// see Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ". len is a
+// multiple of 16 and at least 64, crc is the raw register (not inverted).
+CUTE_PNG_TARGET_PCLMUL static uint32_t cp_crc32_fold(uint32_t crc, const uint8_t* p, int len)
 {
-	uint32_t s1 = s->adler & 0xFFFF;
-	uint32_t s2 = (s->adler >> 16) & 0xFFFF;
-	s1 = (s1 + v) % 65521;
-	s2 = (s2 + s1) % 65521;
-	s->adler = (s2 << 16) + s1;
+	const __m128i k1k2 = _mm_set_epi64x(0x1c6e41596, 0x154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x0ccaa009e, 0x1751997d0);
+	const __m128i k5 = _mm_set_epi64x(0, 0x163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x1f7011641, 0x1db710641);
+	const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+	__m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)p), _mm_cvtsi32_si128((int)crc));
+	__m128i x1 = _mm_loadu_si128((const __m128i*)(p + 16));
+	__m128i x2 = _mm_loadu_si128((const __m128i*)(p + 32));
+	__m128i x3 = _mm_loadu_si128((const __m128i*)(p + 48));
+	__m128i t;
+
+	for (p += 64, len -= 64; len >= 64; p += 64, len -= 64)
+	{
+		#define CP_FOLD(x, k, data) _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), data)
+		x0 = CP_FOLD(x0, k1k2, _mm_loadu_si128((const __m128i*)p));
+		x1 = CP_FOLD(x1, k1k2, _mm_loadu_si128((const __m128i*)(p + 16)));
+		x2 = CP_FOLD(x2, k1k2, _mm_loadu_si128((const __m128i*)(p + 32)));
+		x3 = CP_FOLD(x3, k1k2, _mm_loadu_si128((const __m128i*)(p + 48)));
+	}
+
+	x0 = CP_FOLD(x0, k3k4, x1);
+	x0 = CP_FOLD(x0, k3k4, x2);
+	x0 = CP_FOLD(x0, k3k4, x3);
+	for (; len >= 16; p += 16, len -= 16) x0 = CP_FOLD(x0, k3k4, _mm_loadu_si128((const __m128i*)p));
+	#undef CP_FOLD
+
+	// 128 -> 64 bits, then 64 -> 32 bits with 32 zero bits appended
+	x0 = _mm_xor_si128(_mm_srli_si128(x0, 8), _mm_clmulepi64_si128(k3k4, x0, 0x01));
+	x0 = _mm_xor_si128(_mm_srli_si128(x0, 4), _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), k5, 0x00));
+
+	// Barrett reduction
+	t = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), poly, 0x10);
+	t = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), poly, 0x00);
+	return (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(_mm_xor_si128(x0, t), 4));
 }
 
-static void cp_put32(cp_save_png_data_t* s, uint32_t v)
+#endif // CUTE_PNG_PCLMUL
+
+static uint32_t cp_crc32(uint32_t crc, const uint8_t* p, int len)
 {
-	cp_put8(s, (v >> 24) & 0xFF);
-	cp_put8(s, (v >> 16) & 0xFF);
-	cp_put8(s, (v >> 8) & 0xFF);
-	cp_put8(s, v & 0xFF);
+#ifdef CUTE_PNG_PCLMUL
+	if (len >= 64 && __builtin_cpu_supports("pclmul"))
+	{
+		int n = len & ~15;
+		crc = ~cp_crc32_fold(~crc, p, n);
+		p += n;
+		len -= n;
+	}
+#endif
+	return cp_crc32_portable(crc, p, len);
 }
 
-static void cp_put_bits(cp_save_png_data_t* s, uint32_t data, uint32_t bitcount)
+// Most bytes that can be summed before s2 could overflow 32 bits, same as zlib
+#define CP_ADLER_NMAX 5552
+
+static uint32_t cp_adler32_portable(uint32_t adler, const uint8_t* p, int len)
 {
-	while (bitcount--)
+	uint32_t s1 = adler & 0xFFFF;
+	uint32_t s2 = (adler >> 16) & 0xFFFF;
+	while (len)
 	{
-		uint32_t prev = s->bits;
-		s->bits = (s->bits >> 1) | ((data & 1) << 7);
-		data >>= 1;
-
-		if (prev & 1)
+		int n = len < CP_ADLER_NMAX ? len : CP_ADLER_NMAX;
+		len -= n;
+		for (; n >= 4; n -= 4, p += 4)
 		{
-			cp_put8(s, s->bits);
-			s->bits = 0x80;
+			s1 += p[0]; s2 += s1;
+			s1 += p[1]; s2 += s1;
+			s1 += p[2]; s2 += s1;
+			s1 += p[3]; s2 += s1;
 		}
+		while (n--)
+		{
+			s1 += *p++;
+			s2 += s1;
+		}
+		s1 %= 65521;
+		s2 %= 65521;
 	}
+	return (s2 << 16) | s1;
 }
 
-static void cp_put_bitsr(cp_save_png_data_t* s, uint32_t data, uint32_t bitcount)
-{
-	while (bitcount--)
-		cp_put_bits(s, data >> bitcount, 1);
-}
+#ifdef CUTE_PNG_SSE2
 
-static void cp_begin_chunk(cp_save_png_data_t* s, const char* id, uint32_t len)
+// Within a block, s2 gains s1 once per byte plus each byte weighted by how many bytes
+// follow it. Sums of bytes come from psadbw, the weighted sums from pmaddwd against 16..1,
+// and s1 is added to a running total before each chunk which is scaled by 16 at the end.
+static uint32_t cp_adler32_sse2(uint32_t adler, const uint8_t* p, int len)
 {
-	cp_put32(s, len);
-	s->crc = 0xFFFFFFFF;
-	cp_put8(s, id[0]);
-	cp_put8(s, id[1]);
-	cp_put8(s, id[2]);
-	cp_put8(s, id[3]);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i w_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+	const __m128i w_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+	uint32_t s1 = adler & 0xFFFF;
+	uint32_t s2 = (adler >> 16) & 0xFFFF;
+
+	while (len >= 16)
+	{
+		int n = (len < CP_ADLER_NMAX ? len : CP_ADLER_NMAX) & ~15;
+		__m128i v1 = zero, v2 = zero, vs = zero;
+		len -= n;
+		s2 += s1 * n;
+		for (; n; n -= 16, p += 16)
+		{
+			__m128i b = _mm_loadu_si128((const __m128i*)p);
+			vs = _mm_add_epi32(vs, v1);
+			v1 = _mm_add_epi32(v1, _mm_sad_epu8(b, zero));
+			v2 = _mm_add_epi32(v2, _mm_madd_epi16(_mm_unpacklo_epi8(b, zero), w_lo));
+			v2 = _mm_add_epi32(v2, _mm_madd_epi16(_mm_unpackhi_epi8(b, zero), w_hi));
+		}
+
+		// Lanes 1 and 3 of v1 and vs are the zero upper halves of psadbw's results
+		v2 = _mm_add_epi32(v2, _mm_slli_epi32(vs, 4));
+		v1 = _mm_add_epi32(v1, _mm_shuffle_epi32(v1, _MM_SHUFFLE(1, 0, 3, 2)));
+		v2 = _mm_add_epi32(v2, _mm_shuffle_epi32(v2, _MM_SHUFFLE(1, 0, 3, 2)));
+		v2 = _mm_add_epi32(v2, _mm_shuffle_epi32(v2, _MM_SHUFFLE(2, 3, 0, 1)));
+		s1 = (s1 + (uint32_t)_mm_cvtsi128_si32(v1)) % 65521;
+		s2 = (s2 + (uint32_t)_mm_cvtsi128_si32(v2)) % 65521;
+	}
+
+	return cp_adler32_portable((s2 << 16) | s1, p, len);
 }
 
+#endif // CUTE_PNG_SSE2
+
+#ifdef CUTE_PNG_AVX2
+
+// Same as the SSE2 version 32 bytes at a time, pmaddubsw does the weighting straight
+// from bytes
+CUTE_PNG_TARGET_AVX2 static uint32_t cp_adler32_avx2(uint32_t adler, const uint8_t* p, int len)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i w = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+		16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+	uint32_t s1 = adler & 0xFFFF;
+	uint32_t s2 = (adler >> 16) & 0xFFFF;
+
+	while (len >= 32)
+	{
+		int n = (len < CP_ADLER_NMAX ? len : CP_ADLER_NMAX) & ~31;
+		__m256i v1 = zero, v2 = zero, vs = zero;
+		__m128i h1, h2;
+		len -= n;
+		s2 += s1 * n;
+		for (; n; n -= 32, p += 32)
+		{
+			__m256i b = _mm256_loadu_si256((const __m256i*)p);
+			vs = _mm256_add_epi32(vs, v1);
+			v1 = _mm256_add_epi32(v1, _mm256_sad_epu8(b, zero));
+			v2 = _mm256_add_epi32(v2, _mm256_madd_epi16(_mm256_maddubs_epi16(b, w), ones));
+		}
+
+		v2 = _mm256_add_epi32(v2, _mm256_slli_epi32(vs, 5));
+		h1 = _mm_add_epi32(_mm256_castsi256_si128(v1), _mm256_extracti128_si256(v1, 1));
+		h2 = _mm_add_epi32(_mm256_castsi256_si128(v2), _mm256_extracti128_si256(v2, 1));
+		h1 = _mm_add_epi32(h1, _mm_shuffle_epi32(h1, _MM_SHUFFLE(1, 0, 3, 2)));
+		h2 = _mm_add_epi32(h2, _mm_shuffle_epi32(h2, _MM_SHUFFLE(1, 0, 3, 2)));
+		h2 = _mm_add_epi32(h2, _mm_shuffle_epi32(h2, _MM_SHUFFLE(2, 3, 0, 1)));
+		s1 = (s1 + (uint32_t)_mm_cvtsi128_si32(h1)) % 65521;
+		s2 = (s2 + (uint32_t)_mm_cvtsi128_si32(h2)) % 65521;
+	}
+
+	return cp_adler32_sse2((s2 << 16) | s1, p, len);
+}
+
+#endif // CUTE_PNG_AVX2
+
+static uint32_t cp_adler32(uint32_t adler, const uint8_t* p, int len)
+{
+#ifdef CUTE_PNG_AVX2
+	if (len >= 64 && __builtin_cpu_supports("avx2")) return cp_adler32_avx2(adler, p, len);
+#endif
+#ifdef CUTE_PNG_SSE2
+	return cp_adler32_sse2(adler, p, len);
+#else
+	return cp_adler32_portable(adler, p, len);
+#endif
+}
+
+// Checksum of two pieces of data joined together, from the checksums of
+// each piece and the length of the second. Same as zlib's *_combine.
+static uint32_t cp_adler32_combine(uint32_t adler1, uint32_t adler2, int len2)
+{
+	uint32_t rem = (uint32_t)len2 % 65521;
+	uint32_t s1 = adler1 & 0xFFFF;
+	uint32_t s2 = (rem * s1) % 65521;
+	s1 += (adler2 & 0xFFFF) + 65521 - 1;
+	s2 += ((adler1 >> 16) & 0xFFFF) + ((adler2 >> 16) & 0xFFFF) + 65521 - rem;
+	if (s1 >= 65521) s1 -= 65521;
+	if (s1 >= 65521) s1 -= 65521;
+	if (s2 >= 65521 * 2) s2 -= 65521 * 2;
+	if (s2 >= 65521) s2 -= 65521;
+	return (s2 << 16) | s1;
+}
+
+// a * b modulo the CRC-32 polynomial, bit reflected so x^0 is the top bit
+static uint32_t cp_multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1u << 31, p = 0;
+	while (m)
+	{
+		if (a & m) p ^= b;
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ 0xedb88320 : b >> 1;
+	}
+	return p;
+}
+
+static uint32_t cp_crc32_combine(uint32_t crc1, uint32_t crc2, int len2)
+{
+	// Appending len2 bytes multiplies crc1 by x^(8 * len2)
+	uint32_t xn = 1u << 31;
+	uint32_t x8 = 1u << 23;
+	for (; len2; len2 >>= 1)
+	{
+		if (len2 & 1) xn = cp_multmodp(x8, xn);
+		x8 = cp_multmodp(x8, x8);
+	}
+	return cp_multmodp(xn, crc1) ^ crc2;
+}
+
+static int cp_reserve(cp_save_png_data_t* s, int n)
+{
+	if (s->len + n <= s->cap) return 1;
+	if (s->oom) return 0;
+
+	int cap = s->cap * 2 + n;
+	uint8_t* out = (uint8_t*)CUTE_PNG_ALLOC(cap);
+	if (!out)
+	{
+		s->oom = 1;
+		return 0;
+	}
+
+	if (s->out) CUTE_PNG_MEMCPY(out, s->out, s->len);
+	CUTE_PNG_FREE(s->out);
+	s->out = out;
+	s->cap = cap;
+	return 1;
+}
+
+static void cp_put8(cp_save_png_data_t* s, uint32_t a)
+{
+	if (cp_reserve(s, 1)) s->out[s->len++] = (uint8_t)a;
+}
+
+static void cp_put_bytes(cp_save_png_data_t* s, const void* p, int n)
+{
+	if (n <= 0 || !cp_reserve(s, n)) return;
+	CUTE_PNG_MEMCPY(s->out + s->len, p, n);
+	s->len += n;
+}
+
+static void cp_put32(cp_save_png_data_t* s, uint32_t v)
+{
+	cp_put8(s, (v >> 24) & 0xFF);
+	cp_put8(s, (v >> 16) & 0xFF);
+	cp_put8(s, (v >> 8) & 0xFF);
+	cp_put8(s, v & 0xFF);
+}
+
+static void cp_put_bits(cp_save_png_data_t* s, uint32_t data, int bitcount)
+{
+	s->bits |= (uint64_t)(data & ((1u << bitcount) - 1)) << s->count;
+	s->count += bitcount;
+
+	while (s->count >= 8)
+	{
+		cp_put8(s, (uint32_t)s->bits & 0xFF);
+		s->bits >>= 8;
+		s->count -= 8;
+	}
+}
+
+static uint32_t cp_reverse_bits(uint32_t code, int len)
+{
+	uint32_t r = 0;
+	while (len--)
+	{
+		r = (r << 1) | (code & 1);
+		code >>= 1;
+	}
+	return r;
+}
+
+// Huffman codes are written most significant bit first
+static void cp_put_bitsr(cp_save_png_data_t* s, uint32_t data, int bitcount)
+{
+	cp_put_bits(s, cp_reverse_bits(data, bitcount), bitcount);
+}
+
+static void cp_align_bits(cp_save_png_data_t* s)
+{
+	if (s->count) cp_put_bits(s, 0, 8 - s->count);
+}
+
+static void cp_put_chunk(cp_save_png_data_t* s, const char* id, const uint8_t* data, int len)
+{
+	cp_put32(s, len);
+	int start = s->len;
+	cp_put_bytes(s, id, 4);
+	cp_put_bytes(s, data, len);
+	if (!s->oom) cp_put32(s, cp_crc32(0, s->out + start, len + 4));
+}
+
+// Level 0: run length encoding with the fixed Huffman codes, only ever
+// matches against the previous byte.
 static void cp_encode_literal(cp_save_png_data_t* s, uint32_t v)
 {
-	// Encode a literal/length using the built-in tables.
-	// Could do better with a custom table but whatever.
-	     if (v < 144) cp_put_bitsr(s, 0x030 + v -   0, 8);
-	else if (v < 256) cp_put_bitsr(s, 0x190 + v - 144, 9);
-	else if (v < 280) cp_put_bitsr(s, 0x000 + v - 256, 7);
-	else              cp_put_bitsr(s, 0x0c0 + v - 280, 8);
+	// Encode a literal/length using the built-in tables.
+	// Could do better with a custom table but whatever.
+	     if (v < 144) cp_put_bitsr(s, 0x030 + v -   0, 8);
+	else if (v < 256) cp_put_bitsr(s, 0x190 + v - 144, 9);
+	else if (v < 280) cp_put_bitsr(s, 0x000 + v - 256, 7);
+	else              cp_put_bitsr(s, 0x0c0 + v - 280, 8);
+}
+
+static void cp_encode_len(cp_save_png_data_t* s, uint32_t code, uint32_t bits, uint32_t len)
+{
+	cp_encode_literal(s, code + (len >> bits));
+	cp_put_bits(s, len, bits);
+	cp_put_bits(s, 0, 5);
+}
+
+static void cp_end_run(cp_save_png_data_t* s)
+{
+	s->runlen--;
+	cp_encode_literal(s, s->prev);
+
+	if (s->runlen >= 67) cp_encode_len(s, 277, 4, s->runlen - 67);
+	else if (s->runlen >= 35) cp_encode_len(s, 273, 3, s->runlen - 35);
+	else if (s->runlen >= 19) cp_encode_len(s, 269, 2, s->runlen - 19);
+	else if (s->runlen >= 11) cp_encode_len(s, 265, 1, s->runlen - 11);
+	else if (s->runlen >= 3) cp_encode_len(s, 257, 0, s->runlen - 3);
+	else while (s->runlen--) cp_encode_literal(s, s->prev);
+}
+
+static void cp_encode_byte(cp_save_png_data_t *s, uint8_t v)
+{
+	if (s->prev == v && s->runlen < 115) s->runlen++;
+
+	else
+	{
+		if (s->runlen) cp_end_run(s);
+
+		s->prev = v;
+		s->runlen = 1;
+	}
+}
+
+static void cp_put_stored(cp_save_png_data_t* s, const uint8_t* raw, int len, int final);
+
+static void cp_deflate_rle(cp_save_png_data_t* s, const uint8_t* data, int len, int final)
+{
+	s->prev = 0xFFFF;
+	s->runlen = 0;
+
+	cp_put_bits(s, final | (1 << 1), 3); // fixed dictionary
+	for (int i = 0; i < len; ++i) cp_encode_byte(s, data[i]);
+	if (s->runlen) cp_end_run(s);
+	cp_encode_literal(s, 256); // terminator
+	if (!final) cp_put_stored(s, data, 0, 0);
+}
+
+// Levels 1-9: LZ77 over a 32K window with hash chains, emitted as blocks of
+// dynamic Huffman codes (or fixed or stored, whichever is smallest).
+#define CUTE_PNG_WINDOW_SIZE 32768
+#define CUTE_PNG_HASH_BITS 15
+#define CUTE_PNG_MIN_MATCH 3
+#define CUTE_PNG_MAX_MATCH 258
+#define CUTE_PNG_BLOCK_SYMBOLS 16384 // LZ77 symbols per DEFLATE block
+
+typedef struct cp_level_t
+{
+	int max_chain; // hash chain entries searched per position
+	int nice_len;  // stop searching once a match is this long
+	int lazy_len;  // check the next position for a longer match below this length
+} cp_level_t;
+
+static const cp_level_t cp_levels[10] = {
+	{ 0, 0, 0 },
+	{ 4, 8, 0 },
+	{ 8, 16, 0 },
+	{ 32, 32, 0 },
+	{ 16, 16, 4 },
+	{ 32, 32, 16 },
+	{ 128, 128, 16 },
+	{ 256, 128, 32 },
+	{ 1024, 258, 128 },
+	{ 4096, 258, 258 },
+};
+
+typedef struct cp_deflate_t
+{
+	cp_level_t level;
+	int head[1 << CUTE_PNG_HASH_BITS]; // latest position for each hash, -1 if none
+	int prev[CUTE_PNG_WINDOW_SIZE];    // previous position with the same hash
+
+	// Symbols for the block being built, a distance of 0 marks a literal
+	int sym_count;
+	uint16_t sym_len[CUTE_PNG_BLOCK_SYMBOLS];
+	uint16_t sym_dist[CUTE_PNG_BLOCK_SYMBOLS];
+	uint32_t lit_freq[286];
+	uint32_t dist_freq[30];
+
+	uint8_t len_code[CUTE_PNG_MAX_MATCH + 1];
+	uint8_t dist_code[512]; // see cp_dist_code
+} cp_deflate_t;
+
+static void cp_deflate_init(cp_deflate_t* d, int level)
+{
+	d->level = cp_levels[level];
+	CUTE_PNG_MEMSET(d->head, 0xFF, sizeof(d->head));
+	CUTE_PNG_MEMSET(d->lit_freq, 0, sizeof(d->lit_freq));
+	CUTE_PNG_MEMSET(d->dist_freq, 0, sizeof(d->dist_freq));
+	d->sym_count = 0;
+
+	for (int code = 0; code < 29; ++code)
+		for (int len = cp_len_base[code]; len < (int)cp_len_base[code] + (1 << cp_len_extra_bits[code]) && len <= CUTE_PNG_MAX_MATCH; ++len)
+			d->len_code[len] = code;
+
+	for (int code = 0; code < 30; ++code)
+		for (int dist = cp_dist_base[code] - 1; dist < (int)cp_dist_base[code] - 1 + (1 << cp_dist_extra_bits[code]); ++dist)
+			d->dist_code[dist < 256 ? dist : 256 + (dist >> 7)] = code;
+}
+
+// Distances above 256 are looked up 128 at a time, codes that far out all
+// have at least 7 extra bits.
+static int cp_dist_code(const cp_deflate_t* d, int dist)
+{
+	dist--;
+	return d->dist_code[dist < 256 ? dist : 256 + (dist >> 7)];
+}
+
+static uint32_t cp_hash3(const uint8_t* p)
+{
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+	return (v * 0x9E3779B1u) >> (32 - CUTE_PNG_HASH_BITS);
+}
+
+static void cp_insert(cp_deflate_t* d, const uint8_t* data, int pos)
+{
+	uint32_t h = cp_hash3(data + pos);
+	d->prev[pos & (CUTE_PNG_WINDOW_SIZE - 1)] = d->head[h];
+	d->head[h] = pos;
+}
+
+static int cp_match_length(const uint8_t* a, const uint8_t* b, int max_len)
+{
+	int n = 0;
+#if defined(__GNUC__) || defined(__clang__)
+	for (; n + 8 <= max_len; n += 8)
+	{
+		uint64_t x = cp_load64le(a + n) ^ cp_load64le(b + n);
+		if (x) return n + (__builtin_ctzll(x) >> 3);
+	}
+#endif
+	while (n < max_len && a[n] == b[n]) n++;
+	return n;
+}
+
+// Returns the length of the longest match for pos within [pos, end), or 0 if
+// there's nothing of at least CUTE_PNG_MIN_MATCH
+static int cp_longest_match(const cp_deflate_t* d, const uint8_t* data, int pos, int end, int* dist_out)
+{
+	int max_len = end - pos;
+	if (max_len > CUTE_PNG_MAX_MATCH) max_len = CUTE_PNG_MAX_MATCH;
+	if (max_len < CUTE_PNG_MIN_MATCH) return 0;
+
+	const uint8_t* p = data + pos;
+	int best = CUTE_PNG_MIN_MATCH - 1;
+	int limit = pos - CUTE_PNG_WINDOW_SIZE;
+	int chain = d->level.max_chain;
+	int cand = d->head[cp_hash3(p)];
+
+	while (cand >= 0 && cand > limit && chain--)
+	{
+		const uint8_t* q = data + cand;
+		if (q[best] == p[best] && q[0] == p[0])
+		{
+			int n = cp_match_length(p, q, max_len);
+			if (n > best)
+			{
+				best = n;
+				*dist_out = pos - cand;
+				if (n >= d->level.nice_len || n == max_len) break;
+			}
+		}
+
+		int next = d->prev[cand & (CUTE_PNG_WINDOW_SIZE - 1)];
+		if (next >= cand) break;
+		cand = next;
+	}
+
+	return best >= CUTE_PNG_MIN_MATCH ? best : 0;
+}
+
+static void cp_lz_literal(cp_deflate_t* d, uint8_t c)
+{
+	d->sym_len[d->sym_count] = c;
+	d->sym_dist[d->sym_count++] = 0;
+	d->lit_freq[c]++;
+}
+
+static void cp_lz_match(cp_deflate_t* d, int len, int dist)
+{
+	d->sym_len[d->sym_count] = len;
+	d->sym_dist[d->sym_count++] = dist;
+	d->lit_freq[257 + d->len_code[len]]++;
+	d->dist_freq[cp_dist_code(d, dist)]++;
+}
+
+// Huffman code lengths no longer than max_bits. The tree is built with the
+// two queue method over leaves sorted by frequency; if it comes out too deep
+// the frequencies are flattened and it's built again.
+static void cp_huffman_lengths(const uint32_t* freq, int count, int max_bits, uint8_t* lens)
+{
+	uint32_t weight[2 * 288];
+	int sym[288];
+	int parent[2 * 288];
+	int depth[2 * 288];
+	int n = 0;
+
+	CUTE_PNG_MEMSET(lens, 0, count);
+	for (int i = 0; i < count; ++i)
+	{
+		if (!freq[i]) continue;
+		int j = n++;
+		for (; j > 0 && weight[j - 1] > freq[i]; --j)
+		{
+			weight[j] = weight[j - 1];
+			sym[j] = sym[j - 1];
+		}
+		weight[j] = freq[i];
+		sym[j] = i;
+	}
+
+	if (n == 0) return;
+	if (n == 1)
+	{
+		// A single code still needs a bit, pair it up to keep the code complete
+		lens[sym[0]] = 1;
+		lens[sym[0] ? 0 : 1] = 1;
+		return;
+	}
+
+	while (1)
+	{
+		int leaf = 0, node = n;
+		for (int next = n; next < 2 * n - 1; ++next)
+		{
+			for (int k = 0; k < 2; ++k)
+			{
+				int pick = (leaf < n && (node >= next || weight[leaf] <= weight[node])) ? leaf++ : node++;
+				weight[next] = k ? weight[next] + weight[pick] : weight[pick];
+				parent[pick] = next;
+			}
+		}
+
+		int max_depth = 0;
+		depth[2 * n - 2] = 0;
+		for (int i = 2 * n - 3; i >= 0; --i)
+		{
+			depth[i] = depth[parent[i]] + 1;
+			if (depth[i] > max_depth) max_depth = depth[i];
+		}
+
+		if (max_depth <= max_bits) break;
+		for (int i = 0; i < n; ++i) weight[i] = (weight[i] >> 1) | 1;
+	}
+
+	for (int i = 0; i < n; ++i) lens[sym[i]] = depth[i];
+}
+
+// Canonical codes for a set of lengths, bit reversed ready for cp_put_bits
+static void cp_huffman_codes(const uint8_t* lens, int count, uint16_t* codes)
+{
+	int bl_count[16] = { 0 };
+	uint32_t next_code[16];
+	uint32_t code = 0;
+
+	for (int i = 0; i < count; ++i) bl_count[lens[i]]++;
+	bl_count[0] = 0;
+
+	for (int bits = 1; bits < 16; ++bits)
+	{
+		code = (code + bl_count[bits - 1]) << 1;
+		next_code[bits] = code;
+	}
+
+	for (int i = 0; i < count; ++i)
+		if (lens[i]) codes[i] = (uint16_t)cp_reverse_bits(next_code[lens[i]]++, lens[i]);
+}
+
+// Run length encodes code lengths with symbols 16-18, as in 3.2.7
+static int cp_rle_lengths(const uint8_t* lens, int count, uint8_t* syms, uint8_t* extra)
+{
+	int n = 0;
+
+	for (int i = 0; i < count;)
+	{
+		int len = lens[i], run = 1;
+		while (i + run < count && lens[i + run] == len) run++;
+		i += run;
+
+		if (len == 0)
+		{
+			while (run >= 11)
+			{
+				int r = run < 138 ? run : 138;
+				syms[n] = 18; extra[n++] = r - 11;
+				run -= r;
+			}
+			if (run >= 3)
+			{
+				syms[n] = 17; extra[n++] = run - 3;
+				run = 0;
+			}
+		}
+
+		else
+		{
+			syms[n] = len; extra[n++] = 0;
+			run--;
+			while (run >= 3)
+			{
+				int r = run < 6 ? run : 6;
+				syms[n] = 16; extra[n++] = r - 3;
+				run -= r;
+			}
+		}
+
+		while (run--)
+		{
+			syms[n] = len; extra[n++] = 0;
+		}
+	}
+
+	return n;
+}
+
+static void cp_put_stored(cp_save_png_data_t* s, const uint8_t* raw, int len, int final)
+{
+	do
+	{
+		int n = len < 65535 ? len : 65535;
+		len -= n;
+		cp_put_bits(s, final && !len, 3);
+		cp_align_bits(s);
+		cp_put8(s, n & 0xFF);
+		cp_put8(s, n >> 8);
+		cp_put8(s, ~n & 0xFF);
+		cp_put8(s, (~n >> 8) & 0xFF);
+		cp_put_bytes(s, raw, n);
+		raw += n;
+	}
+	while (len);
+}
+
+static void cp_put_symbols(cp_deflate_t* d, cp_save_png_data_t* s, const uint16_t* lit_codes, const uint8_t* lit_lens, const uint16_t* dist_codes, const uint8_t* dist_lens)
+{
+	for (int i = 0; i < d->sym_count; ++i)
+	{
+		int len = d->sym_len[i];
+		int dist = d->sym_dist[i];
+
+		if (!dist)
+		{
+			cp_put_bits(s, lit_codes[len], lit_lens[len]);
+			continue;
+		}
+
+		int lc = d->len_code[len];
+		int dc = cp_dist_code(d, dist);
+		cp_put_bits(s, lit_codes[257 + lc], lit_lens[257 + lc]);
+		cp_put_bits(s, len - cp_len_base[lc], cp_len_extra_bits[lc]);
+		cp_put_bits(s, dist_codes[dc], dist_lens[dc]);
+		cp_put_bits(s, dist - cp_dist_base[dc], cp_dist_extra_bits[dc]);
+	}
+
+	cp_put_bits(s, lit_codes[256], lit_lens[256]);
+}
+
+// Writes out the buffered symbols, which cover raw[0, raw_len), as whichever
+// block type comes out smallest
+static void cp_flush_block(cp_deflate_t* d, cp_save_png_data_t* s, const uint8_t* raw, int raw_len, int final)
+{
+	uint8_t lit_lens[286];
+	uint8_t dist_lens[30];
+	uint8_t lens[286 + 30];
+	uint16_t lit_codes[288];
+	uint16_t dist_codes[32];
+
+	d->lit_freq[256] = 1;
+	cp_huffman_lengths(d->lit_freq, 286, CUTE_PNG_DEFLATE_MAX_BITLEN, lit_lens);
+	cp_huffman_lengths(d->dist_freq, 30, CUTE_PNG_DEFLATE_MAX_BITLEN, dist_lens);
+
+	int nlit = 286;
+	int ndist = 30;
+	while (nlit > 257 && !lit_lens[nlit - 1]) nlit--;
+	while (ndist > 1 && !dist_lens[ndist - 1]) ndist--;
+	if (ndist == 1 && !dist_lens[0])
+	{
+		// No matches, but the distance code still has to be a valid one
+		dist_lens[0] = dist_lens[1] = 1;
+		ndist = 2;
+	}
+	CUTE_PNG_MEMCPY(lens, lit_lens, nlit);
+	CUTE_PNG_MEMCPY(lens + nlit, dist_lens, ndist);
+
+	uint8_t cl_syms[286 + 30];
+	uint8_t cl_extra[286 + 30];
+	uint32_t cl_freq[19] = { 0 };
+	uint8_t cl_lens[19];
+	uint16_t cl_codes[19];
+	int ncl = cp_rle_lengths(lens, nlit + ndist, cl_syms, cl_extra);
+	for (int i = 0; i < ncl; ++i) cl_freq[cl_syms[i]]++;
+	cp_huffman_lengths(cl_freq, 19, 7, cl_lens);
+	int nclen = 19;
+	while (nclen > 4 && !cl_lens[cp_permutation_order[nclen - 1]]) nclen--;
+
+	// Sizes in bits of each block type
+	uint64_t extra = 0, dynamic = 3 + 14 + 3 * nclen, fixed = 3;
+	for (int i = 0; i < 29; ++i) extra += (uint64_t)d->lit_freq[257 + i] * cp_len_extra_bits[i];
+	for (int i = 0; i < 30; ++i) extra += (uint64_t)d->dist_freq[i] * cp_dist_extra_bits[i];
+	for (int i = 0; i < 19; ++i) dynamic += (uint64_t)cl_freq[i] * cl_lens[i];
+	dynamic += cl_freq[16] * 2 + cl_freq[17] * 3 + cl_freq[18] * 7;
+	for (int i = 0; i < 286; ++i)
+	{
+		dynamic += (uint64_t)d->lit_freq[i] * lit_lens[i];
+		fixed += (uint64_t)d->lit_freq[i] * cp_fixed_table[i];
+	}
+	for (int i = 0; i < 30; ++i)
+	{
+		dynamic += (uint64_t)d->dist_freq[i] * dist_lens[i];
+		fixed += (uint64_t)d->dist_freq[i] * 5;
+	}
+	dynamic += extra;
+	fixed += extra;
+	uint64_t stored = (uint64_t)raw_len * 8 + (raw_len / 65535 + 1) * (3 + 7 + 32);
+
+	if (stored <= dynamic && stored <= fixed)
+	{
+		cp_put_stored(s, raw, raw_len, final);
+	}
+
+	else if (fixed <= dynamic)
+	{
+		cp_put_bits(s, final | (1 << 1), 3);
+		cp_huffman_codes(cp_fixed_table, 288, lit_codes);
+		cp_huffman_codes(cp_fixed_table + 288, 32, dist_codes);
+		cp_put_symbols(d, s, lit_codes, cp_fixed_table, dist_codes, cp_fixed_table + 288);
+	}
+
+	else
+	{
+		cp_put_bits(s, final | (2 << 1), 3);
+		cp_put_bits(s, nlit - 257, 5);
+		cp_put_bits(s, ndist - 1, 5);
+		cp_put_bits(s, nclen - 4, 4);
+		for (int i = 0; i < nclen; ++i) cp_put_bits(s, cl_lens[cp_permutation_order[i]], 3);
+
+		cp_huffman_codes(cl_lens, 19, cl_codes);
+		for (int i = 0; i < ncl; ++i)
+		{
+			int sym = cl_syms[i];
+			cp_put_bits(s, cl_codes[sym], cl_lens[sym]);
+			if (sym == 16) cp_put_bits(s, cl_extra[i], 2);
+			else if (sym == 17) cp_put_bits(s, cl_extra[i], 3);
+			else if (sym == 18) cp_put_bits(s, cl_extra[i], 7);
+		}
+
+		cp_huffman_codes(lit_lens, 286, lit_codes);
+		cp_huffman_codes(dist_lens, 30, dist_codes);
+		cp_put_symbols(d, s, lit_codes, lit_lens, dist_codes, dist_lens);
+	}
+
+	d->sym_count = 0;
+	CUTE_PNG_MEMSET(d->lit_freq, 0, sizeof(d->lit_freq));
+	CUTE_PNG_MEMSET(d->dist_freq, 0, sizeof(d->dist_freq));
+}
+
+// Compresses data[start, end), matches can reach back into the 32K before
+// start. Unless this is the final piece of the stream it finishes with an
+// empty stored block (a zlib sync flush) so the next piece starts on a byte
+// boundary and can be compressed separately.
+//
+// Greedy matching, or one step lazy matching (as in zlib) for the levels
+// with a lazy_len: a match is held back while the next position is checked,
+// and dropped to a literal if that one is longer.
+static void cp_deflate(cp_deflate_t* d, cp_save_png_data_t* s, const uint8_t* data, int start, int end, int final)
+{
+	int pos = start, block_start = start;
+	int prev_len = 0, prev_dist = 0; // match held back from pos - 1
+
+	for (int i = start > CUTE_PNG_WINDOW_SIZE ? start - CUTE_PNG_WINDOW_SIZE : 0; i < start; ++i)
+		if (i + CUTE_PNG_MIN_MATCH <= end) cp_insert(d, data, i);
+
+	while (pos < end)
+	{
+		if (d->sym_count >= CUTE_PNG_BLOCK_SYMBOLS - 2)
+		{
+			int block_end = prev_len ? pos - 1 : pos;
+			cp_flush_block(d, s, data + block_start, block_end - block_start, 0);
+			block_start = block_end;
+		}
+
+		int dist = 0;
+		int n = cp_longest_match(d, data, pos, end, &dist);
+
+		if (prev_len)
+		{
+			if (prev_len >= n)
+			{
+				cp_lz_match(d, prev_len, prev_dist);
+				for (int stop = pos - 1 + prev_len; pos < stop; ++pos)
+					if (pos + CUTE_PNG_MIN_MATCH <= end) cp_insert(d, data, pos);
+				prev_len = 0;
+				continue;
+			}
+
+			cp_lz_literal(d, data[pos - 1]);
+			prev_len = 0;
+		}
+
+		if (n && n < d->level.lazy_len)
+		{
+			prev_len = n;
+			prev_dist = dist;
+			cp_insert(d, data, pos++);
+		}
+
+		else if (n)
+		{
+			cp_lz_match(d, n, dist);
+			for (int stop = pos + n; pos < stop; ++pos)
+				if (pos + CUTE_PNG_MIN_MATCH <= end) cp_insert(d, data, pos);
+		}
+
+		else
+		{
+			cp_lz_literal(d, data[pos]);
+			if (pos + CUTE_PNG_MIN_MATCH <= end) cp_insert(d, data, pos);
+			pos++;
+		}
+	}
+
+	if (prev_len) cp_lz_match(d, prev_len, prev_dist);
+	cp_flush_block(d, s, data + block_start, end - block_start, final);
+	if (!final) cp_put_stored(s, data, 0, 0);
+}
+
+// The inverse of cp_unfilter_row, for RGBA rows
+static void cp_filter_row(int filter, int len, const uint8_t* raw, const uint8_t* prev, uint8_t* out)
+{
+	const int bpp = 4;
+	int x;
+
+#define FILTER_LOOP(A, B) for (x = 0 ; x < bpp; x++) out[x] = raw[x] - (A); for (; x < len; x++) out[x] = raw[x] - (B); break
+	switch (filter)
+	{
+	case 0: FILTER_LOOP(0          , 0);
+	case 1: FILTER_LOOP(0          , raw[x - bpp]);
+	case 2: FILTER_LOOP(prev[x]    , prev[x]);
+	case 3: FILTER_LOOP(prev[x] / 2, (raw[x - bpp] + prev[x]) / 2);
+	case 4: FILTER_LOOP(prev[x]    , cp_paeth(raw[x - bpp], prev[x], prev[x - bpp]));
+	}
+#undef FILTER_LOOP
+}
+
+// Filters rows [y0, y1), each prefixed with its filter type. With `adaptive`
+// each row gets the filter with the smallest sum of absolute (signed) output
+// bytes, the usual heuristic from libpng, otherwise Sub is used throughout.
+static int cp_filter_rows(const cp_image_t* img, int adaptive, int y0, int y1, uint8_t* out)
+{
+	int len = img->w * 4;
+	uint8_t* zero = (uint8_t*)CUTE_PNG_CALLOC(len * 6 + 1, 1);
+	uint8_t* scratch = zero + len;
+	if (!zero) return 0;
+
+	for (int y = y0; y < y1; ++y)
+	{
+		const uint8_t* raw = (const uint8_t*)(img->pix + y * img->w);
+		const uint8_t* prev = y ? raw - len : zero;
+		uint8_t* row = out + y * (len + 1);
+
+		if (!adaptive)
+		{
+			row[0] = 1;
+			cp_filter_row(1, len, raw, prev, row + 1);
+			continue;
+		}
+
+		int best = 0;
+		uint32_t best_sum = UINT32_MAX;
+		for (int filter = 0; filter < 5; ++filter)
+		{
+			uint8_t* candidate = scratch + filter * len;
+			uint32_t sum = 0;
+			cp_filter_row(filter, len, raw, prev, candidate);
+			for (int x = 0; x < len; ++x) sum += abs((int8_t)candidate[x]);
+
+			if (sum < best_sum)
+			{
+				best = filter;
+				best_sum = sum;
+			}
+		}
+
+		row[0] = (uint8_t)best;
+		CUTE_PNG_MEMCPY(row + 1, scratch + best * len, len);
+	}
+
+	CUTE_PNG_FREE(zero);
+	return 1;
+}
+
+// The image is encoded as horizontal bands of rows, each filtered and then
+// compressed on its own thread, pigz style. A band's compressed data ends on
+// a byte boundary so the bands are simply concatenated, and the checksums of
+// each band are combined afterwards.
+#define CUTE_PNG_MIN_BAND_BYTES (128 * 1024)
+
+typedef struct cp_band_t
+{
+	const cp_image_t* img;
+	uint8_t* filtered;
+	int level;
+	int pass; // 0 to filter, 1 to compress
+	int y0, y1;
+	int start, end; // filtered bytes
+	cp_save_png_data_t out;
+	uint32_t adler;
+	uint32_t crc;
+	int ok;
+} cp_band_t;
+
+static void cp_encode_band(cp_band_t* b)
+{
+	if (b->pass == 0)
+	{
+		b->ok = cp_filter_rows(b->img, b->level > 0, b->y0, b->y1, b->filtered);
+		if (b->ok) b->adler = cp_adler32(1, b->filtered + b->start, b->end - b->start);
+		return;
+	}
+
+	int final = b->y1 == b->img->h;
+	cp_reserve(&b->out, (b->end - b->start) / 4 + 1024);
+
+	if (b->level == 0)
+	{
+		cp_deflate_rle(&b->out, b->filtered + b->start, b->end - b->start, final);
+	}
+
+	else
+	{
+		cp_deflate_t* d = (cp_deflate_t*)CUTE_PNG_ALLOC(sizeof(cp_deflate_t));
+		if (!d)
+		{
+			b->ok = 0;
+			return;
+		}
+
+		cp_deflate_init(d, b->level);
+		cp_deflate(d, &b->out, b->filtered, b->start, b->end, final);
+		CUTE_PNG_FREE(d);
+	}
+
+	cp_align_bits(&b->out);
+	b->ok = !b->out.oom;
+	if (b->ok) b->crc = cp_crc32(0, b->out.out, b->out.len);
+}
+
+#ifdef CUTE_PNG_THREADS
+
+#ifdef _WIN32
+static DWORD WINAPI cp_band_thread(LPVOID b)
+{
+	cp_encode_band((cp_band_t*)b);
+	return 0;
+}
+#else
+static void* cp_band_thread(void* b)
+{
+	cp_encode_band((cp_band_t*)b);
+	return 0;
+}
+#endif
+
+// Runs the current pass of every band, the first one on this thread
+static void cp_encode_bands(cp_band_t* bands, int count)
+{
+#ifdef _WIN32
+	HANDLE threads[CUTE_PNG_MAX_THREADS];
+	for (int i = 1; i < count; ++i)
+	{
+		threads[i] = CreateThread(0, 0, cp_band_thread, bands + i, 0, 0);
+		if (!threads[i]) cp_encode_band(bands + i);
+	}
+
+	cp_encode_band(bands);
+	for (int i = 1; i < count; ++i)
+	{
+		if (!threads[i]) continue;
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+#else
+	pthread_t threads[CUTE_PNG_MAX_THREADS];
+	int started[CUTE_PNG_MAX_THREADS];
+	for (int i = 1; i < count; ++i)
+	{
+		started[i] = !pthread_create(threads + i, 0, cp_band_thread, bands + i);
+		if (!started[i]) cp_encode_band(bands + i);
+	}
+
+	cp_encode_band(bands);
+	for (int i = 1; i < count; ++i)
+		if (started[i]) pthread_join(threads[i], 0);
+#endif
+}
+
+#else
+
+static void cp_encode_bands(cp_band_t* bands, int count)
+{
+	for (int i = 0; i < count; ++i) cp_encode_band(bands + i);
+}
+
+#endif
+
+void* cp_save_png_mem_parallel(const cp_image_t* img, int level, int threads, int* size)
+{
+	cp_save_png_data_t png;
+	cp_band_t* bands = 0;
+	uint8_t* filtered = 0;
+	int raw_len = (img->w * 4 + 1) * img->h;
+	int count = raw_len / CUTE_PNG_MIN_BAND_BYTES;
+	uint8_t ihdr[13] = {
+		(uint8_t)(img->w >> 24), (uint8_t)(img->w >> 16), (uint8_t)(img->w >> 8), (uint8_t)img->w,
+		(uint8_t)(img->h >> 24), (uint8_t)(img->h >> 16), (uint8_t)(img->h >> 8), (uint8_t)img->h,
+		8, // bit depth
+		6, // RGBA
+		0, // compression (deflate)
+		0, // filter (standard)
+		0, // interlace off
+	};
+	uint8_t zlib[2];
+	uint32_t adler, crc;
+	int zlib_len = 2 + 4;
+
+	CUTE_PNG_MEMSET(&png, 0, sizeof(png));
+	if (level < 0) level = 0;
+	if (level > 9) level = 9;
+
+#ifndef CUTE_PNG_THREADS
+	threads = 1;
+#endif
+	if (threads > CUTE_PNG_MAX_THREADS) threads = CUTE_PNG_MAX_THREADS;
+	if (count > threads) count = threads;
+	if (count > img->h) count = img->h;
+	if (count < 1) count = 1;
+
+	filtered = (uint8_t*)CUTE_PNG_ALLOC(raw_len);
+	bands = (cp_band_t*)CUTE_PNG_CALLOC(count, sizeof(cp_band_t));
+	CUTE_PNG_CHECK(filtered && bands, "out of mem");
+
+	for (int i = 0; i < count; ++i)
+	{
+		cp_band_t* b = bands + i;
+		b->img = img;
+		b->filtered = filtered;
+		b->level = level;
+		b->y0 = img->h * i / count;
+		b->y1 = img->h * (i + 1) / count;
+		b->start = b->y0 * (img->w * 4 + 1);
+		b->end = b->y1 * (img->w * 4 + 1);
+	}
+
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		for (int i = 0; i < count; ++i) bands[i].pass = pass;
+		cp_encode_bands(bands, count);
+		for (int i = 0; i < count; ++i) CUTE_PNG_CHECK(bands[i].ok, "out of mem");
+	}
+
+	if (level == 0)
+	{
+		zlib[0] = 0x08; // zlib compression method, 256 byte window
+		zlib[1] = 0x1D; // zlib compression flags
+	}
+
+	else
+	{
+		zlib[0] = 0x78; // zlib compression method, 32K window
+		zlib[1] = level == 1 ? 0x01 : level < 6 ? 0x5E : level == 6 ? 0x9C : 0xDA;
+	}
+
+	// IDAT is the zlib header, each band in turn then the Adler-32 of it all
+	crc = cp_crc32(0, (const uint8_t*)"IDAT", 4);
+	crc = cp_crc32(crc, zlib, 2);
+	adler = bands[0].adler;
+	for (int i = 0; i < count; ++i)
+	{
+		zlib_len += bands[i].out.len;
+		crc = cp_crc32_combine(crc, bands[i].crc, bands[i].out.len);
+		if (i) adler = cp_adler32_combine(adler, bands[i].adler, bands[i].end - bands[i].start);
+	}
+
+	cp_reserve(&png, zlib_len + 57);
+	cp_put_bytes(&png, "\211PNG\r\n\032\n", 8);
+	cp_put_chunk(&png, "IHDR", ihdr, 13);
+	cp_put32(&png, zlib_len);
+	cp_put_bytes(&png, "IDAT", 4);
+	cp_put_bytes(&png, zlib, 2);
+	for (int i = 0; i < count; ++i) cp_put_bytes(&png, bands[i].out.out, bands[i].out.len);
+	cp_put32(&png, adler);
+	for (int shift = 24; shift >= 0; shift -= 8)
+	{
+		uint8_t byte = (uint8_t)(adler >> shift);
+		crc = cp_crc32(crc, &byte, 1);
+	}
+	cp_put32(&png, crc);
+	cp_put_chunk(&png, "IEND", 0, 0);
+	CUTE_PNG_CHECK(!png.oom, "out of mem");
+
+	for (int i = 0; i < count; ++i) CUTE_PNG_FREE(bands[i].out.out);
+	CUTE_PNG_FREE(bands);
+	CUTE_PNG_FREE(filtered);
+	*size = png.len;
+	return png.out;
+
+cp_err:
+	if (bands)
+		for (int i = 0; i < count; ++i) CUTE_PNG_FREE(bands[i].out.out);
+	CUTE_PNG_FREE(bands);
+	CUTE_PNG_FREE(filtered);
+	CUTE_PNG_FREE(png.out);
+	*size = 0;
+	return 0;
+}
+
+void* cp_save_png_mem(const cp_image_t* img, int level, int* size)
+{
+	return cp_save_png_mem_parallel(img, level, 1, size);
+}
+
+int cp_save_png_parallel(const char* file_name, const cp_image_t* img, int level, int threads)
+{
+	int size;
+	void* png = cp_save_png_mem_parallel(img, level, threads, &size);
+	if (!png) return 0;
+
+	FILE* fp = fopen(file_name, "wb");
+	int ok = fp && fwrite(png, size, 1, fp) == 1;
+	if (fp && fclose(fp)) ok = 0;
+	if (!ok) cp_error_reason = fp ? "unable to write file_name in cp_save_png" : "unable to open file_name in cp_save_png";
+
+	CUTE_PNG_FREE(png);
+	return ok;
+}
+
+int cp_save_png_level(const char* file_name, const cp_image_t* img, int level)
+{
+	return cp_save_png_parallel(file_name, img, level, 1);
+}
+
+int cp_save_png(const char* file_name, const cp_image_t* img)
+{
+	return cp_save_png_level(file_name, img, CUTE_PNG_DEFAULT_LEVEL);
+}
+
+typedef struct cp_raw_png_t
+{
+	const uint8_t* p;
+	const uint8_t* end;
+} cp_raw_png_t;
+
+static uint32_t cp_make32(const uint8_t* s)
+{
+	return ((uint32_t)s[0] << 24) | (s[1] << 16) | (s[2] << 8) | s[3];
+}
+
+static const uint8_t* cp_chunk(cp_raw_png_t* png, const char* chunk, uint32_t minlen)
+{
+	if (png->end - png->p < 12) return 0;
+	uint32_t len = cp_make32(png->p);
+	const uint8_t* start = png->p;
+
+	if (!memcmp(start + 4, chunk, 4) && len >= minlen && len <= (uint32_t)(png->end - png->p - 12))
+	{
+		png->p += len + 12;
+		return start + 8;
+	}
+
+	return 0;
+}
+
+static const uint8_t* cp_find(cp_raw_png_t* png, const char* chunk, uint32_t minlen)
+{
+	const uint8_t *start;
+	while (png->end - png->p >= 12)
+	{
+		uint32_t len = cp_make32(png->p);
+		if (len > (uint32_t)(png->end - png->p - 12)) break;
+		start = png->p;
+		png->p += len + 12;
+
+		if (!memcmp(start+4, chunk, 4) && len >= minlen)
+			return start + 8;
+	}
+
+	png->p = png->end;
+	return 0;
+}
+
+static uint32_t cp_load32(const uint8_t* p)
+{
+	uint32_t v;
+	CUTE_PNG_MEMCPY(&v, p, 4);
+	return v;
+}
+
+static void cp_store32(uint8_t* p, uint32_t v)
+{
+	CUTE_PNG_MEMCPY(p, &v, 4);
+}
+
+// Generic unfiltering for any bpp, one byte at a time
+static int cp_unfilter_row(int filter, int bpp, int len, uint8_t* raw, const uint8_t* prev)
+{
+	int x;
+
+#define FILTER_LOOP(A, B) for (x = 0 ; x < bpp; x++) raw[x] += A; for (; x < len; x++) raw[x] += B; break
+	switch (filter)
+	{
+	case 0: break;
+	case 1: FILTER_LOOP(0            , raw[x - bpp] );
+	case 2: FILTER_LOOP(prev[x]    , prev[x]);
+	case 3: FILTER_LOOP(prev[x] / 2, (raw[x - bpp] + prev[x]) / 2);
+	case 4: FILTER_LOOP(prev[x]    , cp_paeth(raw[x - bpp], prev[x], prev[x -bpp]));
+	default: return 0;
+	}
+#undef FILTER_LOOP
+
+	return 1;
+}
+
+// RGBA rows have their own kernels with the pixel size fixed at 4 bytes.
+// These portable versions (32-bit SWAR for Sub) are what non-x86 targets get.
+typedef void (cp_unfilter_fn)(uint8_t* raw, const uint8_t* prev, int len);
+
+static void cp_unfilter_sub4(uint8_t* raw, const uint8_t* prev, int len)
+{
+	uint32_t a = 0;
+	(void)prev;
+
+	for (int x = 0; x < len; x += 4)
+	{
+		// bytewise add without carries crossing channels
+		uint32_t d = cp_load32(raw + x);
+		a = ((a & 0x7F7F7F7F) + (d & 0x7F7F7F7F)) ^ ((a ^ d) & 0x80808080);
+		cp_store32(raw + x, a);
+	}
+}
+
+static void cp_unfilter_up4(uint8_t* raw, const uint8_t* prev, int len)
+{
+	for (int x = 0; x < len; ++x) raw[x] += prev[x];
+}
+
+static void cp_unfilter_avg4(uint8_t* raw, const uint8_t* prev, int len)
+{
+	int x;
+	for (x = 0; x < 4; ++x) raw[x] += prev[x] >> 1;
+	for (; x < len; ++x) raw[x] += (raw[x - 4] + prev[x]) >> 1;
+}
+
+static void cp_unfilter_paeth4(uint8_t* raw, const uint8_t* prev, int len)
+{
+	int x;
+	for (x = 0; x < 4; ++x) raw[x] += prev[x];
+	for (; x < len; ++x) raw[x] += cp_paeth(raw[x - 4], prev[x], prev[x - 4]);
+}
+
+#ifdef CUTE_PNG_SSE2
+
+// Sub is a running sum of pixels, so four pixels are done at once as a
+// prefix sum carried in from the previous group
+static void cp_unfilter_sub4_sse2(uint8_t* raw, const uint8_t* prev, int len)
+{
+	__m128i a = _mm_setzero_si128();
+	int x = 0;
+	(void)prev;
+
+	for (; x + 16 <= len; x += 16)
+	{
+		__m128i d = _mm_loadu_si128((__m128i*)(raw + x));
+		d = _mm_add_epi8(d, _mm_slli_si128(d, 4));
+		d = _mm_add_epi8(d, _mm_slli_si128(d, 8));
+		d = _mm_add_epi8(d, a);
+		_mm_storeu_si128((__m128i*)(raw + x), d);
+		a = _mm_shuffle_epi32(d, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+
+	for (; x < len; x += 4)
+	{
+		__m128i d = _mm_cvtsi32_si128((int)cp_load32(raw + x));
+		a = _mm_add_epi8(a, d);
+		cp_store32(raw + x, (uint32_t)_mm_cvtsi128_si32(a));
+	}
 }
 
-static void cp_encode_len(cp_save_png_data_t* s, uint32_t code, uint32_t bits, uint32_t len)
+static void cp_unfilter_up4_sse2(uint8_t* raw, const uint8_t* prev, int len)
 {
-	cp_encode_literal(s, code + (len >> bits));
-	cp_put_bits(s, len, bits);
-	cp_put_bits(s, 0, 5);
+	int x = 0;
+
+	for (; x + 16 <= len; x += 16)
+	{
+		__m128i d = _mm_loadu_si128((__m128i*)(raw + x));
+		__m128i b = _mm_loadu_si128((__m128i*)(prev + x));
+		_mm_storeu_si128((__m128i*)(raw + x), _mm_add_epi8(d, b));
+	}
+
+	for (; x < len; ++x) raw[x] += prev[x];
 }
 
-static void cp_end_run(cp_save_png_data_t* s)
+static void cp_unfilter_avg4_sse2(uint8_t* raw, const uint8_t* prev, int len)
 {
-	s->runlen--;
-	cp_encode_literal(s, s->prev);
+	__m128i a = _mm_setzero_si128();
+	__m128i ones = _mm_set1_epi8(1);
 
-	if (s->runlen >= 67) cp_encode_len(s, 277, 4, s->runlen - 67);
-	else if (s->runlen >= 35) cp_encode_len(s, 273, 3, s->runlen - 35);
-	else if (s->runlen >= 19) cp_encode_len(s, 269, 2, s->runlen - 19);
-	else if (s->runlen >= 11) cp_encode_len(s, 265, 1, s->runlen - 11);
-	else if (s->runlen >= 3) cp_encode_len(s, 257, 0, s->runlen - 3);
-	else while (s->runlen--) cp_encode_literal(s, s->prev);
+	for (int x = 0; x < len; x += 4)
+	{
+		__m128i b = _mm_cvtsi32_si128((int)cp_load32(prev + x));
+		__m128i d = _mm_cvtsi32_si128((int)cp_load32(raw + x));
+
+		// _mm_avg_epu8 rounds up, take the odd bit back off to round down
+		__m128i avg = _mm_avg_epu8(a, b);
+		avg = _mm_sub_epi8(avg, _mm_and_si128(_mm_xor_si128(a, b), ones));
+		a = _mm_add_epi8(d, avg);
+		cp_store32(raw + x, (uint32_t)_mm_cvtsi128_si32(a));
+	}
 }
 
-static void cp_encode_byte(cp_save_png_data_t *s, uint8_t v)
+static __m128i cp_abs_epi16(__m128i x)
 {
-	cp_update_adler(s, v);
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
 
-	// Simple RLE compression. We could do better by doing a search
-	// to find matches, but this works pretty well TBH.
-	if (s->prev == v && s->runlen < 115) s->runlen++;
+static __m128i cp_select_epi16(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
 
-	else
+// Same predictor as cp_paeth on 16-bit lanes, using
+// p - a = b - c, p - b = a - c, p - c = (b - c) + (a - c)
+static void cp_unfilter_paeth4_sse2(uint8_t* raw, const uint8_t* prev, int len)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i a = zero, c = zero;
+
+	for (int x = 0; x < len; x += 4)
 	{
-		if (s->runlen) cp_end_run(s);
+		__m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)cp_load32(prev + x)), zero);
+		__m128i d = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)cp_load32(raw + x)), zero);
+
+		__m128i pa = _mm_sub_epi16(b, c);
+		__m128i pb = _mm_sub_epi16(a, c);
+		__m128i pc = cp_abs_epi16(_mm_add_epi16(pa, pb));
+		pa = cp_abs_epi16(pa);
+		pb = cp_abs_epi16(pb);
+
+		__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+		__m128i pred = cp_select_epi16(_mm_cmpeq_epi16(smallest, pb), b, c);
+		pred = cp_select_epi16(_mm_cmpeq_epi16(smallest, pa), a, pred);
+
+		a = _mm_and_si128(_mm_add_epi16(d, pred), _mm_set1_epi16(0xFF));
+		c = b;
+		cp_store32(raw + x, (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(a, a)));
+	}
+}
 
-		s->prev = v;
-		s->runlen = 1;
+#endif // CUTE_PNG_SSE2
+
+#ifdef CUTE_PNG_AVX2
+
+CUTE_PNG_TARGET_AVX2 static void cp_unfilter_up4_avx2(uint8_t* raw, const uint8_t* prev, int len)
+{
+	int x = 0;
+
+	for (; x + 32 <= len; x += 32)
+	{
+		__m256i d = _mm256_loadu_si256((__m256i*)(raw + x));
+		__m256i b = _mm256_loadu_si256((__m256i*)(prev + x));
+		_mm256_storeu_si256((__m256i*)(raw + x), _mm256_add_epi8(d, b));
 	}
+
+	for (; x < len; ++x) raw[x] += prev[x];
+}
+
+#endif // CUTE_PNG_AVX2
+
+// Row kernels for expanding decoded rows to RGBA, premultiplying alpha and swapping rows.
+// Loads convert in place with the source rows towards the end of the pixel buffer, which
+// is safe as long as a kernel reads a group of pixels before writing them out and never
+// reads past the end of its row.
+typedef void (cp_convert_fn)(const uint8_t* src, cp_pixel_t* dst, int w);
+typedef void (cp_depalette_fn)(const uint8_t* src, cp_pixel_t* dst, int w, const cp_pixel_t* palette);
+typedef void (cp_premultiply_fn)(cp_pixel_t* pix, int count);
+typedef void (cp_swap_fn)(cp_pixel_t* a, cp_pixel_t* b, int count);
+
+static void cp_convert_grey(const uint8_t* src, cp_pixel_t* dst, int w)
+{
+	for (int x = 0; x < w; ++x) dst[x] = cp_make_pixel(src[x], src[x], src[x]);
+}
+
+static void cp_convert_grey_alpha(const uint8_t* src, cp_pixel_t* dst, int w)
+{
+	for (int x = 0; x < w; ++x, src += 2) dst[x] = cp_make_pixel_a(src[0], src[0], src[0], src[1]);
+}
+
+static void cp_convert_rgb(const uint8_t* src, cp_pixel_t* dst, int w)
+{
+	for (int x = 0; x < w; ++x, src += 3) dst[x] = cp_make_pixel(src[0], src[1], src[2]);
 }
 
-static void cp_save_header(cp_save_png_data_t* s, cp_image_t* img)
+static void cp_convert_rgba(const uint8_t* src, cp_pixel_t* dst, int w)
 {
-	fwrite("\211PNG\r\n\032\n", 8, 1, s->fp);
-	cp_begin_chunk(s, "IHDR", 13);
-	cp_put32(s, img->w);
-	cp_put32(s, img->h);
-	cp_put8(s, 8); // bit depth
-	cp_put8(s, 6); // RGBA
-	cp_put8(s, 0); // compression (deflate)
-	cp_put8(s, 0); // filter (standard)
-	cp_put8(s, 0); // interlace off
-	cp_put32(s, ~s->crc);
+	// overlaps by a few bytes when converting in place
+	CUTE_PNG_MEMMOVE(dst, src, w * sizeof(cp_pixel_t));
 }
 
-static long cp_save_data(cp_save_png_data_t* s, cp_image_t* img, long dataPos)
+static void cp_depalette_row(const uint8_t* src, cp_pixel_t* dst, int w, const cp_pixel_t* palette)
 {
-	cp_begin_chunk(s, "IDAT", 0);
-	cp_put8(s, 0x08); // zlib compression method
-	cp_put8(s, 0x1D); // zlib compression flags
-	cp_put_bits(s, 3, 3); // zlib last block + fixed dictionary
+	for (int x = 0; x < w; ++x) dst[x] = palette[src[x]];
+}
+
+// floor(c * a / 255) exactly for c, a <= 255, the same as the SIMD versions get from _mm_mulhi_epu16
+static uint8_t cp_mul_div255(int c, int a)
+{
+	return (uint8_t)(((uint32_t)(c * a) * 0x8081) >> 23);
+}
 
-	for (int y = 0; y < img->h; ++y)
+static void cp_premultiply_pixels(cp_pixel_t* pix, int count)
+{
+	for (int i = 0; i < count; ++i)
 	{
-		cp_pixel_t *row = &img->pix[y * img->w];
-		cp_pixel_t prev = cp_make_pixel_a(0, 0, 0, 0);
+		int a = pix[i].a;
+		pix[i].r = cp_mul_div255(pix[i].r, a);
+		pix[i].g = cp_mul_div255(pix[i].g, a);
+		pix[i].b = cp_mul_div255(pix[i].b, a);
+	}
+}
 
-		cp_encode_byte(s, 1); // sub filter
-		for (int x = 0; x < img->w; ++x)
-		{
-			cp_encode_byte(s, row[x].r - prev.r);
-			cp_encode_byte(s, row[x].g - prev.g);
-			cp_encode_byte(s, row[x].b - prev.b);
-			cp_encode_byte(s, row[x].a - prev.a);
-			prev = row[x];
-		}
+static void cp_swap_pixels(cp_pixel_t* a, cp_pixel_t* b, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		cp_pixel_t t = a[i];
+		a[i] = b[i];
+		b[i] = t;
 	}
+}
 
-	cp_end_run(s);
-	cp_encode_literal(s, 256); // terminator
-	while (s->bits != 0x80) cp_put_bits(s, 0, 1);
-	cp_put32(s, s->adler);
-	long dataSize = (ftell(s->fp) - dataPos) - 8;
-	cp_put32(s, ~s->crc);
+#ifdef CUTE_PNG_SSE2
+
+static void cp_convert_grey_sse2(const uint8_t* src, cp_pixel_t* dst, int w)
+{
+	__m128i opaque = _mm_set1_epi8((char)0xFF);
+	int x = 0;
+
+	for (; x + 16 <= w; x += 16)
+	{
+		__m128i g = _mm_loadu_si128((const __m128i*)(src + x));
+		__m128i gg_lo = _mm_unpacklo_epi8(g, g), gg_hi = _mm_unpackhi_epi8(g, g);
+		__m128i ga_lo = _mm_unpacklo_epi8(g, opaque), ga_hi = _mm_unpackhi_epi8(g, opaque);
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_unpacklo_epi16(gg_lo, ga_lo));
+		_mm_storeu_si128((__m128i*)(dst + x + 4), _mm_unpackhi_epi16(gg_lo, ga_lo));
+		_mm_storeu_si128((__m128i*)(dst + x + 8), _mm_unpacklo_epi16(gg_hi, ga_hi));
+		_mm_storeu_si128((__m128i*)(dst + x + 12), _mm_unpackhi_epi16(gg_hi, ga_hi));
+	}
 
-	return dataSize;
+	cp_convert_grey(src + x, dst + x, w - x);
 }
 
-int cp_save_png(const char* file_name, const cp_image_t* img)
+static void cp_convert_grey_alpha_sse2(const uint8_t* src, cp_pixel_t* dst, int w)
 {
-	cp_save_png_data_t s;
-	long dataPos, dataSize, err;
+	__m128i low = _mm_set1_epi16(0xFF);
+	int x = 0;
 
-	FILE* fp = fopen(file_name, "wb");
-	if (!fp) return 1;
+	for (; x + 8 <= w; x += 8)
+	{
+		// 16-bit lanes of g | a << 8, the first half of each pixel is g | g << 8
+		__m128i ga = _mm_loadu_si128((const __m128i*)(src + x * 2));
+		__m128i g = _mm_and_si128(ga, low);
+		__m128i gg = _mm_or_si128(g, _mm_slli_epi16(g, 8));
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_unpacklo_epi16(gg, ga));
+		_mm_storeu_si128((__m128i*)(dst + x + 4), _mm_unpackhi_epi16(gg, ga));
+	}
 
-	s.fp = fp;
-	s.adler = 1;
-	s.bits = 0x80;
-	s.prev = 0xFFFF;
-	s.runlen = 0;
+	cp_convert_grey_alpha(src + x * 2, dst + x, w - x);
+}
 
-	cp_save_header(&s, (cp_image_t*)img);
-	dataPos = ftell(s.fp);
-	dataSize = cp_save_data(&s, (cp_image_t*)img, dataPos);
+// Without a byte shuffle the four pixels in the low 12 bytes are shifted down
+// into the bottom lane one at a time and gathered back with unpacks
+static void cp_convert_rgb_sse2(const uint8_t* src, cp_pixel_t* dst, int w)
+{
+	__m128i opaque = _mm_set1_epi32((int)0xFF000000);
+	int x = 0;
 
-	// End chunk.
-	cp_begin_chunk(&s, "IEND", 0);
-	cp_put32(&s, ~s.crc);
+	for (; (x + 4) * 3 + 4 <= w * 3; x += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(src + x * 3));
+		__m128i p01 = _mm_unpacklo_epi32(v, _mm_srli_si128(v, 3));
+		__m128i p23 = _mm_unpacklo_epi32(_mm_srli_si128(v, 6), _mm_srli_si128(v, 9));
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_or_si128(_mm_unpacklo_epi64(p01, p23), opaque));
+	}
 
-	// Write back payload size.
-	fseek(fp, dataPos, SEEK_SET);
-	cp_put32(&s, dataSize);
+	cp_convert_rgb(src + x * 3, dst + x, w - x);
+}
 
-	err = ferror(fp);
-	fclose(fp);
-	return !err;
+// Two pixels to a register as 16-bit lanes, alpha is copied across its pixel
+// and put back untouched after the multiply
+static __m128i cp_premultiply_epi16(__m128i p, __m128i alpha_lane)
+{
+	__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	__m128i q = _mm_srli_epi16(_mm_mulhi_epu16(_mm_mullo_epi16(p, a), _mm_set1_epi16((short)0x8081)), 7);
+	return cp_select_epi16(alpha_lane, p, q);
 }
 
-typedef struct cp_raw_png_t
+static void cp_premultiply_pixels_sse2(cp_pixel_t* pix, int count)
 {
-	const uint8_t* p;
-	const uint8_t* end;
-} cp_raw_png_t;
+	__m128i zero = _mm_setzero_si128();
+	__m128i alpha_lane = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+	int i = 0;
 
-static uint32_t cp_make32(const uint8_t* s)
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i v = _mm_loadu_si128((__m128i*)(pix + i));
+		__m128i lo = cp_premultiply_epi16(_mm_unpacklo_epi8(v, zero), alpha_lane);
+		__m128i hi = cp_premultiply_epi16(_mm_unpackhi_epi8(v, zero), alpha_lane);
+		_mm_storeu_si128((__m128i*)(pix + i), _mm_packus_epi16(lo, hi));
+	}
+
+	cp_premultiply_pixels(pix + i, count - i);
+}
+
+static void cp_swap_pixels_sse2(cp_pixel_t* a, cp_pixel_t* b, int count)
 {
-	return (s[0] << 24) | (s[1] << 16) | (s[2] << 8) | s[3];
+	int i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i va = _mm_loadu_si128((__m128i*)(a + i));
+		__m128i vb = _mm_loadu_si128((__m128i*)(b + i));
+		_mm_storeu_si128((__m128i*)(a + i), vb);
+		_mm_storeu_si128((__m128i*)(b + i), va);
+	}
+
+	cp_swap_pixels(a + i, b + i, count - i);
 }
 
-static const uint8_t* cp_chunk(cp_raw_png_t* png, const char* chunk, uint32_t minlen)
+#endif // CUTE_PNG_SSE2
+
+#ifdef CUTE_PNG_AVX2
+
+// Eight grey values widened to a pixel each, then copied into g and b
+CUTE_PNG_TARGET_AVX2 static void cp_convert_grey_avx2(const uint8_t* src, cp_pixel_t* dst, int w)
 {
-	uint32_t len = cp_make32(png->p);
-	const uint8_t* start = png->p;
+	__m256i opaque = _mm256_set1_epi32((int)0xFF000000);
+	int x = 0;
 
-	if (!memcmp(start + 4, chunk, 4) && len >= minlen)
+	for (; x + 8 <= w; x += 8)
 	{
-		int offset = len + 12;
+		__m256i p = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + x)));
+		p = _mm256_or_si256(p, _mm256_slli_epi32(p, 8));
+		p = _mm256_or_si256(p, _mm256_slli_epi32(p, 16));
+		_mm256_storeu_si256((__m256i*)(dst + x), _mm256_or_si256(p, opaque));
+	}
 
-		if (png->p + offset <= png->end)
-		{
-			png->p += offset;
-			return start + 8;
-		}
+	cp_convert_grey(src + x, dst + x, w - x);
+}
+
+CUTE_PNG_TARGET_AVX2 static void cp_convert_grey_alpha_avx2(const uint8_t* src, cp_pixel_t* dst, int w)
+{
+	__m256i low = _mm256_set1_epi32(0xFF);
+	int x = 0;
+
+	for (; x + 8 <= w; x += 8)
+	{
+		__m256i ga = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + x * 2)));
+		__m256i g = _mm256_and_si256(ga, low);
+		__m256i p = _mm256_or_si256(g, _mm256_slli_epi32(g, 8));
+		p = _mm256_or_si256(p, _mm256_slli_epi32(ga, 16));
+		_mm256_storeu_si256((__m256i*)(dst + x), p);
 	}
 
-	return 0;
+	cp_convert_grey_alpha(src + x * 2, dst + x, w - x);
 }
 
-static const uint8_t* cp_find(cp_raw_png_t* png, const char* chunk, uint32_t minlen)
+// Four pixels from the low 12 bytes of each lane, the second lane loaded 12 bytes on
+CUTE_PNG_TARGET_AVX2 static void cp_convert_rgb_avx2(const uint8_t* src, cp_pixel_t* dst, int w)
 {
-	const uint8_t *start;
-	while (png->p < png->end)
+	__m256i opaque = _mm256_set1_epi32((int)0xFF000000);
+	__m256i shuffle = _mm256_setr_epi8(
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	int x = 0;
+
+	for (; x * 3 + 28 <= w * 3; x += 8)
 	{
-		uint32_t len = cp_make32(png->p);
-		start = png->p;
-		png->p += len + 12;
+		__m128i lo = _mm_loadu_si128((const __m128i*)(src + x * 3));
+		__m128i hi = _mm_loadu_si128((const __m128i*)(src + x * 3 + 12));
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		_mm256_storeu_si256((__m256i*)(dst + x), _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle), opaque));
+	}
 
-		if (!memcmp(start+4, chunk, 4) && len >= minlen && png->p <= png->end)
-			return start + 8;
+	cp_convert_rgb(src + x * 3, dst + x, w - x);
+}
+
+CUTE_PNG_TARGET_AVX2 static void cp_depalette_row_avx2(const uint8_t* src, cp_pixel_t* dst, int w, const cp_pixel_t* palette)
+{
+	int x = 0;
+
+	for (; x + 8 <= w; x += 8)
+	{
+		__m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + x)));
+		_mm256_storeu_si256((__m256i*)(dst + x), _mm256_i32gather_epi32((const int*)palette, index, 4));
 	}
 
-	return 0;
+	cp_depalette_row(src + x, dst + x, w - x, palette);
+}
+
+CUTE_PNG_TARGET_AVX2 static __m256i cp_premultiply_epi16_avx2(__m256i p, __m256i alpha_lane)
+{
+	__m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(p, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	__m256i q = _mm256_srli_epi16(_mm256_mulhi_epu16(_mm256_mullo_epi16(p, a), _mm256_set1_epi16((short)0x8081)), 7);
+	return _mm256_blendv_epi8(q, p, alpha_lane);
+}
+
+CUTE_PNG_TARGET_AVX2 static void cp_premultiply_pixels_avx2(cp_pixel_t* pix, int count)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i alpha_lane = _mm256_set1_epi64x((long long)0xFFFF000000000000ULL);
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i v = _mm256_loadu_si256((__m256i*)(pix + i));
+		__m256i lo = cp_premultiply_epi16_avx2(_mm256_unpacklo_epi8(v, zero), alpha_lane);
+		__m256i hi = cp_premultiply_epi16_avx2(_mm256_unpackhi_epi8(v, zero), alpha_lane);
+		_mm256_storeu_si256((__m256i*)(pix + i), _mm256_packus_epi16(lo, hi));
+	}
+
+	cp_premultiply_pixels(pix + i, count - i);
+}
+
+CUTE_PNG_TARGET_AVX2 static void cp_swap_pixels_avx2(cp_pixel_t* a, cp_pixel_t* b, int count)
+{
+	int i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i va = _mm256_loadu_si256((__m256i*)(a + i));
+		__m256i vb = _mm256_loadu_si256((__m256i*)(b + i));
+		_mm256_storeu_si256((__m256i*)(a + i), vb);
+		_mm256_storeu_si256((__m256i*)(b + i), va);
+	}
+
+	cp_swap_pixels(a + i, b + i, count - i);
+}
+
+#endif // CUTE_PNG_AVX2
+
+// Kernels in use, picked by cp_select_kernels. Picking is cheap, so each load fills in its
+// own copy rather than sharing a table between threads.
+typedef struct cp_kernels_t
+{
+	cp_unfilter_fn* unfilter4[5]; // RGBA unfilter kernels indexed by filter type
+	cp_convert_fn* convert[5];    // expand a row to RGBA, indexed by bytes per pixel
+	cp_depalette_fn* depalette;
+	cp_premultiply_fn* premultiply;
+	cp_swap_fn* swap;
+} cp_kernels_t;
+
+#define CUTE_PNG_KERNELS_PORTABLE 0
+#define CUTE_PNG_KERNELS_SSE2     1
+#define CUTE_PNG_KERNELS_AVX2     2
+#define CUTE_PNG_KERNELS_BEST     2
+
+// Fills in the best kernels the build and CPU support, up to `level`
+static void cp_select_kernels(cp_kernels_t* k, int level)
+{
+	k->unfilter4[0] = 0;
+	k->unfilter4[1] = cp_unfilter_sub4;
+	k->unfilter4[2] = cp_unfilter_up4;
+	k->unfilter4[3] = cp_unfilter_avg4;
+	k->unfilter4[4] = cp_unfilter_paeth4;
+	k->convert[0] = 0;
+	k->convert[1] = cp_convert_grey;
+	k->convert[2] = cp_convert_grey_alpha;
+	k->convert[3] = cp_convert_rgb;
+	k->convert[4] = cp_convert_rgba;
+	k->depalette = cp_depalette_row;
+	k->premultiply = cp_premultiply_pixels;
+	k->swap = cp_swap_pixels;
+
+#ifdef CUTE_PNG_SSE2
+	if (level >= CUTE_PNG_KERNELS_SSE2)
+	{
+		k->unfilter4[1] = cp_unfilter_sub4_sse2;
+		k->unfilter4[2] = cp_unfilter_up4_sse2;
+		k->unfilter4[3] = cp_unfilter_avg4_sse2;
+		k->unfilter4[4] = cp_unfilter_paeth4_sse2;
+		k->convert[1] = cp_convert_grey_sse2;
+		k->convert[2] = cp_convert_grey_alpha_sse2;
+		k->convert[3] = cp_convert_rgb_sse2;
+		k->premultiply = cp_premultiply_pixels_sse2;
+		k->swap = cp_swap_pixels_sse2;
+	}
+#endif
+
+#ifdef CUTE_PNG_AVX2
+	if (level >= CUTE_PNG_KERNELS_AVX2 && __builtin_cpu_supports("avx2"))
+	{
+		k->unfilter4[2] = cp_unfilter_up4_avx2;
+		k->convert[1] = cp_convert_grey_avx2;
+		k->convert[2] = cp_convert_grey_alpha_avx2;
+		k->convert[3] = cp_convert_rgb_avx2;
+		k->depalette = cp_depalette_row_avx2;
+		k->premultiply = cp_premultiply_pixels_avx2;
+		k->swap = cp_swap_pixels_avx2;
+	}
+#endif
+
+	(void)level;
 }
 
-static int cp_unfilter(int w, int h, int bpp, uint8_t* raw)
+static int cp_unfilter(const cp_kernels_t* k, int w, int h, int bpp, uint8_t* raw, cp_arena_t* arena)
 {
 	int len = w * bpp;
-	uint8_t *prev = raw;
-	int x;
+	uint8_t* prev;
+
+	// The row above the first is defined to be all zeroes
+	uint8_t* zeroes = (uint8_t*)cp_alloc_zero(arena, len + 1);
+	if (!zeroes) return 0;
+	prev = zeroes;
 
 	for (int y = 0; y < h; y++, prev = raw, raw += len)
 	{
-#define FILTER_LOOP(A, B) for (x = 0 ; x < bpp; x++) raw[x] += A; for (; x < len; x++) raw[x] += B; break
-		switch (*raw++)
+		int filter = *raw++;
+
+		if (bpp == 4 && filter >= 1 && filter <= 4) k->unfilter4[filter](raw, prev, len);
+		else if (!cp_unfilter_row(filter, bpp, len, raw, prev))
 		{
-		case 0: break;
-		case 1: FILTER_LOOP(0            , raw[x - bpp] );
-		case 2: FILTER_LOOP(prev[x]    , prev[x]);
-		case 3: FILTER_LOOP(prev[x] / 2, (raw[x - bpp] + prev[x]) / 2);
-		case 4: FILTER_LOOP(prev[x]    , cp_paeth(raw[x - bpp], prev[x], prev[x -bpp]));
-		default: return 0;
+			cp_release(arena, zeroes);
+			return 0;
 		}
-#undef FILTER_LOOP
 	}
 
+	cp_release(arena, zeroes);
 	return 1;
 }
 
-static void cp_convert(int bpp, int w, int h, uint8_t* src, cp_pixel_t* dst)
+// Rows start with their filter byte
+static void cp_convert(const cp_kernels_t* k, int bpp, int w, int h, uint8_t* src, cp_pixel_t* dst)
 {
-	for (int y = 0; y < h; y++)
+	for (int y = 0; y < h; y++, src += w * bpp + 1, dst += w)
 	{
-		// skip filter byte
-		src++;
-
-		for (int x = 0; x < w; x++, src += bpp)
-		{
-			switch (bpp)
-			{
-				case 1: *dst++ = cp_make_pixel(src[0], src[0], src[0]); break;
-				case 2: *dst++ = cp_make_pixel_a(src[0], src[0], src[0], src[1]); break;
-				case 3: *dst++ = cp_make_pixel(src[0], src[1], src[2]); break;
-				case 4: *dst++ = cp_make_pixel_a(src[0], src[1], src[2], src[3]); break;
-			}
-		}
+		k->convert[bpp](src + 1, dst, w);
 	}
 }
 
@@ -883,22 +3193,11 @@ static uint8_t cp_get_alpha_for_indexed_image(int index, const uint8_t* trns, ui
 	else return trns[index];
 }
 
-static void cp_depalette(int w, int h, uint8_t* src, cp_pixel_t* dst, const uint8_t* plte, const uint8_t* trns, uint32_t trns_len)
+static void cp_depalette(const cp_kernels_t* k, int w, int h, uint8_t* src, cp_pixel_t* dst, const cp_pixel_t* palette)
 {
-	for (int y = 0; y < h; ++y)
+	for (int y = 0; y < h; y++, src += w + 1, dst += w)
 	{
-		// skip filter byte
-		++src;
-
-		for (int x = 0; x < w; ++x, ++src)
-		{
-			int c = *src;
-			uint8_t r = plte[c * 3];
-			uint8_t g = plte[c * 3 + 1];
-			uint8_t b = plte[c * 3 + 2];
-			uint8_t a = cp_get_alpha_for_indexed_image(c, trns, trns_len);
-			*dst++ = cp_make_pixel_a(r, g, b, a);
-		}
+		k->depalette(src + 1, dst, w, palette);
 	}
 }
 
@@ -912,49 +3211,82 @@ static int cp_out_size(cp_image_t* img, int bpp)
 	return (img->w + 1) * img->h * bpp;
 }
 
-cp_image_t cp_load_png_mem(const void* png_data, int png_length)
+typedef struct cp_png_info_t
+{
+	int w, h;
+	int bpp;
+	int color_type;
+	const uint8_t* plte;
+	const uint8_t* trns;
+	uint32_t trns_len;
+	cp_pixel_t palette[256]; // PLTE and tRNS together, for color type 3
+
+	// The DEFLATE stream, pointing straight into the file when there's a
+	// single IDAT chunk, otherwise the IDAT chunks are joined into `copy`
+	const uint8_t* data;
+	int datalen;
+	uint8_t* copy;
+} cp_png_info_t;
+
+#ifdef CUTE_PNG_VERIFY_CRC
+
+// The CRC at the end of each chunk covers its type and data
+static int cp_check_chunk_crcs(const uint8_t* p, const uint8_t* end)
+{
+	while (end - p >= 12)
+	{
+		uint32_t len = cp_make32(p);
+		if (len > (uint32_t)(end - p - 12)) break;
+		if (cp_crc32(0, p + 4, len + 4) != cp_make32(p + 8 + len)) return 0;
+		p += len + 12;
+	}
+	return 1;
+}
+
+// The zlib stream ends with the Adler-32 of the inflated data, filter bytes and all
+static int cp_check_adler(const cp_png_info_t* info, uint32_t adler)
+{
+	return adler == cp_make32(info->data + info->datalen - 4);
+}
+
+#endif // CUTE_PNG_VERIFY_CRC
+
+static int cp_parse_png(const void* png_data, int png_length, cp_png_info_t* info, cp_arena_t* arena)
 {
 	const char* sig = "\211PNG\r\n\032\n";
-	const uint8_t* ihdr, *first, *plte, *trns;
-	int bit_depth, color_type, bpp, w, h, pix_bytes;
-	int compression, filter, interlace;
-	int datalen, offset;
-	uint8_t* out;
-	cp_image_t img = { 0 };
-	uint8_t* data = 0;
+	const uint8_t* ihdr, *first;
+	int bit_depth, compression, filter, interlace, idat_count, offset;
 	cp_raw_png_t png;
 	png.p = (uint8_t*)png_data;
 	png.end = (uint8_t*)png_data + png_length;
+	CUTE_PNG_MEMSET(info, 0, sizeof(*info));
 
-	CUTE_PNG_CHECK(!memcmp(png.p, sig, 8), "incorrect file signature (is this a png file?)");
+	CUTE_PNG_CHECK(png_length >= 8 && !memcmp(png.p, sig, 8), "incorrect file signature (is this a png file?)");
 	png.p += 8;
+#ifdef CUTE_PNG_VERIFY_CRC
+	CUTE_PNG_CHECK(cp_check_chunk_crcs(png.p, png.end), "chunk CRC mismatch (the file is corrupt)");
+#endif
 
 	ihdr = cp_chunk(&png, "IHDR", 13);
 	CUTE_PNG_CHECK(ihdr, "unable to find IHDR chunk");
 	bit_depth = ihdr[8];
-	color_type = ihdr[9];
+	info->color_type = ihdr[9];
 	CUTE_PNG_CHECK(bit_depth == 8, "only bit-depth of 8 is supported");
 
-	switch (color_type)
+	switch (info->color_type)
 	{
-		case 0: bpp = 1; break; // greyscale
-		case 2: bpp = 3; break; // RGB
-		case 3: bpp = 1; break; // paletted
-		case 4: bpp = 2; break; // grey+alpha
-		case 6: bpp = 4; break; // RGBA
+		case 0: info->bpp = 1; break; // greyscale
+		case 2: info->bpp = 3; break; // RGB
+		case 3: info->bpp = 1; break; // paletted
+		case 4: info->bpp = 2; break; // grey+alpha
+		case 6: info->bpp = 4; break; // RGBA
 		default: CUTE_PNG_CHECK(0, "unknown color type");
 	}
 
-	// +1 for filter byte (which is dumb! just stick this at file header...)
-	w = cp_make32(ihdr) + 1;
-	h = cp_make32(ihdr + 4);
-	CUTE_PNG_CHECK(w >= 1, "invalid IHDR chunk found, image width was less than 1");
-	CUTE_PNG_CHECK(h >= 1, "invalid IHDR chunk found, image height was less than 1");
-	pix_bytes = w * h * sizeof(cp_pixel_t);
-	img.w = w - 1;
-	img.h = h;
-	img.pix = (cp_pixel_t*)CUTE_PNG_ALLOC(pix_bytes);
-	CUTE_PNG_CHECK(img.pix, "unable to allocate raw image space");
+	info->w = cp_make32(ihdr);
+	info->h = cp_make32(ihdr + 4);
+	CUTE_PNG_CHECK(info->w >= 1 && info->w < INT_MAX, "invalid IHDR chunk found, image width was less than 1");
+	CUTE_PNG_CHECK(info->h >= 1, "invalid IHDR chunk found, image height was less than 1");
 
 	compression = ihdr[10];
 	filter = ihdr[11];
@@ -965,75 +3297,250 @@ cp_image_t cp_load_png_mem(const void* png_data, int png_length)
 
 	// PLTE must come before any IDAT chunk
 	first = png.p;
-	plte = cp_find(&png, "PLTE", 0);
-	if (!plte) png.p = first;
+	info->plte = cp_find(&png, "PLTE", 0);
+	if (!info->plte) png.p = first;
 	else first = png.p;
 
-	// tRNS can come after PLTE
-	trns = cp_find(&png, "tRNS", 0);
-	if (!trns) png.p = first;
-	else first = png.p;
+	// tRNS can come after PLTE
+	info->trns = cp_find(&png, "tRNS", 0);
+	if (!info->trns) png.p = first;
+	else first = png.p;
+	info->trns_len = info->trns ? cp_get_chunk_byte_length(info->trns) : 0;
+
+	// Compute length of the DEFLATE stream through IDAT chunk data sizes
+	idat_count = 0;
+	for (const uint8_t* idat = cp_find(&png, "IDAT", 0); idat; idat = cp_chunk(&png, "IDAT", 0))
+	{
+		if (!idat_count++) info->data = idat;
+		info->datalen += cp_get_chunk_byte_length(idat);
+	}
+
+	// Copy in IDAT chunk data sections to form the compressed DEFLATE stream
+	if (idat_count > 1)
+	{
+		png.p = first;
+		info->copy = (uint8_t*)cp_alloc(arena, info->datalen);
+		CUTE_PNG_CHECK(info->copy, "out of mem");
+		info->data = info->copy;
+		offset = 0;
+		for (const uint8_t* idat = cp_find(&png, "IDAT", 0); idat; idat = cp_chunk(&png, "IDAT", 0))
+		{
+			uint32_t len = cp_get_chunk_byte_length(idat);
+			CUTE_PNG_MEMCPY(info->copy + offset, idat, len);
+			offset += len;
+		}
+	}
+
+	// check for proper zlib structure in DEFLATE stream
+	CUTE_PNG_CHECK(info->data && info->datalen >= 6, "corrupt zlib structure in DEFLATE stream");
+	CUTE_PNG_CHECK((info->data[0] & 0x0f) == 0x08, "only zlib compression method (RFC 1950) is supported");
+	CUTE_PNG_CHECK((info->data[0] & 0xf0) <= 0x70, "innapropriate window size detected");
+	CUTE_PNG_CHECK(!(info->data[1] & 0x20), "preset dictionary is present and not supported");
+
+	if (info->color_type == 3)
+	{
+		CUTE_PNG_CHECK(info->plte, "color type of indexed requires a PLTE chunk");
+
+		// Indices past the end of PLTE come out opaque black rather than reading past it
+		int plte_len = cp_get_chunk_byte_length(info->plte) / 3;
+		for (int i = 0; i < 256; ++i)
+		{
+			if (i < plte_len) info->palette[i] = cp_make_pixel_a(info->plte[i * 3], info->plte[i * 3 + 1], info->plte[i * 3 + 2], cp_get_alpha_for_indexed_image(i, info->trns, info->trns_len));
+			else info->palette[i] = cp_make_pixel(0, 0, 0);
+		}
+	}
+
+	return 1;
+
+cp_err:
+	cp_release(arena, info->copy);
+	info->copy = 0;
+	return 0;
+}
+
+cp_image_t cp_load_png_mem(const void* png_data, int png_length)
+{
+	return cp_load_png_mem_arena(png_data, png_length, 0);
+}
+
+cp_image_t cp_load_png_mem_arena(const void* png_data, int png_length, cp_arena_t* arena)
+{
+	cp_png_info_t info;
+	cp_image_t img = { 0 };
+	cp_kernels_t k;
+	uint8_t* out;
+
+	cp_select_kernels(&k, CUTE_PNG_KERNELS_BEST);
+	CUTE_PNG_CALL(cp_parse_png(png_data, png_length, &info, arena));
+	img.w = info.w;
+	img.h = info.h;
+
+	// check for integer overflow
+	CUTE_PNG_CHECK((int64_t)(img.w + 1) * img.h * 4 <= INT_MAX, "invalid image size found");
+
+	// The image is inflated into the end of the pixel buffer and converted
+	// in place, rows grow towards the end so nothing is overwritten early
+	img.pix = (cp_pixel_t*)cp_alloc(arena, cp_out_size(&img, 4));
+	CUTE_PNG_CHECK(img.pix, "unable to allocate raw image space");
+
+	out = (uint8_t*)img.pix + cp_out_size(&img, 4) - cp_out_size(&img, info.bpp);
+	CUTE_PNG_CHECK(cp_inflate_stream(info.data + 2, info.datalen - 6, out, cp_out_size(&img, info.bpp), 0, 0, arena), "DEFLATE algorithm failed");
+#ifdef CUTE_PNG_VERIFY_CRC
+	CUTE_PNG_CHECK(cp_check_adler(&info, cp_adler32(1, out, (img.w * info.bpp + 1) * img.h)), "Adler-32 mismatch in image data (the file is corrupt)");
+#endif
+	CUTE_PNG_CHECK(cp_unfilter(&k, img.w, img.h, info.bpp, out, arena), "invalid filter byte found");
+
+	if (info.color_type == 3) cp_depalette(&k, img.w, img.h, out, img.pix, info.palette);
+	else cp_convert(&k, info.bpp, img.w, img.h, out, img.pix);
+
+	cp_release(arena, info.copy);
+	return img;
+
+cp_err:
+	cp_release(arena, img.pix);
+	cp_release(arena, info.copy);
+	img.pix = 0;
+
+	return img;
+}
+
+// Inflates into a window of CUTE_PNG_STREAM_WINDOW bytes plus a row and some
+// room, unfiltering and converting each row as it completes
+#define CUTE_PNG_STREAM_WINDOW 32768
+#define CUTE_PNG_STREAM_ROOM (64 * 1024)
 
-	// Compute length of the DEFLATE stream through IDAT chunk data sizes
-	datalen = 0;
-	for (const uint8_t* idat = cp_find(&png, "IDAT", 0); idat; idat = cp_chunk(&png, "IDAT", 0))
-	{
-		uint32_t len = cp_get_chunk_byte_length(idat);
-		datalen += len;
-	}
+typedef struct cp_stream_t
+{
+	cp_png_info_t* info;
+	int stride;       // bytes per row including the filter byte
+	int y;            // rows handed out so far
+	char* row;        // start of the next row in the inflate output
+	uint8_t* cur;     // row being unfiltered, filter byte first
+	uint8_t* prev;    // last row, unfiltered
+	cp_pixel_t* pix;  // converted row for the callback
+	cp_pixel_t* dst;  // or, destination image
+	int pitch;
+	cp_row_fn* fn;
+	void* udata;
+	cp_kernels_t k;
+	uint32_t adler;   // of the rows so far, for CUTE_PNG_VERIFY_CRC
+} cp_stream_t;
+
+static int cp_stream_flush(cp_state_t* s)
+{
+	cp_stream_t* st = (cp_stream_t*)s->udata;
+	cp_png_info_t* info = st->info;
+	int len = st->stride - 1;
+	char* keep;
 
-	// Copy in IDAT chunk data sections to form the compressed DEFLATE stream
-	png.p = first;
-	data = (uint8_t*)CUTE_PNG_ALLOC(datalen);
-	offset = 0;
-	for (const uint8_t* idat = cp_find(&png, "IDAT", 0); idat; idat = cp_chunk(&png, "IDAT", 0))
+	if (!st->row) st->row = s->begin;
+
+	for (; s->out - st->row >= st->stride; st->row += st->stride, st->y++)
 	{
-		uint32_t len = cp_get_chunk_byte_length(idat);
-		CUTE_PNG_MEMCPY(data + offset, idat, len);
-		offset += len;
+		CUTE_PNG_CHECK(st->y < info->h, "image data is larger than the image");
+
+		int filter = (uint8_t)st->row[0];
+		CUTE_PNG_MEMCPY(st->cur, st->row, st->stride);
+#ifdef CUTE_PNG_VERIFY_CRC
+		st->adler = cp_adler32(st->adler, st->cur, st->stride);
+#endif
+		if (info->bpp == 4 && filter >= 1 && filter <= 4) st->k.unfilter4[filter](st->cur + 1, st->prev + 1, len);
+		else CUTE_PNG_CHECK(cp_unfilter_row(filter, info->bpp, len, st->cur + 1, st->prev + 1), "invalid filter byte found");
+
+		cp_pixel_t* pix = st->dst ? (cp_pixel_t*)((char*)st->dst + (size_t)st->y * st->pitch) : st->pix;
+		if (info->color_type == 3) cp_depalette(&st->k, info->w, 1, st->cur, pix, info->palette);
+		else cp_convert(&st->k, info->bpp, info->w, 1, st->cur, pix);
+		CUTE_PNG_CHECK(st->dst || st->fn(pix, info->w, st->y, st->udata), "stopped by the row callback");
+
+		uint8_t* swap = st->prev;
+		st->prev = st->cur;
+		st->cur = swap;
 	}
 
-	// check for proper zlib structure in DEFLATE stream
-	CUTE_PNG_CHECK(data && datalen >= 6, "corrupt zlib structure in DEFLATE stream");
-	CUTE_PNG_CHECK((data[0] & 0x0f) == 0x08, "only zlib compression method (RFC 1950) is supported");
-	CUTE_PNG_CHECK((data[0] & 0xf0) <= 0x70, "innapropriate window size detected");
-	CUTE_PNG_CHECK(!(data[1] & 0x20), "preset dictionary is present and not supported");
+	// Slide the window and any partial row back to the start of the buffer
+	keep = s->out - CUTE_PNG_STREAM_WINDOW;
+	if (keep < s->begin) keep = s->begin;
+	if (keep > st->row) keep = st->row;
+	CUTE_PNG_MEMMOVE(s->begin, keep, s->out - keep);
+	st->row -= keep - s->begin;
+	s->out -= keep - s->begin;
 
-	// check for integer overflow
-	CUTE_PNG_CHECK(cp_out_size(&img, 4) >= 1, "invalid image size found");
-	CUTE_PNG_CHECK(cp_out_size(&img, bpp) >= 1, "invalid image size found");
+	CUTE_PNG_CHECK(s->out_end - s->out >= CUTE_PNG_FAST_OUT_MARGIN, "out of mem");
+	return 1;
 
-	out = (uint8_t*)img.pix + cp_out_size(&img, 4) - cp_out_size(&img, bpp);
-	CUTE_PNG_CHECK(cp_inflate(data + 2, datalen - 6, out, pix_bytes), "DEFLATE algorithm failed");
-	CUTE_PNG_CHECK(cp_unfilter(img.w, img.h, bpp, out), "invalid filter byte found");
+cp_err:
+	return 0;
+}
 
-	if (color_type == 3)
-	{
-		CUTE_PNG_CHECK(plte, "color type of indexed requires a PLTE chunk");
-		uint32_t trns_len = trns ? cp_get_chunk_byte_length(trns) : 0;
-		cp_depalette(img.w, img.h, out, img.pix, plte, trns, trns_len);
-	}
-	else cp_convert(bpp, img.w, img.h, out, img.pix);
+static int cp_load_png_stream(const void* png_data, int png_length, cp_stream_t* st)
+{
+	cp_png_info_t info;
+	uint8_t* mem = 0;
+	int size;
+
+	CUTE_PNG_CALL(cp_parse_png(png_data, png_length, &info, 0));
+	CUTE_PNG_CHECK(info.w < (INT_MAX - CUTE_PNG_STREAM_WINDOW - CUTE_PNG_STREAM_ROOM) / 16, "invalid image size found");
+	st->info = &info;
+	st->stride = info.w * info.bpp + 1;
+	st->adler = 1;
+	cp_select_kernels(&st->k, CUTE_PNG_KERNELS_BEST);
+
+	// One allocation for the window, the two rows and a converted row
+	size = CUTE_PNG_STREAM_WINDOW + st->stride + CUTE_PNG_STREAM_ROOM;
+	mem = (uint8_t*)CUTE_PNG_ALLOC(size + st->stride * 2 + info.w * sizeof(cp_pixel_t));
+	CUTE_PNG_CHECK(mem, "out of mem");
+	st->cur = mem + size;
+	st->prev = st->cur + st->stride;
+	st->pix = (cp_pixel_t*)(st->prev + st->stride);
+	CUTE_PNG_MEMSET(st->prev, 0, st->stride);
+
+	CUTE_PNG_CHECK(cp_inflate_stream(info.data + 2, info.datalen - 6, mem, size, cp_stream_flush, st, 0), "DEFLATE algorithm failed");
+	CUTE_PNG_CHECK(st->y == info.h, "image data is smaller than the image");
+#ifdef CUTE_PNG_VERIFY_CRC
+	CUTE_PNG_CHECK(cp_check_adler(&info, st->adler), "Adler-32 mismatch in image data (the file is corrupt)");
+#endif
 
-	CUTE_PNG_FREE(data);
-	return img;
+	CUTE_PNG_FREE(mem);
+	CUTE_PNG_FREE(info.copy);
+	return 1;
 
 cp_err:
-	CUTE_PNG_FREE(data);
-	CUTE_PNG_FREE(img.pix);
-	img.pix = 0;
+	CUTE_PNG_FREE(mem);
+	CUTE_PNG_FREE(info.copy);
+	return 0;
+}
 
-	return img;
+int cp_load_png_mem_rows(const void* png_data, int png_length, cp_row_fn* fn, void* udata)
+{
+	cp_stream_t st;
+	CUTE_PNG_MEMSET(&st, 0, sizeof(st));
+	st.fn = fn;
+	st.udata = udata;
+	return cp_load_png_stream(png_data, png_length, &st);
+}
+
+int cp_load_png_mem_into(const void* png_data, int png_length, cp_pixel_t* dst, int pitch)
+{
+	cp_stream_t st;
+	CUTE_PNG_MEMSET(&st, 0, sizeof(st));
+	st.dst = dst;
+	st.pitch = pitch;
+	return cp_load_png_stream(png_data, png_length, &st);
 }
 
 cp_image_t cp_load_png(const char *file_name)
+{
+	return cp_load_png_arena(file_name, 0);
+}
+
+cp_image_t cp_load_png_arena(const char* file_name, cp_arena_t* arena)
 {
 	cp_image_t img = { 0 };
-	int len;
-	void* data = cp_read_file_to_memory(file_name, &len);
+	int len, mapped;
+	void* data = cp_map_file(file_name, &len, &mapped);
 	if (!data) return img;
-	img = cp_load_png_mem(data, len);
-	CUTE_PNG_FREE(data);
+	img = cp_load_png_mem_arena(data, len, arena);
+	cp_unmap_file(data, len, mapped);
 	return img;
 }
 
@@ -1050,18 +3557,12 @@ void cp_flip_image_horizontal(cp_image_t* img)
 	int w = img->w;
 	int h = img->h;
 	int flips = h / 2;
+	cp_kernels_t k;
+	cp_select_kernels(&k, CUTE_PNG_KERNELS_BEST);
+
 	for (int i = 0; i < flips; ++i)
 	{
-		cp_pixel_t* a = pix + w * i;
-		cp_pixel_t* b = pix + w * (h - i - 1);
-		for (int j = 0; j < w; ++j)
-		{
-			cp_pixel_t t = *a;
-			*a = *b;
-			*b = t;
-			++a;
-			++b;
-		}
+		k.swap(pix + w * i, pix + w * (h - i - 1), w);
 	}
 }
 
@@ -1077,7 +3578,7 @@ void cp_load_png_wh(const void* png_data, int png_length, int* w_out, int* h_out
 	if (w_out) *w_out = 0;
 	if (h_out) *h_out = 0;
 
-	CUTE_PNG_CHECK(!memcmp(png.p, sig, 8), "incorrect file signature (is this a png file?)");
+	CUTE_PNG_CHECK(png_length >= 8 && !memcmp(png.p, sig, 8), "incorrect file signature (is this a png file?)");
 	png.p += 8;
 
 	ihdr = cp_chunk(&png, "IHDR", 13);
@@ -1093,13 +3594,18 @@ void cp_load_png_wh(const void* png_data, int png_length, int* w_out, int* h_out
 }
 
 cp_indexed_image_t cp_load_indexed_png(const char* file_name)
+{
+	return cp_load_indexed_png_arena(file_name, 0);
+}
+
+cp_indexed_image_t cp_load_indexed_png_arena(const char* file_name, cp_arena_t* arena)
 {
 	cp_indexed_image_t img = { 0 };
-	int len;
-	void* data = cp_read_file_to_memory(file_name, &len);
+	int len, mapped;
+	void* data = cp_map_file(file_name, &len, &mapped);
 	if (!data) return img;
-	img = cp_load_indexed_png_mem(data, len);
-	CUTE_PNG_FREE(data);
+	img = cp_load_indexed_png_mem_arena(data, len, arena);
+	cp_unmap_file(data, len, mapped);
 	return img;
 }
 
@@ -1132,97 +3638,47 @@ void cp_unpack_palette(cp_pixel_t* dst, const uint8_t* plte, int plte_len, const
 
 cp_indexed_image_t cp_load_indexed_png_mem(const void *png_data, int png_length)
 {
-	const char* sig = "\211PNG\r\n\032\n";
-	const uint8_t* ihdr, *first, *plte, *trns;
-	int bit_depth, color_type, bpp, w, h, pix_bytes;
-	int compression, filter, interlace;
-	int datalen, offset;
-	int plte_len;
-	uint8_t* out;
-	cp_indexed_image_t img = { 0 };
-	uint8_t* data = 0;
-	cp_raw_png_t png;
-	png.p = (uint8_t*)png_data;
-	png.end = (uint8_t*)png_data + png_length;
-
-	CUTE_PNG_CHECK(!memcmp(png.p, sig, 8), "incorrect file signature (is this a png file?)");
-	png.p += 8;
-
-	ihdr = cp_chunk(&png, "IHDR", 13);
-	CUTE_PNG_CHECK(ihdr, "unable to find IHDR chunk");
-	bit_depth = ihdr[8];
-	color_type = ihdr[9];
-	bpp = 1; // bytes per pixel
-	CUTE_PNG_CHECK(bit_depth == 8, "only bit-depth of 8 is supported");
-	CUTE_PNG_CHECK(color_type == 3, "only indexed png images (images with a palette) are valid for cp_load_indexed_png_mem");
+	return cp_load_indexed_png_mem_arena(png_data, png_length, 0);
+}
 
-	// +1 for filter byte (which is dumb! just stick this at file header...)
-	w = cp_make32(ihdr) + 1;
-	h = cp_make32(ihdr + 4);
-	pix_bytes = w * h * sizeof(uint8_t);
-	img.w = w - 1;
-	img.h = h;
-	img.pix = (uint8_t*)CUTE_PNG_ALLOC(pix_bytes);
+cp_indexed_image_t cp_load_indexed_png_mem_arena(const void* png_data, int png_length, cp_arena_t* arena)
+{
+	cp_png_info_t info;
+	cp_indexed_image_t img = { 0 };
+	cp_kernels_t k;
+	int pix_bytes, plte_len;
+
+	cp_select_kernels(&k, CUTE_PNG_KERNELS_BEST);
+	CUTE_PNG_CALL(cp_parse_png(png_data, png_length, &info, arena));
+	CUTE_PNG_CHECK(info.color_type == 3, "only indexed png images (images with a palette) are valid for cp_load_indexed_png_mem");
+	CUTE_PNG_CHECK((int64_t)(info.w + 1) * info.h <= INT_MAX, "invalid image size found");
+
+	// Inflated with a filter byte per row, then unpacked in place
+	pix_bytes = (info.w + 1) * info.h;
+	img.w = info.w;
+	img.h = info.h;
+	img.pix = (uint8_t*)cp_alloc(arena, pix_bytes);
 	CUTE_PNG_CHECK(img.pix, "unable to allocate raw image space");
 
-	compression = ihdr[10];
-	filter = ihdr[11];
-	interlace = ihdr[12];
-	CUTE_PNG_CHECK(!compression, "only standard compression DEFLATE is supported");
-	CUTE_PNG_CHECK(!filter, "only standard adaptive filtering is supported");
-	CUTE_PNG_CHECK(!interlace, "interlacing is not supported");
-
-	// PLTE must come before any IDAT chunk
-	first = png.p;
-	plte = cp_find(&png, "PLTE", 0);
-	if (!plte) png.p = first;
-	else first = png.p;
-
-	// tRNS can come after PLTE
-	trns = cp_find(&png, "tRNS", 0);
-	if (!trns) png.p = first;
-	else first = png.p;
-
-	// Compute length of the DEFLATE stream through IDAT chunk data sizes
-	datalen = 0;
-	for (const uint8_t* idat = cp_find(&png, "IDAT", 0); idat; idat = cp_chunk(&png, "IDAT", 0))
-	{
-		uint32_t len = cp_get_chunk_byte_length(idat);
-		datalen += len;
-	}
-
-	// Copy in IDAT chunk data sections to form the compressed DEFLATE stream
-	png.p = first;
-	data = (uint8_t*)CUTE_PNG_ALLOC(datalen);
-	offset = 0;
-	for (const uint8_t* idat = cp_find(&png, "IDAT", 0); idat; idat = cp_chunk(&png, "IDAT", 0))
-	{
-		uint32_t len = cp_get_chunk_byte_length(idat);
-		CUTE_PNG_MEMCPY(data + offset, idat, len);
-		offset += len;
-	}
+	CUTE_PNG_CHECK(cp_inflate_stream(info.data + 2, info.datalen - 6, img.pix, pix_bytes, 0, 0, arena), "DEFLATE algorithm failed");
+#ifdef CUTE_PNG_VERIFY_CRC
+	CUTE_PNG_CHECK(cp_check_adler(&info, cp_adler32(1, img.pix, pix_bytes)), "Adler-32 mismatch in image data (the file is corrupt)");
+#endif
+	CUTE_PNG_CHECK(cp_unfilter(&k, img.w, img.h, 1, img.pix, arena), "invalid filter byte found");
+	cp_unpack_indexed_rows(img.w, img.h, img.pix, img.pix);
 
-	// check for proper zlib structure in DEFLATE stream
-	CUTE_PNG_CHECK(data && datalen >= 6, "corrupt zlib structure in DEFLATE stream");
-	CUTE_PNG_CHECK((data[0] & 0x0f) == 0x08, "only zlib compression method (RFC 1950) is supported");
-	CUTE_PNG_CHECK((data[0] & 0xf0) <= 0x70, "innapropriate window size detected");
-	CUTE_PNG_CHECK(!(data[1] & 0x20), "preset dictionary is present and not supported");
-
-	out = img.pix;
-	CUTE_PNG_CHECK(cp_inflate(data + 2, datalen - 6, out, pix_bytes), "DEFLATE algorithm failed");
-	CUTE_PNG_CHECK(cp_unfilter(img.w, img.h, bpp, out), "invalid filter byte found");
-	cp_unpack_indexed_rows(img.w, img.h, out, img.pix);
-
-	plte_len = cp_get_chunk_byte_length(plte) / 3;
-	cp_unpack_palette(img.palette, plte, plte_len, trns, cp_get_chunk_byte_length(trns));
+	// All 256 entries are filled in, so stray indices come out black like in cp_load_png
+	plte_len = cp_get_chunk_byte_length(info.plte) / 3;
+	if (plte_len > 256) plte_len = 256;
+	CUTE_PNG_MEMCPY(img.palette, info.palette, sizeof(img.palette));
 	img.palette_len = (uint8_t)plte_len;
 
-	CUTE_PNG_FREE(data);
+	cp_release(arena, info.copy);
 	return img;
 
 cp_err:
-	CUTE_PNG_FREE(data);
-	CUTE_PNG_FREE(img.pix);
+	cp_release(arena, img.pix);
+	cp_release(arena, info.copy);
 	img.pix = 0;
 
 	return img;
@@ -1241,19 +3697,12 @@ cp_image_t cp_depallete_indexed_image(cp_indexed_image_t* img)
 	out.w = img->w;
 	out.h = img->h;
 	out.pix = (cp_pixel_t*)CUTE_PNG_ALLOC(sizeof(cp_pixel_t) * out.w * out.h);
+	if (!out.pix) return out;
 
-	cp_pixel_t* dst = out.pix;
-	uint8_t* src = img->pix;
-
-	for (int y = 0; y < out.h; ++y)
-	{
-		for (int x = 0; x < out.w; ++x)
-		{
-			int index = *src++;
-			cp_pixel_t p = img->palette[index];
-			*dst++ = p;
-		}
-	}
+	// Rows are contiguous with no filter bytes, so this is one long row
+	cp_kernels_t k;
+	cp_select_kernels(&k, CUTE_PNG_KERNELS_BEST);
+	k.depalette(img->pix, out.pix, out.w * out.h, img->palette);
 
 	return out;
 }
@@ -1271,6 +3720,7 @@ typedef struct cp_integer_image_t
 	cp_v2i_t min;
 	cp_v2i_t max;
 	int fit;
+	int page;
 } cp_integer_image_t;
 
 static cp_v2i_t cp_v2i(int x, int y)
@@ -1281,14 +3731,6 @@ static cp_v2i_t cp_v2i(int x, int y)
 	return v;
 }
 
-static cp_v2i_t cp_sub(cp_v2i_t a, cp_v2i_t b)
-{
-	cp_v2i_t v;
-	v.x = a.x - b.x;
-	v.y = a.y - b.y;
-	return v;
-}
-
 static cp_v2i_t cp_add(cp_v2i_t a, cp_v2i_t b)
 {
 	cp_v2i_t v;
@@ -1297,247 +3739,243 @@ static cp_v2i_t cp_add(cp_v2i_t a, cp_v2i_t b)
 	return v;
 }
 
-typedef struct cp_atlas_node_t
+void cp_premultiply(cp_image_t* img)
 {
-	cp_v2i_t size;
-	cp_v2i_t min;
-	cp_v2i_t max;
-} cp_atlas_node_t;
+	cp_kernels_t k;
+	cp_select_kernels(&k, CUTE_PNG_KERNELS_BEST);
+	k.premultiply(img->pix, img->w * img->h);
+}
 
-static cp_atlas_node_t* cp_best_fit(int sp, const cp_image_t* png, cp_atlas_node_t* nodes)
+// The skyline is the top edge of everything packed so far, as segments running left to
+// right. Each image goes where its bottom edge sits lowest, resting on the highest segment
+// under it, with ties going to whichever leaves the least empty space underneath.
+typedef struct cp_skyline_t
 {
-	int bestVolume = INT_MAX;
-	cp_atlas_node_t *best_node = 0;
-	int width = png->w;
-	int height = png->h;
-	int png_volume = width * height;
-
-	for (int i = 0; i < sp; ++i)
-	{
-		cp_atlas_node_t *node = nodes + i;
-		int can_contain = node->size.x >= width && node->size.y >= height;
-		if (can_contain)
-		{
-			int node_volume = node->size.x * node->size.y;
-			if (node_volume == png_volume) return node;
-			if (node_volume < bestVolume)
-			{
-				bestVolume = node_volume;
-				best_node = node;
-			}
-		}
-	}
+	int w, h;
+	int count;
+	cp_v2i_t* nodes; // left end and height of each segment, the last runs to w
+} cp_skyline_t;
 
-	return best_node;
+static void cp_skyline_reset(cp_skyline_t* s, int w, int h)
+{
+	s->w = w;
+	s->h = h;
+	s->count = 1;
+	s->nodes[0] = cp_v2i(0, 0);
 }
 
-static int cp_perimeter_pred(cp_integer_image_t* a, cp_integer_image_t* b)
+static int cp_skyline_right(const cp_skyline_t* s, int i)
 {
-	int perimeterA = 2 * (a->size.x + a->size.y);
-	int perimeterB = 2 * (b->size.x + b->size.y);
-	return perimeterB < perimeterA;
+	return i + 1 < s->count ? s->nodes[i + 1].x : s->w;
 }
 
-void cp_premultiply(cp_image_t* img)
+// Returns the segment the image's left edge goes on and its y in y_out, or -1 if it doesn't fit
+static int cp_skyline_find(const cp_skyline_t* s, int w, int h, int* y_out)
 {
-	int w = img->w;
-	int h = img->h;
-	int stride = w * sizeof(cp_pixel_t);
-	uint8_t* data = (uint8_t*)img->pix;
+	int best = -1, best_y = INT_MAX, best_waste = INT_MAX;
 
-	for(int i = 0; i < (int)stride * h; i += sizeof(cp_pixel_t))
+	for (int i = 0; i < s->count; ++i)
 	{
-		float a = (float)data[i + 3] / 255.0f;
-		float r = (float)data[i + 0] / 255.0f;
-		float g = (float)data[i + 1] / 255.0f;
-		float b = (float)data[i + 2] / 255.0f;
-		r *= a;
-		g *= a;
-		b *= a;
-		data[i + 0] = (uint8_t)(r * 255.0f);
-		data[i + 1] = (uint8_t)(g * 255.0f);
-		data[i + 2] = (uint8_t)(b * 255.0f);
-	}
-}
+		int x = s->nodes[i].x, y = 0, waste = 0;
+		if (x + w > s->w) break;
 
-static void cp_qsort(cp_integer_image_t* items, int count)
-{
-	if (count <= 1) return;
+		for (int j = i; j < s->count && s->nodes[j].x < x + w; ++j)
+			if (s->nodes[j].y > y) y = s->nodes[j].y;
+		if (y + h > s->h || y > best_y) continue;
 
-	cp_integer_image_t pivot = items[count - 1];
-	int low = 0;
-	for (int i = 0; i < count - 1; ++i)
-	{
-		if (cp_perimeter_pred(items + i, &pivot))
+		for (int j = i; j < s->count && s->nodes[j].x < x + w; ++j)
 		{
-			cp_integer_image_t tmp = items[i];
-			items[i] = items[low];
-			items[low] = tmp;
-			low++;
+			int right = cp_skyline_right(s, j);
+			if (right > x + w) right = x + w;
+			waste += (y - s->nodes[j].y) * (right - s->nodes[j].x);
+		}
+
+		if (y < best_y || waste < best_waste)
+		{
+			best = i;
+			best_y = y;
+			best_waste = waste;
 		}
 	}
 
-	items[count - 1] = items[low];
-	items[low] = pivot;
-	cp_qsort(items, low);
-	cp_qsort(items + low + 1, count - 1 - low);
+	*y_out = best_y;
+	return best;
 }
 
-cp_image_t cp_make_atlas(int atlas_width, int atlas_height, const cp_image_t* pngs, int png_count, cp_atlas_image_t* imgs_out)
+// Raises the skyline to top over an image w wide whose left edge is on segment i
+static void cp_skyline_place(cp_skyline_t* s, int i, int w, int top)
 {
-	float w0, h0, div, wTol, hTol;
-	int atlas_image_size, atlas_stride, sp;
-	void* atlas_pixels = 0;
-	int atlas_node_capacity = png_count * 2;
-	cp_image_t atlas_image;
-	cp_integer_image_t* images = 0;
-	cp_atlas_node_t* nodes = 0;
-
-	atlas_image.w = atlas_width;
-	atlas_image.h = atlas_height;
-	atlas_image.pix = 0;
-
-	CUTE_PNG_CHECK(pngs, "pngs array was NULL");
-	CUTE_PNG_CHECK(imgs_out, "imgs_out array was NULL");
+	int x = s->nodes[i].x, j = i;
 
-	images = (cp_integer_image_t*)CUTE_PNG_ALLOCA(sizeof(cp_integer_image_t) * png_count);
-	nodes = (cp_atlas_node_t*)CUTE_PNG_ALLOC(sizeof(cp_atlas_node_t) * atlas_node_capacity);
-	CUTE_PNG_CHECK(images, "out of mem");
-	CUTE_PNG_CHECK(nodes, "out of mem");
+	// Segments wholly under the image go, one partly under it is cut short
+	while (j < s->count && cp_skyline_right(s, j) <= x + w) ++j;
+	if (j < s->count) s->nodes[j].x = x + w;
+	CUTE_PNG_MEMMOVE(s->nodes + i + 1, s->nodes + j, sizeof(cp_v2i_t) * (s->count - j));
+	s->count += 1 - (j - i);
+	s->nodes[i] = cp_v2i(x, top);
 
-	for (int i = 0; i < png_count; ++i)
+	// Join neighbours at the same height so the skyline stays short
+	if (i + 1 < s->count && s->nodes[i + 1].y == top)
 	{
-		const cp_image_t* png = pngs + i;
-		cp_integer_image_t* image = images + i;
-		image->fit = 0;
-		image->size = cp_v2i(png->w, png->h);
-		image->img_index = i;
+		CUTE_PNG_MEMMOVE(s->nodes + i + 1, s->nodes + i + 2, sizeof(cp_v2i_t) * (s->count - i - 2));
+		s->count--;
 	}
 
-	// Sort PNGs from largest to smallest
-	cp_qsort(images, png_count);
-
-	// stack pointer, the stack is the nodes array which we will
-	// allocate nodes from as necessary.
-	sp = 1;
-
-	nodes[0].min = cp_v2i(0, 0);
-	nodes[0].max = cp_v2i(atlas_width, atlas_height);
-	nodes[0].size = cp_v2i(atlas_width, atlas_height);
+	if (i > 0 && s->nodes[i - 1].y == top)
+	{
+		CUTE_PNG_MEMMOVE(s->nodes + i, s->nodes + i + 1, sizeof(cp_v2i_t) * (s->count - i - 1));
+		s->count--;
+	}
+}
 
-	// Nodes represent empty space in the atlas. Placing a texture into the
-	// atlas involves splitting a node into two smaller pieces (or, if a
-	// perfect fit is found, deleting the node).
-	for (int i = 0; i < png_count; ++i)
+// Places the images not in the atlas yet onto `page`, returns how many fit
+static int cp_atlas_pack(cp_skyline_t* s, cp_integer_image_t* images, int count, int page)
+{
+	int placed = 0;
+	for (int i = 0; i < count; ++i)
 	{
 		cp_integer_image_t* image = images + i;
-		const cp_image_t* png = pngs + image->img_index;
-		int width = png->w;
-		int height = png->h;
-		cp_atlas_node_t *best_fit = cp_best_fit(sp, png, nodes);
-		if (CUTE_PNG_ATLAS_MUST_FIT) CUTE_PNG_CHECK(best_fit, "Not enough room to place image in atlas.");
-
-		image->min = best_fit->min;
-		image->max = cp_add(image->min, image->size);
+		int at = 0, y = 0;
+		if (image->fit) continue;
 
-		if (best_fit->size.x == width && best_fit->size.y == height)
+		// Empty images take up no room
+		if (image->size.x > 0 && image->size.y > 0)
 		{
-			cp_atlas_node_t* last_node = nodes + --sp;
-			*best_fit = *last_node;
-			image->fit = 1;
-
-			continue;
+			at = cp_skyline_find(s, image->size.x, image->size.y, &y);
+			if (at < 0) continue;
+			image->min = cp_v2i(s->nodes[at].x, y);
+			cp_skyline_place(s, at, image->size.x, y + image->size.y);
 		}
 
-		image->fit = 1;
-
-		if (sp == atlas_node_capacity)
-		{
-			int new_capacity = atlas_node_capacity * 2;
-			cp_atlas_node_t* new_nodes = (cp_atlas_node_t*)CUTE_PNG_ALLOC(sizeof(cp_atlas_node_t) * new_capacity);
-			CUTE_PNG_CHECK(new_nodes, "out of mem");
-			memcpy(new_nodes, nodes, sizeof(cp_atlas_node_t) * sp);
-			CUTE_PNG_FREE(nodes);
-			nodes = new_nodes;
-			atlas_node_capacity = new_capacity;
-		}
+		else image->min = cp_v2i(0, 0);
 
-		cp_atlas_node_t* new_node = nodes + sp++;
-		new_node->min = best_fit->min;
+		image->max = cp_add(image->min, image->size);
+		image->fit = 1;
+		image->page = page;
+		placed++;
+	}
+	return placed;
+}
 
-		// Split bestFit along x or y, whichever minimizes
-		// fragmentation of empty space
-		cp_v2i_t d = cp_sub(best_fit->size, cp_v2i(width, height));
-		if (d.x < d.y)
-		{
-			new_node->size.x = d.x;
-			new_node->size.y = height;
-			new_node->min.x += width;
+static void cp_atlas_unpack(cp_integer_image_t* images, int count, int page)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		if (images[i].page != page) continue;
+		images[i].fit = 0;
+		images[i].page = -1;
+	}
+}
 
-			best_fit->size.y = d.y;
-			best_fit->min.y += height;
-		}
+// Tallest first then widest, the order a skyline packs best in
+static int cp_atlas_before(const cp_integer_image_t* a, const cp_integer_image_t* b)
+{
+	if (a->size.y != b->size.y) return a->size.y > b->size.y;
+	if (a->size.x != b->size.x) return a->size.x > b->size.x;
+	return a->img_index < b->img_index;
+}
 
-		else
-		{
-			new_node->size.x = width;
-			new_node->size.y = d.y;
-			new_node->min.y += height;
+static void cp_sift_down(cp_integer_image_t* items, int root, int count)
+{
+	for (int child = root * 2 + 1; child < count; root = child, child = root * 2 + 1)
+	{
+		if (child + 1 < count && cp_atlas_before(items + child, items + child + 1)) child++;
+		if (!cp_atlas_before(items + root, items + child)) return;
 
-			best_fit->size.x = d.x;
-			best_fit->min.x += width;
-		}
+		cp_integer_image_t tmp = items[root];
+		items[root] = items[child];
+		items[child] = tmp;
+	}
+}
 
-		new_node->max = cp_add(new_node->min, new_node->size);
+// Heap sort, so there's no recursion and no slow case for lots of same sized images
+static void cp_sort_images(cp_integer_image_t* items, int count)
+{
+	for (int i = count / 2 - 1; i >= 0; --i) cp_sift_down(items, i, count);
+	for (int end = count - 1; end > 0; --end)
+	{
+		cp_integer_image_t tmp = items[0];
+		items[0] = items[end];
+		items[end] = tmp;
+		cp_sift_down(items, 0, end);
 	}
+}
 
-	// Write the final atlas image, use CUTE_PNG_ATLAS_EMPTY_COLOR as base color
-	atlas_stride = atlas_width * sizeof(cp_pixel_t);
-	atlas_image_size = atlas_width * atlas_height * sizeof(cp_pixel_t);
-	atlas_pixels = CUTE_PNG_ALLOC(atlas_image_size);
-	CUTE_PNG_CHECK(atlas_image_size, "out of mem");
-	CUTE_PNG_MEMSET(atlas_pixels, CUTE_PNG_ATLAS_EMPTY_COLOR, atlas_image_size);
+// Sorted packing order for the images, along with room for a skyline that can hold all of them
+static cp_integer_image_t* cp_atlas_images(const cp_image_t* pngs, int png_count, cp_skyline_t* s)
+{
+	cp_integer_image_t* images = (cp_integer_image_t*)CUTE_PNG_ALLOC(sizeof(cp_integer_image_t) * png_count + sizeof(cp_v2i_t) * (png_count + 1));
+	if (!images) return 0;
 
 	for (int i = 0; i < png_count; ++i)
 	{
 		cp_integer_image_t* image = images + i;
+		image->fit = 0;
+		image->page = -1;
+		image->size = cp_v2i(pngs[i].w, pngs[i].h);
+		image->img_index = i;
+	}
 
-		if (image->fit)
-		{
-			const cp_image_t* png = pngs + image->img_index;
-			char* pixels = (char*)png->pix;
-			cp_v2i_t min = image->min;
-			cp_v2i_t max = image->max;
-			int atlas_offset = min.x * sizeof(cp_pixel_t);
-			int tex_stride = png->w * sizeof(cp_pixel_t);
+	cp_sort_images(images, png_count);
+	s->nodes = (cp_v2i_t*)(images + png_count);
+	return images;
+}
 
-			for (int row = min.y, y = 0; row < max.y; ++row, ++y)
-			{
-				void* row_ptr = (char*)atlas_pixels + (row * atlas_stride + atlas_offset);
-				CUTE_PNG_MEMCPY(row_ptr, pixels + y * tex_stride, tex_stride);
-			}
+// Copies the images packed onto `page` into a new w x h image, use CUTE_PNG_ATLAS_EMPTY_COLOR as base color
+static cp_image_t cp_atlas_page(const cp_image_t* pngs, const cp_integer_image_t* images, int count, int page, int w, int h)
+{
+	cp_image_t atlas_image;
+	int atlas_stride = w * sizeof(cp_pixel_t);
+	atlas_image.w = w;
+	atlas_image.h = h;
+	atlas_image.pix = (cp_pixel_t*)CUTE_PNG_ALLOC(atlas_stride * h);
+	if (!atlas_image.pix) return atlas_image;
+	CUTE_PNG_MEMSET(atlas_image.pix, CUTE_PNG_ATLAS_EMPTY_COLOR, atlas_stride * h);
+
+	for (int i = 0; i < count; ++i)
+	{
+		const cp_integer_image_t* image = images + i;
+		if (!image->fit || image->page != page) continue;
+
+		const cp_image_t* png = pngs + image->img_index;
+		char* pixels = (char*)png->pix;
+		cp_v2i_t min = image->min;
+		cp_v2i_t max = image->max;
+		int atlas_offset = min.x * sizeof(cp_pixel_t);
+		int tex_stride = png->w * sizeof(cp_pixel_t);
+
+		for (int row = min.y, y = 0; row < max.y; ++row, ++y)
+		{
+			void* row_ptr = (char*)atlas_image.pix + (row * atlas_stride + atlas_offset);
+			CUTE_PNG_MEMCPY(row_ptr, pixels + y * tex_stride, tex_stride);
 		}
 	}
 
-	atlas_image.pix = (cp_pixel_t*)atlas_pixels;
+	return atlas_image;
+}
 
+// Fills in imgs_out for the images on a w x h `page`, and for those that didn't fit anywhere
+static void cp_atlas_uvs(const cp_integer_image_t* images, int count, int page, int w, int h, cp_atlas_image_t* imgs_out)
+{
 	// squeeze UVs inward by 128th of a pixel
 	// this prevents atlas bleeding. tune as necessary for good results.
-	w0 = 1.0f / (float)(atlas_width);
-	h0 = 1.0f / (float)(atlas_height);
-	div = 1.0f / 128.0f;
-	wTol = w0 * div;
-	hTol = h0 * div;
+	float w0 = 1.0f / (float)(w);
+	float h0 = 1.0f / (float)(h);
+	float div = 1.0f / 128.0f;
+	float wTol = w0 * div;
+	float hTol = h0 * div;
 
-	for (int i = 0; i < png_count; ++i)
+	for (int i = 0; i < count; ++i)
 	{
-		cp_integer_image_t* image = images + i;
+		const cp_integer_image_t* image = images + i;
 		cp_atlas_image_t* img_out = imgs_out + i;
+		if (image->fit && image->page != page) continue;
 
 		img_out->img_index = image->img_index;
 		img_out->w = image->size.x;
 		img_out->h = image->size.y;
 		img_out->fit = image->fit;
+		img_out->page = image->page;
 
 		if (image->fit)
 		{
@@ -1563,17 +4001,123 @@ cp_image_t cp_make_atlas(int atlas_width, int atlas_height, const cp_image_t* pn
 			img_out->maxy = max_y;
 		}
 	}
+}
+
+cp_image_t cp_make_atlas(int atlas_width, int atlas_height, const cp_image_t* pngs, int png_count, cp_atlas_image_t* imgs_out)
+{
+	cp_image_t atlas_image;
+	cp_integer_image_t* images = 0;
+	cp_skyline_t sky;
+	int placed;
+
+	atlas_image.w = atlas_width;
+	atlas_image.h = atlas_height;
+	atlas_image.pix = 0;
+
+	CUTE_PNG_CHECK(pngs, "pngs array was NULL");
+	CUTE_PNG_CHECK(imgs_out, "imgs_out array was NULL");
+	CUTE_PNG_CHECK(atlas_width >= 1 && atlas_height >= 1 && (int64_t)atlas_width * atlas_height * sizeof(cp_pixel_t) <= INT_MAX, "invalid atlas size");
+
+	images = cp_atlas_images(pngs, png_count, &sky);
+	CUTE_PNG_CHECK(images, "out of mem");
+
+	cp_skyline_reset(&sky, atlas_width, atlas_height);
+	placed = cp_atlas_pack(&sky, images, png_count, 0);
+	CUTE_PNG_CHECK(!CUTE_PNG_ATLAS_MUST_FIT || placed == png_count, "Not enough room to place image in atlas.");
+
+	atlas_image = cp_atlas_page(pngs, images, png_count, 0, atlas_width, atlas_height);
+	CUTE_PNG_CHECK(atlas_image.pix, "out of mem");
+	cp_atlas_uvs(images, png_count, 0, atlas_width, atlas_height, imgs_out);
 
-	CUTE_PNG_FREE(nodes);
+	CUTE_PNG_FREE(images);
 	return atlas_image;
 
 cp_err:
-	CUTE_PNG_FREE(atlas_pixels);
-	CUTE_PNG_FREE(nodes);
+	CUTE_PNG_FREE(images);
 	atlas_image.pix = 0;
 	return atlas_image;
 }
 
+// Doubles the shorter side of a page, staying within max_w x max_h
+static void cp_atlas_grow(int* w, int* h, int max_w, int max_h)
+{
+	if ((*h < *w || *w == max_w) && *h < max_h) *h = *h * 2 < max_h ? *h * 2 : max_h;
+	else *w = *w * 2 < max_w ? *w * 2 : max_w;
+}
+
+int cp_make_atlas_pages(int max_width, int max_height, const cp_image_t* pngs, int png_count, cp_atlas_image_t* imgs_out, cp_image_t* pages_out, int max_pages)
+{
+	cp_integer_image_t* images = 0;
+	cp_skyline_t sky;
+	int page_count = 0, left = 0;
+	int w, h, placed;
+	int64_t area;
+
+	CUTE_PNG_CHECK(pngs, "pngs array was NULL");
+	CUTE_PNG_CHECK(imgs_out, "imgs_out array was NULL");
+	CUTE_PNG_CHECK(pages_out, "pages_out array was NULL");
+	CUTE_PNG_CHECK(max_width >= 1 && max_height >= 1 && (int64_t)max_width * max_height * sizeof(cp_pixel_t) <= INT_MAX, "invalid atlas size");
+
+	images = cp_atlas_images(pngs, png_count, &sky);
+	CUTE_PNG_CHECK(images, "out of mem");
+
+	// Images bigger than a whole page are left out, or are an error
+	for (int i = 0; i < png_count; ++i)
+	{
+		if (images[i].size.x <= max_width && images[i].size.y <= max_height) left++;
+		else CUTE_PNG_CHECK(!CUTE_PNG_ATLAS_MUST_FIT, "Image is larger than the largest atlas page.");
+	}
+	cp_atlas_uvs(images, png_count, -1, max_width, max_height, imgs_out);
+
+	while (left)
+	{
+		CUTE_PNG_CHECK(page_count < max_pages, "Not enough atlas pages to place every image.");
+
+		// Start from the smallest power of two that holds the largest image and the area
+		// of everything left, then keep doubling until it all fits or the page is full size
+		w = h = 1;
+		area = 0;
+		for (int i = 0; i < png_count; ++i)
+		{
+			cp_integer_image_t* image = images + i;
+			if (image->fit || image->size.x > max_width || image->size.y > max_height) continue;
+			area += (int64_t)image->size.x * image->size.y;
+			while (w < image->size.x) w *= 2;
+			while (h < image->size.y) h *= 2;
+		}
+		if (w > max_width) w = max_width;
+		if (h > max_height) h = max_height;
+		while ((int64_t)w * h < area && (w < max_width || h < max_height)) cp_atlas_grow(&w, &h, max_width, max_height);
+
+		while (1)
+		{
+			cp_skyline_reset(&sky, w, h);
+			placed = cp_atlas_pack(&sky, images, png_count, page_count);
+			if (placed == left || (w == max_width && h == max_height)) break;
+			cp_atlas_unpack(images, png_count, page_count);
+			cp_atlas_grow(&w, &h, max_width, max_height);
+		}
+
+		pages_out[page_count] = cp_atlas_page(pngs, images, png_count, page_count, w, h);
+		CUTE_PNG_CHECK(pages_out[page_count].pix, "out of mem");
+		cp_atlas_uvs(images, png_count, page_count, w, h, imgs_out);
+		page_count++;
+		left -= placed;
+	}
+
+	CUTE_PNG_FREE(images);
+	return page_count;
+
+cp_err:
+	for (int i = 0; i < page_count; ++i)
+	{
+		CUTE_PNG_FREE(pages_out[i].pix);
+		pages_out[i].pix = 0;
+	}
+	CUTE_PNG_FREE(images);
+	return 0;
+}
+
 int cp_default_save_atlas(const char* out_path_image, const char* out_path_atlas_txt, const cp_image_t* atlas, const cp_atlas_image_t* imgs, int img_count, const char** names)
 {
 	FILE* fp = fopen(out_path_atlas_txt, "wt");
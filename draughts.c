@@ -0,0 +1,254 @@
+#include "draughts.h"
+
+#define SPARE_BITS ((Bitboard)1 << 10 | (Bitboard)1 << 21 | (Bitboard)1 << 32 | (Bitboard)1 << 43)
+#define ON_BOARD ((((Bitboard)1 << 54) - 1) & ~SPARE_BITS)
+#define TOP_ROW ((Bitboard)0x1F)
+#define BOTTOM_ROW ((Bitboard)0x1F << 49)
+
+#if defined(__GNUC__)
+#define lowest_bit(bb) __builtin_ctzll(bb)
+#define count_bits(bb) __builtin_popcountll(bb)
+#else
+static int lowest_bit(Bitboard bb) {
+  int n = 0;
+  for(; !(bb & 1); bb >>= 1)
+    n++;
+  return n;
+}
+
+static int count_bits(Bitboard bb) {
+  int n = 0;
+  for(; bb; bb &= bb - 1)
+    n++;
+  return n;
+}
+#endif
+
+// Up left, up right, down left and down right. White moves down the board
+// and black up it.
+static const int shifts[4] = { -6, -5, 5, 6 };
+
+// State for the capture search from one piece
+typedef struct {
+  DraughtsMove *moves;
+  int count;
+  int best; // most pieces taken by any capture so far
+  int from;
+  Bitboard enemy, empty;
+} Captures;
+
+
+static Bitboard shift(Bitboard bb, int d) {
+  return d > 0 ? bb << d : bb >> -d;
+}
+
+
+// Bit for x,y, or 0 for light squares and squares off the board
+static Bitboard square_bit(int x, int y) {
+  if(x < 0 || x >= DRAUGHTS_SIZE || y < 0 || y >= DRAUGHTS_SIZE || x%2 == y%2)
+    return 0;
+
+  int s = y * 5 + x / 2;
+  return (Bitboard)1 << (s + s / 10);
+}
+
+
+// Get piece at board location x, y
+// Returns -1 off the board
+int draughts_get_piece(const DraughtsBoard *b, int x, int y) {
+  if(x < 0 || x >= DRAUGHTS_SIZE || y < 0 || y >= DRAUGHTS_SIZE)
+    return -1;
+
+  Bitboard bit = square_bit(x, y);
+  if(b->white & bit)
+    return b->kings & bit ? 'W' : 'w';
+  if(b->black & bit)
+    return b->kings & bit ? 'B' : 'b';
+  return ' ';
+}
+
+
+// Set piece at board location x, y
+// Returns false for light squares, squares off the board and unknown pieces
+bool draughts_set_piece(DraughtsBoard *b, int x, int y, char piece) {
+  Bitboard bit = square_bit(x, y);
+  if(bit == 0 || (piece != ' ' && piece != 'w' && piece != 'W' && piece != 'b' && piece != 'B'))
+    return false;
+
+  b->white &= ~bit;
+  b->black &= ~bit;
+  b->kings &= ~bit;
+  if(piece == 'w' || piece == 'W')
+    b->white |= bit;
+  if(piece == 'b' || piece == 'B')
+    b->black |= bit;
+  if(piece == 'W' || piece == 'B')
+    b->kings |= bit;
+  return true;
+}
+
+
+void draughts_init_board(DraughtsBoard *b) {
+  b->white = b->black = b->kings = 0;
+  for(int y = 0; y < DRAUGHTS_SIZE; y++)
+    for(int x = 0; x < DRAUGHTS_SIZE; x++)
+      draughts_set_piece(b, x, y, y < 4 ? 'w' : y >= DRAUGHTS_SIZE - 4 ? 'b' : ' ');
+  b->side = 'b';
+}
+
+
+// Men that have a capture, for all of them at once
+static Bitboard men_that_capture(Bitboard men, Bitboard enemy, Bitboard empty) {
+  Bitboard found = 0;
+  for(int d = 0; d < 4; d++)
+    found |= shift(shift(empty, -shifts[d]) & enemy, -shifts[d]);
+  return men & found;
+}
+
+
+// Kings that have a capture. For each direction this finds the squares a
+// capture can be made from straight away, then fills back from them along
+// the empty squares a king could slide down to get there.
+static Bitboard kings_that_capture(Bitboard kings, Bitboard enemy, Bitboard empty) {
+  Bitboard found = 0;
+  for(int d = 0; d < 4; d++) {
+    Bitboard reach = shift(shift(empty, -shifts[d]) & enemy, -shifts[d]);
+    for(Bitboard more = reach; more; reach |= more)
+      more = shift(reach & empty, -shifts[d]) & ~reach;
+    found |= reach;
+  }
+  return kings & found;
+}
+
+
+// Adds a finished capture, unless another takes more pieces or it's the
+// same move as one already found by another route
+static void add_capture(Captures *c, int to, Bitboard captured) {
+  int taken = count_bits(captured);
+  if(taken < c->best)
+    return;
+  if(taken > c->best) {
+    c->best = taken;
+    c->count = 0;
+  }
+
+  for(int i = 0; i < c->count && taken > 1; i++)
+    if(c->moves[i].to == to && c->moves[i].from == c->from && c->moves[i].captured == captured)
+      return;
+
+  c->moves[c->count++] = (DraughtsMove){ c->from, to, captured };
+}
+
+
+// Every way a man at at can carry on capturing. Captured pieces stay on
+// the board until the move is over, so they can't be jumped twice.
+static void man_captures(Captures *c, Bitboard at, Bitboard captured) {
+  bool extended = false;
+  for(int d = 0; d < 4; d++) {
+    Bitboard over = shift(at, shifts[d]) & c->enemy & ~captured;
+    Bitboard land = shift(over, shifts[d]) & c->empty;
+    if(land) {
+      man_captures(c, land, captured | over);
+      extended = true;
+    }
+  }
+
+  if(!extended && captured)
+    add_capture(c, lowest_bit(at), captured);
+}
+
+
+static void king_captures(Captures *c, Bitboard at, Bitboard captured) {
+  bool extended = false;
+  for(int d = 0; d < 4; d++) {
+    Bitboard over = shift(at, shifts[d]);
+    while(over & c->empty)
+      over = shift(over, shifts[d]);
+
+    over &= c->enemy & ~captured;
+    for(Bitboard land = shift(over, shifts[d]) & c->empty; land; land = shift(land, shifts[d]) & c->empty) {
+      king_captures(c, land, captured | over);
+      extended = true;
+    }
+  }
+
+  if(!extended && captured)
+    add_capture(c, lowest_bit(at), captured);
+}
+
+
+int draughts_generate_moves(const DraughtsBoard *b, DraughtsMove *moves) {
+  bool white = b->side == 'w';
+  Bitboard own = white ? b->white : b->black, enemy = white ? b->black : b->white;
+  Bitboard empty = ON_BOARD & ~(b->white | b->black);
+  Bitboard men = own & ~b->kings, kings = own & b->kings;
+
+  // Captures are forced, and it has to be one that takes the most pieces
+  Captures c = { moves, 0, 1, 0, enemy, empty };
+  Bitboard capturers = men_that_capture(men, enemy, empty) | kings_that_capture(kings, enemy, empty);
+  for(; capturers; capturers &= capturers - 1) {
+    Bitboard at = capturers & -capturers;
+    c.from = lowest_bit(at);
+    c.empty = empty | at;
+    if(at & kings)
+      king_captures(&c, at, 0);
+    else
+      man_captures(&c, at, 0);
+  }
+
+  if(c.count > 0)
+    return c.count;
+
+  // Men step forwards, every one of them at once for each direction
+  int count = 0, first = white ? 2 : 0;
+  for(int d = first; d < first + 2; d++) {
+    for(Bitboard to = shift(men, shifts[d]) & empty; to; to &= to - 1) {
+      int square = lowest_bit(to);
+      moves[count++] = (DraughtsMove){ square - shifts[d], square, 0 };
+    }
+  }
+
+  for(; kings; kings &= kings - 1) {
+    Bitboard at = kings & -kings;
+    for(int d = 0; d < 4; d++)
+      for(Bitboard to = shift(at, shifts[d]) & empty; to; to = shift(to, shifts[d]) & empty)
+        moves[count++] = (DraughtsMove){ lowest_bit(at), lowest_bit(to), 0 };
+  }
+
+  return count;
+}
+
+
+void draughts_make_move(DraughtsBoard *b, const DraughtsMove *m) {
+  Bitboard from = (Bitboard)1 << m->from, to = (Bitboard)1 << m->to;
+  bool white = b->side == 'w';
+  Bitboard *own = white ? &b->white : &b->black, *enemy = white ? &b->black : &b->white;
+  bool king = b->kings & from;
+
+  // A king can end a capture where it started, so from and to may be the same
+  *own = (*own & ~from) | to;
+  *enemy &= ~m->captured;
+  b->kings &= ~(from | m->captured);
+  if(king || (to & (white ? BOTTOM_ROW : TOP_ROW)))
+    b->kings |= to;
+  b->side = white ? 'b' : 'w';
+}
+
+
+unsigned long draughts_perft(const DraughtsBoard *b, int depth) {
+  DraughtsMove moves[DRAUGHTS_MAX_MOVES];
+  if(depth == 0)
+    return 1;
+
+  int count = draughts_generate_moves(b, moves);
+  if(depth == 1)
+    return count;
+
+  unsigned long nodes = 0;
+  for(int i = 0; i < count; i++) {
+    DraughtsBoard next = *b;
+    draughts_make_move(&next, &moves[i]);
+    nodes += draughts_perft(&next, depth - 1);
+  }
+  return nodes;
+}
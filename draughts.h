@@ -0,0 +1,49 @@
+#ifndef DRAUGHTS_H
+#define DRAUGHTS_H
+#include <stdbool.h>
+#include <stdint.h>
+
+// International draughts on a 10x10 board, with flying kings, men that
+// capture backwards and majority capture, using 64-bit bitboards.
+//
+// The 50 dark squares are numbered from the top left, five to a row, and
+// square s is bit s + s / 10. That leaves a spare bit after every second
+// row, so the diagonal neighbours of every square are 5 and 6 bits away and
+// a shift that runs off the side of the board lands on a spare bit.
+
+#define DRAUGHTS_SIZE 10
+
+typedef uint64_t Bitboard;
+
+typedef struct {
+  Bitboard white, black, kings;
+  char side; // 'w' or 'b', whoever moves next
+} DraughtsBoard;
+
+// Moves are told apart by where they start and end and what they capture,
+// as the rules do, rather than the route taken
+typedef struct {
+  unsigned char from, to; // bit numbers
+  Bitboard captured;
+} DraughtsMove;
+
+#define DRAUGHTS_MAX_MOVES 256
+
+// Set up the board for a new game, white on the top four rows, black to move
+void draughts_init_board(DraughtsBoard *b);
+
+// Same pieces as checkers.c, ' ' for an empty square and w, W, b, B.
+// Light squares are always empty and can't be set.
+int draughts_get_piece(const DraughtsBoard *b, int x, int y);
+bool draughts_set_piece(DraughtsBoard *b, int x, int y, char piece);
+
+// Fill moves with every legal move for the side to move, returns how many
+int draughts_generate_moves(const DraughtsBoard *b, DraughtsMove *moves);
+
+// Make a move from draughts_generate_moves and pass the turn
+void draughts_make_move(DraughtsBoard *b, const DraughtsMove *m);
+
+// Count the positions depth moves ahead
+unsigned long draughts_perft(const DraughtsBoard *b, int depth);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef EMBEDDED_ASSETS_H
+#define EMBEDDED_ASSETS_H
+
+// Assets decoded at build time by bake_assets, see the Makefile
+// Pixels are RGBA, 4 bytes per pixel with no padding between rows
+typedef struct {
+  const char *filename;
+  int w, h;
+  const unsigned char *pix;
+} EmbeddedAsset;
+
+extern const EmbeddedAsset embedded_assets[];
+extern const int embedded_asset_count;
+
+#endif
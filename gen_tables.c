@@ -0,0 +1,136 @@
+// Writes out the square and diagonal lookup tables checkers.c uses
+//
+// usage: gen_tables >checkers_tables.h
+//
+// Squares are numbered y * BOARD_WIDTH + x, and the tables cover light
+// squares too since move_piece doesn't check where it's moving. The
+// directions are numbered so that (x2 > x1) | (y2 > y1) << 1 picks the
+// one from x1,y1 towards x2,y2.
+//
+// The piece-square tables for the evaluation are from white's side, black
+// uses them turned round.
+
+#include "checkers.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BOARD_SQUARES (BOARD_WIDTH * BOARD_HEIGHT)
+
+const int dirs[4][2] = { {-1,-1}, {1,-1}, {-1,1}, {1,1} };
+
+// Piece-square weights
+#define ADVANCE_WORTH 3 // for each row a man has moved towards promotion
+#define CENTRE_WORTH 6 // for any piece in the middle half of the board
+#define BACK_RANK_WORTH 8 // for a man still guarding the back row
+
+
+bool is_valid(int x, int y) {
+  return x >= 0 && x < BOARD_WIDTH && y >= 0 && y < BOARD_HEIGHT;
+}
+
+
+// Square at distance steps from x,y in direction d, or -1 if off the board
+int step(int x, int y, int d, int distance) {
+  x += dirs[d][0] * distance;
+  y += dirs[d][1] * distance;
+  return is_valid(x, y) ? y * BOARD_WIDTH + x : -1;
+}
+
+
+int main(void) {
+  int live = 0;
+
+  printf("// Generated by gen_tables for %dx%d boards, do not edit\n",
+      BOARD_WIDTH, BOARD_HEIGHT);
+  printf("#ifndef CHECKERS_TABLES_H\n#define CHECKERS_TABLES_H\n");
+  printf("\ntypedef struct {\n  signed char x, y;\n} Location;\n");
+  printf("\ntypedef struct {\n  signed char over, land;\n} Jump;\n");
+
+  printf("\n// Dark square number of every square, -1 for light squares\n");
+  printf("static const signed char live_index[%d] = {", BOARD_SQUARES);
+  for(int y = 0; y < BOARD_HEIGHT; y++) {
+    printf("\n ");
+    for(int x = 0; x < BOARD_WIDTH; x++)
+      printf(" %d,", x%2 != y%2 ? live++ : -1);
+  }
+  printf("\n};\n");
+
+  printf("\n// x,y of every square\n");
+  printf("static const Location locations[%d] = {", BOARD_SQUARES);
+  for(int s = 0; s < BOARD_SQUARES; s++)
+    printf("%s{%d,%d},", s % BOARD_WIDTH ? " " : "\n  ", s % BOARD_WIDTH, s / BOARD_WIDTH);
+  printf("\n};\n");
+
+  printf("\n// x,y of every dark square, top to bottom and left to right\n");
+  printf("static const Location live_locations[%d] = {", live);
+  for(int y = 0, i = 0; y < BOARD_HEIGHT; y++)
+    for(int x = 0; x < BOARD_WIDTH; x++)
+      if(x%2 != y%2)
+        printf("%s{%d,%d},", i++ % 8 ? " " : "\n  ", x, y);
+  printf("\n};\n");
+
+  printf("\n// Diagonal neighbour of every square in each direction, -1 off the board\n");
+  printf("static const signed char neighbours[%d][4] = {", BOARD_SQUARES);
+  for(int s = 0; s < BOARD_SQUARES; s++) {
+    int x = s % BOARD_WIDTH, y = s / BOARD_WIDTH;
+    printf("%s{%d,%d,%d,%d},", s % BOARD_WIDTH ? " " : "\n  ",
+        step(x,y,0,1), step(x,y,1,1), step(x,y,2,1), step(x,y,3,1));
+  }
+  printf("\n};\n");
+
+  printf("\n// Square jumped over and square landed on for a jump in each direction,\n");
+  printf("// both -1 if the landing square is off the board\n");
+  printf("static const Jump jumps[%d][4] = {", BOARD_SQUARES);
+  for(int s = 0; s < BOARD_SQUARES; s++) {
+    int x = s % BOARD_WIDTH, y = s / BOARD_WIDTH;
+    printf("\n  {");
+    for(int d = 0; d < 4; d++) {
+      int land = step(x, y, d, 2);
+      printf(" {%d,%d},", land < 0 ? -1 : step(x, y, d, 1), land);
+    }
+    printf(" },");
+  }
+  printf("\n};\n");
+
+  printf("\n// The men that are promoted on reaching each square\n");
+  printf("static const char promotions[%d] = {", BOARD_SQUARES);
+  for(int y = 0; y < BOARD_HEIGHT; y++) {
+    printf("\n ");
+    for(int x = 0; x < BOARD_WIDTH; x++)
+      printf(" %s,", y == 0 ? "'b'" : y == BOARD_HEIGHT-1 ? "'w'" : "0");
+  }
+  printf("\n};\n");
+
+  printf("\n// Worth of a white man on each square for being further up the board\n");
+  printf("static const signed char advancement[%d] = {", BOARD_SQUARES);
+  for(int y = 0; y < BOARD_HEIGHT; y++) {
+    printf("\n ");
+    for(int x = 0; x < BOARD_WIDTH; x++)
+      printf(" %d,", x%2 != y%2 ? y * ADVANCE_WORTH : 0);
+  }
+  printf("\n};\n");
+
+  printf("\n// Worth of any white piece on each square for being in the centre\n");
+  printf("static const signed char centre[%d] = {", BOARD_SQUARES);
+  for(int y = 0; y < BOARD_HEIGHT; y++) {
+    printf("\n ");
+    for(int x = 0; x < BOARD_WIDTH; x++) {
+      bool middle = x >= BOARD_WIDTH / 4 && x < BOARD_WIDTH - BOARD_WIDTH / 4 &&
+          y >= BOARD_HEIGHT / 4 && y < BOARD_HEIGHT - BOARD_HEIGHT / 4;
+      printf(" %d,", x%2 != y%2 && middle ? CENTRE_WORTH : 0);
+    }
+  }
+  printf("\n};\n");
+
+  printf("\n// Worth of a white man on each square for guarding the back row\n");
+  printf("static const signed char back_rank[%d] = {", BOARD_SQUARES);
+  for(int y = 0; y < BOARD_HEIGHT; y++) {
+    printf("\n ");
+    for(int x = 0; x < BOARD_WIDTH; x++)
+      printf(" %d,", x%2 != y%2 && y == 0 ? BACK_RANK_WORTH : 0);
+  }
+  printf("\n};\n");
+
+  printf("\n#endif\n");
+  return EXIT_SUCCESS;
+}
@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L // for cute_png's posix_madvise
 #include "checkers.h"
 #include <stdio.h>
 #include <stdarg.h>
@@ -6,6 +7,10 @@
 #define CUTE_PNG_IMPLEMENTATION
 #include "cute_png.h"
 
+#ifdef EMBED_ASSETS
+#include "embedded_assets.h"
+#endif
+
 #define WINDOW_WIDTH 640
 #define WINDOW_HEIGHT 480
 #define TILE_WIDTH 32
@@ -19,12 +24,6 @@
     "ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`" \
     "abcdefghijklmnopqrstuvwxyz{|}~" )
 
-#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-#define RGBA_MASK 0xff000000, 0x00ff0000, 0x0000ff00, 0x000000ff
-#else
-#define RGBA_MASK 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000
-#endif
-
 #define die(msg) do { perror(msg); exit(EXIT_FAILURE); } while(0)
 #define max(a,b) ((a) > (b) ? (a) : (b))
 #define min(a,b) ((a) < (b) ? (a) : (b))
@@ -35,6 +34,20 @@ SDL_Renderer *renderer;
 SDL_Texture *render_target;
 int render_target_scale;
 
+// Render targets are kept around by scale so dragging the window back and
+// forth across a scale boundary doesn't allocate a new one every time
+#define RENDER_TARGET_POOL_SIZE 4
+#define RESIZE_DEBOUNCE_MS 100
+
+struct {
+  SDL_Texture *tex;
+  int scale;
+  Uint32 last_used;
+} render_target_pool[RENDER_TARGET_POOL_SIZE];
+
+bool resize_pending;
+Uint32 resize_time;
+
 // Resources
 typedef struct {
   SDL_Texture *tex;
@@ -55,36 +68,75 @@ Font font;
 
 
 // SDL functions
-void update_render_target(void) {
-  if(render_target != NULL)
-    SDL_DestroyTexture(render_target);
-  
+int get_render_target_scale(void) {
   int win_width, win_height;
   SDL_GetWindowSize(window, &win_width, &win_height);
 
-  render_target_scale = ceil(min(
+  int scale = ceil(min(
         win_width / (double)TARGET_WIDTH,
         win_height / (double)TARGET_HEIGHT));
-  if(render_target_scale < 1)
-    render_target_scale = 1;
+  if(scale < 1)
+    scale = 1;
+
+  return scale;
+}
+
+
+// Point render_target at a texture for the current window size. Textures
+// are taken from the pool if one of the right scale exists, otherwise a new
+// one is created in place of the least recently used.
+void update_render_target(void) {
+  int scale = get_render_target_scale();
+  if(render_target != NULL && scale == render_target_scale)
+    return;
+
+  int slot = 0;
+  for(int i = 0; i < RENDER_TARGET_POOL_SIZE; i++) {
+    if(render_target_pool[i].tex != NULL &&
+        render_target_pool[i].scale == scale) {
+      slot = i;
+      goto found;
+    }
+
+    if(render_target_pool[i].last_used < render_target_pool[slot].last_used)
+      slot = i;
+  }
+
+  if(render_target_pool[slot].tex != NULL)
+    SDL_DestroyTexture(render_target_pool[slot].tex);
 
   SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
-  render_target = SDL_CreateTexture(
+  render_target_pool[slot].scale = scale;
+  render_target_pool[slot].tex = SDL_CreateTexture(
       renderer, 
       SDL_PIXELFORMAT_RGBA8888,
       SDL_TEXTUREACCESS_TARGET,
-      TARGET_WIDTH * render_target_scale,
-      TARGET_HEIGHT * render_target_scale);
+      TARGET_WIDTH * scale,
+      TARGET_HEIGHT * scale);
 
-  if(render_target == NULL)
+  if(render_target_pool[slot].tex == NULL)
     die(SDL_GetError());
+
+found:
+  // Never 0, so an empty slot is always the least recently used
+  render_target_pool[slot].last_used = SDL_GetTicks() + 1;
+  render_target = render_target_pool[slot].tex;
+  render_target_scale = scale;
 }
 
 
-void init_sdl(void) {
-  if(SDL_Init(SDL_INIT_EVERYTHING))
-    die(SDL_GetError());
+// Resizing produces a stream of events while the window is dragged, only
+// update the render target once they've stopped for a moment
+void update_resize(void) {
+  if(resize_pending && SDL_GetTicks() - resize_time >= RESIZE_DEBOUNCE_MS) {
+    update_render_target();
+    resize_pending = false;
+  }
+}
 
+
+// Create the window, renderer and render target, after SDL_Init
+void init_window(void) {
   window = SDL_CreateWindow(
       "Checkers",
       SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
@@ -104,44 +156,191 @@ void init_sdl(void) {
 }
 
 
-SDL_Surface *load_png(const char *filename) {
-  cp_image_t img = cp_load_png(filename);
-  if(img.pix == 0)
+// Resources are decoded in parallel on their own threads, straight into
+// streaming textures. Textures can only be created and locked on the main
+// thread, so each resource goes through a few states:
+//
+//   RESOURCE_OPENING   the thread is reading the file for the image size
+//   RESOURCE_SIZED     waiting for the main thread to lock a texture
+//   RESOURCE_DECODING  the thread is writing pixels into the locked texture
+//   RESOURCE_DECODED   ready to unlock, the main thread draws it from then on
+//
+// Whatever has arrived so far is drawn in the meantime.
+typedef enum {
+  RESOURCE_OPENING,
+  RESOURCE_SIZED,
+  RESOURCE_DECODING,
+  RESOURCE_DECODED
+} ResourceState;
+
+typedef struct {
+  const char *filename;
+  Texture *tex;
+  Font *font;
+
+  SDL_Thread *thread;
+  SDL_atomic_t state;
+  SDL_sem *locked;
+  SDL_Texture *pending;
+
+  // Set by the decoding thread
+  int w, h;
+  const void *data;
+  int data_len, mapped;
+  cp_pixel_t *first_row;
+
+  // Set by the main thread, the locked texture memory
+  void *pixels;
+  int pitch;
+} Resource;
+
+Resource resources[] = {
+  {"assets/board.png", &tex_board},
+  {"assets/white.png", &tex_white},
+  {"assets/white_king.png", &tex_white_king},
+  {"assets/black.png", &tex_black},
+  {"assets/black_king.png", &tex_black_king},
+  {"assets/good_neighbors.png", NULL, &font},
+};
+
+#define RESOURCE_COUNT (int)(sizeof(resources) / sizeof(resources[0]))
+
+int resources_pending;
+
+
+// Fonts have markers in the first row showing where each glyph starts, keep
+// a copy since locked texture memory isn't meant to be read back
+void keep_first_row(Resource *res, const cp_pixel_t *row) {
+  res->first_row = malloc(sizeof(cp_pixel_t) * res->w);
+  if(res->first_row == NULL)
+    die("malloc");
+  memcpy(res->first_row, row, sizeof(cp_pixel_t) * res->w);
+}
+
+
+#ifdef EMBED_ASSETS
+// Assets are baked into the executable, look them up by filename instead
+// of touching the disk
+void open_image(Resource *res) {
+  for(int i = 0; i < embedded_asset_count; i++) {
+    const EmbeddedAsset *asset = &embedded_assets[i];
+    if(!strcmp(asset->filename, res->filename)) {
+      res->w = asset->w;
+      res->h = asset->h;
+      res->data = asset->pix;
+      return;
+    }
+  }
+
+  fprintf(stderr, "%s is not an embedded asset\n", res->filename);
+  exit(EXIT_FAILURE);
+}
+
+
+void decode_image(Resource *res) {
+  const cp_pixel_t *pix = res->data;
+  for(int y = 0; y < res->h; y++)
+    memcpy((Uint8*)res->pixels + y * res->pitch, &pix[y * res->w],
+        sizeof(cp_pixel_t) * res->w);
+
+  if(res->font != NULL)
+    keep_first_row(res, pix);
+}
+
+
+void close_image(Resource *res) {
+}
+#else
+void open_image(Resource *res) {
+  res->data = cp_map_file(res->filename, &res->data_len, &res->mapped);
+  if(res->data == NULL)
+    die(res->filename);
+
+  cp_load_png_wh(res->data, res->data_len, &res->w, &res->h);
+  if(res->w == 0 || res->h == 0)
     die(cp_error_reason);
+}
 
-  SDL_Surface *surf = SDL_CreateRGBSurfaceFrom(
-      img.pix, img.w, img.h, 32, img.w*4, RGBA_MASK);
-  
-  if(surf == NULL)
-    die(SDL_GetError());
 
-  return surf;
+int copy_font_row(const cp_pixel_t *row, int w, int y, void *udata) {
+  Resource *res = udata;
+  memcpy((Uint8*)res->pixels + y * res->pitch, row, sizeof(cp_pixel_t) * w);
+  if(y == 0)
+    keep_first_row(res, row);
+  return 1;
 }
 
 
-void load_texture_from_surface(SDL_Surface *surf, Texture *tex) {
-  SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
-  tex->tex = SDL_CreateTextureFromSurface(renderer, surf);
-  if(tex->tex == NULL)
-    die(SDL_GetError());
-  tex->w = surf->w;
-  tex->h = surf->h;
+// Textures get pixels written straight into them, only the font has to see
+// the rows go past
+void decode_image(Resource *res) {
+  int ok = res->font != NULL
+    ? cp_load_png_mem_rows(res->data, res->data_len, copy_font_row, res)
+    : cp_load_png_mem_into(res->data, res->data_len, res->pixels, res->pitch);
+  if(!ok)
+    die(cp_error_reason);
+}
+
+
+void close_image(Resource *res) {
+  cp_unmap_file((void*)res->data, res->data_len, res->mapped);
+  res->data = NULL;
+}
+#endif
+
+
+int decode_resource(void *data) {
+  Resource *res = data;
+  open_image(res);
+  SDL_AtomicSet(&res->state, RESOURCE_SIZED);
+
+  SDL_SemWait(res->locked);
+  decode_image(res);
+  close_image(res);
+  SDL_AtomicSet(&res->state, RESOURCE_DECODED);
+  return 0;
 }
 
 
-void load_texture(const char *filename, Texture *tex) {
-  SDL_Surface *surf = load_png(filename);
-  load_texture_from_surface(surf, tex);
+void load_resources(void) {
+  resources_pending = RESOURCE_COUNT;
 
-  free(surf->pixels);
-  SDL_FreeSurface(surf);
+  for(int i = 0; i < RESOURCE_COUNT; i++) {
+    resources[i].locked = SDL_CreateSemaphore(0);
+    if(resources[i].locked == NULL)
+      die(SDL_GetError());
+
+    resources[i].thread = SDL_CreateThread(
+        decode_resource, resources[i].filename, &resources[i]);
+    if(resources[i].thread == NULL)
+      die(SDL_GetError());
+  }
 }
 
 
-void load_font(const char *filename, const char *charset, Font *fnt) {
-  SDL_Surface *surf = load_png(filename);
-  load_texture_from_surface(surf, &fnt->tex);
+// Create a texture for a resource that knows its size and lock it for the
+// decoding thread to write into
+void lock_resource_texture(Resource *res) {
+  SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+  res->pending = SDL_CreateTexture(
+      renderer,
+      SDL_PIXELFORMAT_RGBA32,
+      SDL_TEXTUREACCESS_STREAMING,
+      res->w,
+      res->h);
+  if(res->pending == NULL)
+    die(SDL_GetError());
+
+  SDL_SetTextureBlendMode(res->pending, SDL_BLENDMODE_BLEND);
+  if(SDL_LockTexture(res->pending, NULL, &res->pixels, &res->pitch))
+    die(SDL_GetError());
+
+  SDL_AtomicSet(&res->state, RESOURCE_DECODING);
+  SDL_SemPost(res->locked);
+}
 
+
+void load_font_glyphs(Font *fnt, const cp_pixel_t *markers, const char *charset) {
   fnt->charset = charset;
   fnt->src_rects = malloc(sizeof(SDL_Rect) * strlen(charset));
 
@@ -149,27 +348,50 @@ void load_font(const char *filename, const char *charset, Font *fnt) {
       idx < strlen(charset) && right < fnt->tex.w;
       left = right, right++, idx++)
   {
-    while(((Uint32*)surf->pixels)[right+1] == 0) right++;
+    while(right+1 < fnt->tex.w && ((Uint32*)markers)[right+1] == 0) right++;
     fnt->src_rects[idx] = (SDL_Rect){
       .x = left,
       .y = 1,
       .w = right-left,
-      .h = surf->h-1
+      .h = fnt->tex.h-1
     };
   }
-
-  free(surf->pixels);
-  SDL_FreeSurface(surf);
 }
 
 
-void load_resources(void) {
-  load_texture("assets/board.png", &tex_board);
-  load_texture("assets/white.png", &tex_white);
-  load_texture("assets/white_king.png", &tex_white_king);
-  load_texture("assets/black.png", &tex_black);
-  load_texture("assets/black_king.png", &tex_black_king);
-  load_font("assets/good_neighbors.png", FONT_CHARS, &font);
+// Hand out textures to lock, and unlock any that have finished decoding
+// Returns true once everything has been loaded
+bool upload_resources(void) {
+  for(int i = 0; i < RESOURCE_COUNT && resources_pending; i++) {
+    Resource *res = &resources[i];
+    if(res->thread == NULL)
+      continue;
+
+    switch(SDL_AtomicGet(&res->state)) {
+    case RESOURCE_SIZED:
+      lock_resource_texture(res);
+      break;
+
+    case RESOURCE_DECODED:
+      SDL_WaitThread(res->thread, NULL);
+      SDL_DestroySemaphore(res->locked);
+      res->thread = NULL;
+      SDL_UnlockTexture(res->pending);
+
+      Texture *tex = res->font != NULL ? &res->font->tex : res->tex;
+      *tex = (Texture){res->pending, res->w, res->h};
+      if(res->font != NULL) {
+        load_font_glyphs(res->font, res->first_row, FONT_CHARS);
+        free(res->first_row);
+      }
+
+      res->pending = NULL;
+      resources_pending--;
+      break;
+    }
+  }
+
+  return resources_pending == 0;
 }
 
 
@@ -177,6 +399,10 @@ void draw_string(Font *fnt, int x, int y, const char *fmt, ...) {
   static char *buf = NULL;
   static size_t buf_size = 0;
 
+  // Still loading
+  if(fnt->tex.tex == NULL)
+    return;
+
   if(buf == NULL) {
     buf = malloc(128);
     buf_size = 128;
@@ -192,13 +418,13 @@ void draw_string(Font *fnt, int x, int y, const char *fmt, ...) {
   for(char *c = buf; *c; c++) {
     // Spaces are 1 n wide
     if(*c == ' ') {
-      char *p = index(fnt->charset, 'n');
+      char *p = strchr(fnt->charset, 'n');
       int idx = (int)(p - fnt->charset);
       x += fnt->src_rects[idx].w;
       continue;
     }
 
-    char *p = index(fnt->charset, *c);
+    char *p = strchr(fnt->charset, *c);
     if(p == NULL) {
       *c = '?';
       c--;
@@ -225,6 +451,9 @@ void draw_string(Font *fnt, int x, int y, const char *fmt, ...) {
 
 // Checkers functions
 void draw_board(void) {
+  if(tex_board.tex == NULL)
+    return;
+
   // Draw board
   SDL_RenderCopy(
       renderer,
@@ -242,7 +471,7 @@ void draw_board(void) {
         case 'B': tex = &tex_black_king; break;
       }
 
-      if(tex == NULL)
+      if(tex == NULL || tex->tex == NULL)
         continue;
 
       SDL_RenderCopy(
@@ -261,12 +490,192 @@ void draw_board(void) {
 }
 
 
+// Frame timing
+// Each frame records how long was spent in each stage of the main loop,
+// the last FRAME_HISTORY frames are kept for the HUD.
+#define FRAME_HISTORY 256
+#define HUD_GRAPH_HEIGHT 64
+#define HUD_GRAPH_MS 33.3
+
+typedef enum {
+  STAGE_EVENTS,
+  STAGE_UPLOAD,
+  STAGE_BOARD,
+  STAGE_TEXT,
+  STAGE_UPSCALE,
+  STAGE_HUD,
+  STAGE_PRESENT,
+  STAGE_COUNT
+} Stage;
+
+const char *stage_names[STAGE_COUNT] = {
+  "events", "upload", "board", "text", "upscale", "hud", "present"
+};
+
+typedef struct {
+  double stage_ms[STAGE_COUNT];
+  double total_ms;
+} FrameTiming;
+
+struct {
+  FrameTiming frames[FRAME_HISTORY];
+  int head, count;
+  unsigned long frame_number;
+
+  Uint64 frame_start, stage_start;
+  FrameTiming current;
+
+  bool show_hud;
+  FILE *csv;
+} timing;
+
+
+double ticks_to_ms(Uint64 ticks) {
+  return ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+
+void begin_frame_timing(void) {
+  timing.frame_start = timing.stage_start = SDL_GetPerformanceCounter();
+  timing.current = (FrameTiming){0};
+}
+
+
+// Attribute everything since the last mark to stage
+void mark_stage(Stage stage) {
+  Uint64 now = SDL_GetPerformanceCounter();
+  timing.current.stage_ms[stage] += ticks_to_ms(now - timing.stage_start);
+  timing.stage_start = now;
+}
+
+
+void end_frame_timing(void) {
+  timing.current.total_ms =
+    ticks_to_ms(SDL_GetPerformanceCounter() - timing.frame_start);
+
+  timing.frames[timing.head] = timing.current;
+  timing.head = (timing.head + 1) % FRAME_HISTORY;
+  if(timing.count < FRAME_HISTORY)
+    timing.count++;
+
+  if(timing.csv != NULL) {
+    fprintf(timing.csv, "%lu", timing.frame_number);
+    for(int i = 0; i < STAGE_COUNT; i++)
+      fprintf(timing.csv, ",%.4f", timing.current.stage_ms[i]);
+    fprintf(timing.csv, ",%.4f\n", timing.current.total_ms);
+  }
+
+  timing.frame_number++;
+}
+
+
+void open_timing_csv(const char *filename) {
+  timing.csv = fopen(filename, "w");
+  if(timing.csv == NULL)
+    die(filename);
+
+  fprintf(timing.csv, "frame");
+  for(int i = 0; i < STAGE_COUNT; i++)
+    fprintf(timing.csv, ",%s_ms", stage_names[i]);
+  fprintf(timing.csv, ",total_ms\n");
+}
+
+
+// Get the i'th frame back in history, 0 is the oldest
+FrameTiming *get_frame_timing(int i) {
+  int start = timing.head - timing.count + FRAME_HISTORY;
+  return &timing.frames[(start + i) % FRAME_HISTORY];
+}
+
+
+int compare_doubles(const void *a, const void *b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+
+// Total frame time at percentile pct over the history
+double frame_time_percentile(double pct) {
+  static double sorted[FRAME_HISTORY];
+
+  if(timing.count == 0)
+    return 0;
+
+  for(int i = 0; i < timing.count; i++)
+    sorted[i] = get_frame_timing(i)->total_ms;
+  qsort(sorted, timing.count, sizeof(double), compare_doubles);
+
+  int idx = (int)(pct / 100 * (timing.count - 1) + 0.5);
+  return sorted[idx];
+}
+
+
+// Draw the HUD straight to the window so it's legible at any scale
+void draw_hud(void) {
+  if(!timing.show_hud || timing.count == 0 || font.tex.tex == NULL)
+    return;
+
+  int line = font.src_rects[0].h + 1;
+  int width = max(FRAME_HISTORY, 200);
+  int height = line * (STAGE_COUNT + 1) + HUD_GRAPH_HEIGHT + 8;
+
+  SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+  SDL_SetRenderDrawColor(renderer, 0, 0, 0, 192);
+  SDL_RenderFillRect(renderer, &(SDL_Rect){0, 0, width + 8, height});
+
+  draw_string(&font, 4, 2, "p50 %.2fms p99 %.2fms",
+      frame_time_percentile(50), frame_time_percentile(99));
+
+  FrameTiming *last = get_frame_timing(timing.count - 1);
+  for(int i = 0; i < STAGE_COUNT; i++)
+    draw_string(&font, 4, 2 + line * (i+1), "%s %.2fms",
+        stage_names[i], last->stage_ms[i]);
+
+  // One column per frame, the line marks HUD_GRAPH_MS/2 (60fps)
+  int bottom = height - 4;
+  SDL_SetRenderDrawColor(renderer, 64, 255, 64, 255);
+  for(int i = 0; i < timing.count; i++) {
+    double ms = get_frame_timing(i)->total_ms;
+    int h = min(HUD_GRAPH_HEIGHT, (int)(ms / HUD_GRAPH_MS * HUD_GRAPH_HEIGHT));
+    SDL_RenderDrawLine(renderer, 4 + i, bottom, 4 + i, bottom - h);
+  }
+
+  SDL_SetRenderDrawColor(renderer, 255, 64, 64, 255);
+  SDL_RenderDrawLine(renderer,
+      4, bottom - HUD_GRAPH_HEIGHT/2,
+      4 + FRAME_HISTORY, bottom - HUD_GRAPH_HEIGHT/2);
+
+  SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+  SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+}
+
+
+void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [--timings FILE.csv]\n", prog);
+  exit(EXIT_FAILURE);
+}
+
+
 int main(int argc, char *argv[]) {
-  init_sdl();
+  Uint64 startup = SDL_GetPerformanceCounter();
+
+  for(int i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "--timings") && i+1 < argc)
+      open_timing_csv(argv[++i]);
+    else
+      usage(argv[0]);
+  }
+
+  // Start decoding as soon as SDL is up so it overlaps creating the window
+  if(SDL_Init(SDL_INIT_EVERYTHING))
+    die(SDL_GetError());
   load_resources();
+  init_window();
   init_board();
 
   while(1) {
+    begin_frame_timing();
+
     for(SDL_Event e; SDL_PollEvent(&e);) {
       switch(e.type) {
       case SDL_QUIT:
@@ -279,19 +688,34 @@ int main(int argc, char *argv[]) {
         case SDL_WINDOWEVENT_CLOSE:
           goto done;
         case SDL_WINDOWEVENT_SIZE_CHANGED:
-          update_render_target();
+          resize_pending = true;
+          resize_time = SDL_GetTicks();
           break;
         }
         break;
+
+      case SDL_KEYDOWN:
+        if(e.key.keysym.sym == SDLK_F3 && !e.key.repeat)
+          timing.show_hud = !timing.show_hud;
+        break;
       }
     }
+    update_resize();
+    mark_stage(STAGE_EVENTS);
+
+    if(resources_pending && upload_resources())
+      fprintf(stderr, "Resources loaded after %.1fms\n",
+          ticks_to_ms(SDL_GetPerformanceCounter() - startup));
+    mark_stage(STAGE_UPLOAD);
 
     SDL_SetRenderTarget(renderer, render_target);
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderClear(renderer);
     SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
     draw_board();
+    mark_stage(STAGE_BOARD);
     draw_string(&font, 0, 0, "Hello, world!");
+    mark_stage(STAGE_TEXT);
 
     SDL_SetRenderTarget(renderer, NULL);
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
@@ -315,9 +739,22 @@ int main(int argc, char *argv[]) {
         .w=TARGET_WIDTH*render_target_scale*scale,
         .h=TARGET_HEIGHT*render_target_scale*scale
       });
+    mark_stage(STAGE_UPSCALE);
+    draw_hud();
+    mark_stage(STAGE_HUD);
+
     SDL_RenderPresent(renderer);
+    mark_stage(STAGE_PRESENT);
+
+    if(timing.frame_number == 0)
+      fprintf(stderr, "First frame after %.1fms\n",
+          ticks_to_ms(SDL_GetPerformanceCounter() - startup));
+    end_frame_timing();
   }
 done:
 
+  if(timing.csv != NULL)
+    fclose(timing.csv);
+
   SDL_Quit();
 }
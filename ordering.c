@@ -0,0 +1,96 @@
+#include "ordering.h"
+#include <string.h>
+
+// Each kind of move sorts above every move of the kinds below it
+#define HASH_MOVE_SCORE (4LL << 48)
+#define CAPTURE_SCORE (3LL << 48)
+#define KILLER_SCORE (2LL << 48)
+
+
+void ordering_clear(MoveOrdering *o, const Variant *v) {
+  memset(o, 0, sizeof(*o));
+  o->variant = v;
+}
+
+
+bool same_move(const Move *a, const Move *b) {
+  if(a->path_length != b->path_length || a->capture_count != b->capture_count ||
+      a->path_length == 0 || a->path[0] != b->path[0] ||
+      a->path[a->path_length - 1] != b->path[b->path_length - 1])
+    return false;
+
+  // The same pieces can be taken in a different order
+  int same = 0;
+  for(int i = 0; i < a->capture_count; i++)
+    for(int j = 0; j < b->capture_count; j++)
+      same += a->captured[i] == b->captured[j];
+  return same == a->capture_count;
+}
+
+
+// Dark squares are numbered from the top left, half as many as the width
+// to a row
+static int dark_square(const Variant *v, int square) {
+  int x, y;
+  variant_location(v, square, &x, &y);
+  return (y * v->width + x) / 2;
+}
+
+
+static void history_squares(const Variant *v, const Move *m, int *from, int *to) {
+  *from = dark_square(v, m->path[0]);
+  *to = dark_square(v, m->path[m->path_length - 1]);
+}
+
+
+static long long move_score(const MoveOrdering *o, const Move *m, int ply,
+    const Move *hash_move) {
+  if(hash_move && same_move(m, hash_move))
+    return HASH_MOVE_SCORE;
+  if(m->capture_count > 0)
+    return CAPTURE_SCORE + m->capture_count;
+
+  for(int k = 0; k < KILLERS && ply < MAX_PLY; k++)
+    if(same_move(m, &o->killers[ply][k]))
+      return KILLER_SCORE + KILLERS - k;
+
+  int from, to;
+  history_squares(o->variant, m, &from, &to);
+  return o->history[from][to];
+}
+
+
+void order_moves(const MoveOrdering *o, Move *moves, int count, int ply,
+    const Move *hash_move) {
+  long long scores[MAX_MOVES];
+  for(int i = 0; i < count; i++)
+    scores[i] = move_score(o, &moves[i], ply, hash_move);
+
+  // Insertion sort, there are rarely more than a dozen moves
+  for(int i = 1; i < count; i++) {
+    Move m = moves[i];
+    long long score = scores[i];
+    int j = i;
+    for(; j > 0 && scores[j - 1] < score; j--) {
+      moves[j] = moves[j - 1];
+      scores[j] = scores[j - 1];
+    }
+    moves[j] = m;
+    scores[j] = score;
+  }
+}
+
+
+void ordering_cutoff(MoveOrdering *o, const Move *m, int ply, int depth) {
+  // Captures go first anyway
+  if(m->capture_count > 0)
+    return;
+
+  if(ply < MAX_PLY && !same_move(m, &o->killers[ply][0])) {
+    memmove(&o->killers[ply][1], &o->killers[ply][0], sizeof(Move) * (KILLERS - 1));
+    o->killers[ply][0] = *m;
+  }
+  int from, to;
+  history_squares(o->variant, m, &from, &to);
+  o->history[from][to] += depth * depth;
+}
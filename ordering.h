@@ -0,0 +1,39 @@
+#ifndef ORDERING_H
+#define ORDERING_H
+#include "variants.h"
+
+// Move ordering for search.c. Alpha-beta only gets near the minimal tree
+// if the move that fails high is tried first, so moves are put in order:
+//
+//   the hash move, the best move found here by an earlier search
+//   captures, taking the most pieces first
+//   killer moves, quiet moves that failed high at the same ply elsewhere
+//   the rest by history, how often and how deep each from/to pair of
+//   dark squares has failed high
+//
+// Quiet moves that fail high are passed back to ordering_cutoff.
+
+#define MAX_PLY 64
+#define KILLERS 2
+#define DARK_SQUARES (MAX_BOARD_WIDTH * MAX_BOARD_HEIGHT / 2)
+
+typedef struct {
+  const Variant *variant;
+  Move killers[MAX_PLY][KILLERS];
+  unsigned long history[DARK_SQUARES][DARK_SQUARES];
+} MoveOrdering;
+
+// Forget everything learnt, ready to search a new position
+void ordering_clear(MoveOrdering *o, const Variant *v);
+
+// Sort moves best first, hash_move can be NULL
+void order_moves(const MoveOrdering *o, Move *moves, int count, int ply,
+    const Move *hash_move);
+
+// Record a move that failed high at ply with depth left to search
+void ordering_cutoff(MoveOrdering *o, const Move *m, int ply, int depth);
+
+// Same start, end and captures
+bool same_move(const Move *a, const Move *b);
+
+#endif
@@ -0,0 +1,224 @@
+// Headless batch renderer for board diagrams
+//
+// Reads a list of positions and writes each one out as a PNG, compositing
+// the board and piece images from assets/ in memory. No window or renderer
+// is created so this runs anywhere, and the list is split between a pool
+// of worker threads.
+//
+// Each line of the input is an output filename followed by a position:
+//
+//   diagrams/opening.png wwwwwwwwwwww........bbbbbbbbbbbb
+//
+// The position lists the dark squares left to right, top to bottom, using
+// the same characters as the board (w, W, b, B) and '.' for empty squares.
+
+#define _POSIX_C_SOURCE 200809L
+#include "checkers.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define CUTE_PNG_IMPLEMENTATION
+#include "cute_png.h"
+
+#define TILE_WIDTH 32
+#define TILE_HEIGHT 32
+#define SQUARES (BOARD_WIDTH * BOARD_HEIGHT / 2)
+
+#define die(msg) do { perror(msg); exit(EXIT_FAILURE); } while(0)
+
+typedef struct {
+  char *filename;
+  char position[SQUARES];
+} Job;
+
+cp_image_t img_board;
+cp_image_t img_white, img_white_king;
+cp_image_t img_black, img_black_king;
+
+Job *jobs;
+int job_count;
+int next_job;
+int failures;
+pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+cp_image_t load_image(const char *filename) {
+  cp_image_t img = cp_load_png(filename);
+  if(img.pix == 0) {
+    fprintf(stderr, "%s: %s\n", filename, cp_error_reason);
+    exit(EXIT_FAILURE);
+  }
+
+  return img;
+}
+
+
+void load_resources(void) {
+  img_board = load_image("assets/board.png");
+  img_white = load_image("assets/white.png");
+  img_white_king = load_image("assets/white_king.png");
+  img_black = load_image("assets/black.png");
+  img_black_king = load_image("assets/black_king.png");
+}
+
+
+// Read the job list, one filename and position per line
+// Returns the number of jobs, exits on malformed input
+int read_jobs(FILE *fp) {
+  char line[4096];
+  int capacity = 0;
+
+  for(int line_number = 1; fgets(line, sizeof(line), fp); line_number++) {
+    char filename[sizeof(line)], position[sizeof(line)];
+    if(sscanf(line, "%s %s", filename, position) != 2)
+      continue;
+
+    if(strlen(position) != SQUARES ||
+        strspn(position, "wWbB.") != SQUARES) {
+      fprintf(stderr, "line %d: position must be %d of w, W, b, B or .\n",
+          line_number, SQUARES);
+      exit(EXIT_FAILURE);
+    }
+
+    if(job_count == capacity) {
+      capacity = capacity ? capacity * 2 : 256;
+      jobs = realloc(jobs, sizeof(Job) * capacity);
+      if(jobs == NULL)
+        die("realloc");
+    }
+
+    jobs[job_count].filename = strdup(filename);
+    memcpy(jobs[job_count].position, position, SQUARES);
+    job_count++;
+  }
+
+  return job_count;
+}
+
+
+// Blend src over dst at x,y, the same as SDL_BLENDMODE_BLEND
+void blit(cp_image_t *dst, const cp_image_t *src, int x, int y) {
+  for(int sy = 0; sy < src->h && y+sy < dst->h; sy++) {
+    const cp_pixel_t *s = &src->pix[sy * src->w];
+    cp_pixel_t *d = &dst->pix[(y+sy) * dst->w + x];
+
+    for(int sx = 0; sx < src->w && x+sx < dst->w; sx++, s++, d++) {
+      int a = s->a, ia = 255 - a;
+      if(a == 0)
+        continue;
+
+      d->r = (s->r * a + d->r * ia + 127) / 255;
+      d->g = (s->g * a + d->g * ia + 127) / 255;
+      d->b = (s->b * a + d->b * ia + 127) / 255;
+      d->a = a + (d->a * ia + 127) / 255;
+    }
+  }
+}
+
+
+// Draw a position onto canvas, laid out the same as draw_board in main.c
+void render_position(cp_image_t *canvas, const char *position) {
+  memcpy(canvas->pix, img_board.pix,
+      sizeof(cp_pixel_t) * img_board.w * img_board.h);
+
+  for(int y = 0, i = 0; y < BOARD_HEIGHT; y++) {
+    for(int x = 0; x < BOARD_WIDTH; x++) {
+      if(!is_location_live(x, y))
+        continue;
+
+      cp_image_t *img = NULL;
+      switch(position[i++]) {
+        case 'w': img = &img_white; break;
+        case 'W': img = &img_white_king; break;
+        case 'b': img = &img_black; break;
+        case 'B': img = &img_black_king; break;
+      }
+
+      if(img != NULL)
+        blit(canvas, img, (x+1) * TILE_WIDTH, (y+1) * TILE_HEIGHT);
+    }
+  }
+}
+
+
+// Worker thread, takes jobs off the list until there are none left
+void *worker(void *arg) {
+  cp_image_t canvas = img_board;
+  canvas.pix = malloc(sizeof(cp_pixel_t) * canvas.w * canvas.h);
+  if(canvas.pix == NULL)
+    die("malloc");
+
+  while(1) {
+    pthread_mutex_lock(&job_lock);
+    int j = next_job++;
+    pthread_mutex_unlock(&job_lock);
+
+    if(j >= job_count)
+      break;
+
+    render_position(&canvas, jobs[j].position);
+    if(!cp_save_png(jobs[j].filename, &canvas)) {
+      pthread_mutex_lock(&job_lock);
+      fprintf(stderr, "%s: %s\n", jobs[j].filename, cp_error_reason);
+      failures++;
+      pthread_mutex_unlock(&job_lock);
+    }
+  }
+
+  free(canvas.pix);
+  return NULL;
+}
+
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void usage(const char *prog) {
+  fprintf(stderr, "usage: %s [-j THREADS] [LIST]\n", prog);
+  exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[]) {
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+  FILE *fp = stdin;
+
+  int opt;
+  while((opt = getopt(argc, argv, "j:")) != -1) {
+    switch(opt) {
+      case 'j': threads = atoi(optarg); break;
+      default: usage(argv[0]);
+    }
+  }
+
+  if(optind < argc && (fp = fopen(argv[optind], "r")) == NULL)
+    die(argv[optind]);
+  if(threads < 1)
+    threads = 1;
+
+  load_resources();
+  read_jobs(fp);
+
+  double start = now();
+
+  pthread_t *pool = malloc(sizeof(pthread_t) * threads);
+  for(int i = 0; i < threads; i++)
+    if(pthread_create(&pool[i], NULL, worker, NULL))
+      die("pthread_create");
+  for(int i = 0; i < threads; i++)
+    pthread_join(pool[i], NULL);
+
+  double elapsed = now() - start;
+  fprintf(stderr, "%d images in %.3fs on %d threads, %.1f images/sec\n",
+      job_count, elapsed, threads, job_count / elapsed);
+
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
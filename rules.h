@@ -0,0 +1,279 @@
+// Rules and move generation for one variant of checkers
+//
+// This is a template, variants.c includes it once per variant with these
+// defined, and they're undefined again at the end:
+//
+//   RULES(name)              prefixes everything, eg english_##name
+//   RULES_WIDTH, RULES_HEIGHT
+//   RULES_RANKS              rows of men each side starts with
+//   RULES_FORCED_CAPTURE     a capture has to be taken if there is one
+//   RULES_MAJORITY_CAPTURE   and it has to be one that takes the most pieces
+//   RULES_FLYING_KINGS       kings move and capture any distance along a diagonal
+//   RULES_MEN_CAPTURE_BACK   men capture backwards as well as forwards
+//
+// Since the rules are constants the compiler drops the branches for the
+// ones a variant doesn't have, leaving each generator with no rule checks
+// in its loops. Board and Move are described in variants.h.
+//
+// Captured pieces stay on the board as CAPTURED until the move is over, so
+// they can't be jumped twice, and a man only becomes a king if the move
+// ends on the far row.
+
+#define STRIDE (RULES_WIDTH + 2)
+#define SQ(x,y) (((y) + 1) * STRIDE + (x) + 1)
+#define EMPTY ' '
+#define CAPTURED 'x'
+
+// The rules again as constants, for variants.c to fill in the Variant from
+// so it can't disagree with the generator
+enum {
+  RULES(width) = RULES_WIDTH,
+  RULES(height) = RULES_HEIGHT,
+  RULES(forced_capture) = RULES_FORCED_CAPTURE,
+  RULES(majority_capture) = RULES_MAJORITY_CAPTURE,
+  RULES(flying_kings) = RULES_FLYING_KINGS,
+  RULES(men_capture_backwards) = RULES_MEN_CAPTURE_BACK
+};
+
+// Up left, up right, down left and down right. White moves down the
+// board and black up it.
+static const int RULES(offsets)[4] = { -STRIDE - 1, -STRIDE + 1, STRIDE - 1, STRIDE + 1 };
+
+
+static void RULES(init_board)(Board *b) {
+  memset(b->squares, '#', sizeof(b->squares));
+  for(int y = 0; y < RULES_HEIGHT; y++) {
+    for(int x = 0; x < RULES_WIDTH; x++) {
+      char piece = EMPTY;
+      if(x%2 != y%2 && y < RULES_RANKS)
+        piece = 'w';
+      else if(x%2 != y%2 && y >= RULES_HEIGHT - RULES_RANKS)
+        piece = 'b';
+      b->squares[SQ(x,y)] = piece;
+    }
+  }
+  b->side = 'b';
+  b->men = b->kings = 0; // as many each
+}
+
+
+// Keeps the piece counts up to date, sign is 1 for a piece put on the board
+// and -1 for one taken off
+static void RULES(count_piece)(Board *b, char piece, int sign) {
+  switch(piece) {
+    case 'w': b->men += sign; break;
+    case 'W': b->kings += sign; break;
+    case 'b': b->men -= sign; break;
+    case 'B': b->kings -= sign; break;
+  }
+}
+
+
+static bool RULES(is_enemy)(char piece, char side) {
+  return piece != EMPTY && piece != CAPTURED && piece != '#' && (piece | 0x20) != side;
+}
+
+
+// Adds a finished capture to moves, unless majority capture rules it out or
+// it's the same move as one already found by another route
+static int RULES(add_capture)(const Move *cur, Move *moves, int count, int *best) {
+  if(RULES_MAJORITY_CAPTURE) {
+    if(cur->capture_count < *best)
+      return count;
+    if(cur->capture_count > *best) {
+      *best = cur->capture_count;
+      count = 0;
+    }
+  }
+
+  int to = cur->path[cur->path_length - 1];
+  for(int i = 0; i < count && cur->capture_count > 1; i++) {
+    const Move *m = &moves[i];
+    if(m->path[0] != cur->path[0] || m->path[m->path_length - 1] != to ||
+        m->capture_count != cur->capture_count)
+      continue;
+
+    int same = 0;
+    for(int j = 0; j < cur->capture_count; j++)
+      for(int k = 0; k < m->capture_count; k++)
+        same += cur->captured[j] == m->captured[k];
+    if(same == cur->capture_count)
+      return count;
+  }
+
+  moves[count] = *cur;
+  return count + 1;
+}
+
+
+// Extends cur with every capture the piece at s can make next, adding
+// each sequence that can't go any further to moves
+static int RULES(find_captures)(Board *b, int s, bool king, Move *cur,
+    Move *moves, int count, int *best) {
+  bool extended = false;
+
+  for(int d = 0; d < 4; d++) {
+    // Men only capture forwards unless the variant says otherwise
+    if(!RULES_MEN_CAPTURE_BACK && !king && (d < 2) != (b->side == 'b'))
+      continue;
+
+    int off = RULES(offsets)[d], over = s + off;
+    if(RULES_FLYING_KINGS && king)
+      while(b->squares[over] == EMPTY)
+        over += off;
+
+    int land = over + off;
+    if(!RULES(is_enemy)(b->squares[over], b->side) || b->squares[land] != EMPTY)
+      continue;
+
+    char victim = b->squares[over];
+    b->squares[over] = CAPTURED;
+    cur->captured[cur->capture_count++] = over;
+    do {
+      cur->path[cur->path_length++] = land;
+      count = RULES(find_captures)(b, land, king, cur, moves, count, best);
+      cur->path_length--;
+      land += off;
+    } while(RULES_FLYING_KINGS && king && b->squares[land] == EMPTY);
+    cur->capture_count--;
+    b->squares[over] = victim;
+    extended = true;
+  }
+
+  if(!extended && cur->capture_count > 0)
+    count = RULES(add_capture)(cur, moves, count, best);
+  return count;
+}
+
+
+// Whether the side to move has a capture, without following it any further
+static bool RULES(has_capture)(const Board *b) {
+  char man = b->side, king = man - 'a' + 'A';
+
+  for(int y = 0; y < RULES_HEIGHT; y++) {
+    for(int x = (y + 1) % 2; x < RULES_WIDTH; x += 2) {
+      int s = SQ(x,y);
+      char piece = b->squares[s];
+      if(piece != man && piece != king)
+        continue;
+
+      for(int d = 0; d < 4; d++) {
+        if(!RULES_MEN_CAPTURE_BACK && piece != king && (d < 2) != (b->side == 'b'))
+          continue;
+
+        int off = RULES(offsets)[d], over = s + off;
+        if(RULES_FLYING_KINGS && piece == king)
+          while(b->squares[over] == EMPTY)
+            over += off;
+        if(RULES(is_enemy)(b->squares[over], b->side) && b->squares[over + off] == EMPTY)
+          return true;
+      }
+    }
+  }
+  return false;
+}
+
+
+static int RULES(generate_moves)(const Board *board, Move *moves) {
+  Board b = *board;
+  char man = b.side, king = man - 'a' + 'A';
+  int count = 0, best = 0;
+  int first = man == 'w' ? 2 : 0; // forward directions for men
+
+  for(int y = 0; y < RULES_HEIGHT; y++) {
+    for(int x = (y + 1) % 2; x < RULES_WIDTH; x += 2) {
+      int s = SQ(x,y);
+      char piece = b.squares[s];
+      if(piece != man && piece != king)
+        continue;
+
+      Move cur = { { s }, { 0 }, 1, 0 };
+      b.squares[s] = EMPTY;
+      count = RULES(find_captures)(&b, s, piece == king, &cur, moves, count, &best);
+      b.squares[s] = piece;
+    }
+  }
+
+  if(RULES_FORCED_CAPTURE && count > 0)
+    return count;
+
+  for(int y = 0; y < RULES_HEIGHT; y++) {
+    for(int x = (y + 1) % 2; x < RULES_WIDTH; x += 2) {
+      int s = SQ(x,y);
+      char piece = b.squares[s];
+      if(piece != man && piece != king)
+        continue;
+
+      int start = piece == king ? 0 : first, end = piece == king ? 4 : first + 2;
+      for(int d = start; d < end; d++) {
+        int off = RULES(offsets)[d];
+        for(int to = s + off; b.squares[to] == EMPTY; to += off) {
+          moves[count++] = (Move){ { s, to }, { 0 }, 2, 0 };
+          if(!RULES_FLYING_KINGS || piece != king)
+            break;
+        }
+      }
+    }
+  }
+
+  return count;
+}
+
+
+static void RULES(make_move)(Board *b, const Move *m) {
+  int from = m->path[0], to = m->path[m->path_length - 1];
+  char piece = b->squares[from];
+
+  for(int i = 0; i < m->capture_count; i++) {
+    RULES(count_piece)(b, b->squares[m->captured[i]], -1);
+    b->squares[m->captured[i]] = EMPTY;
+  }
+
+  char crowned = piece;
+  if(piece == 'w' && to >= SQ(0, RULES_HEIGHT - 1))
+    crowned = 'W';
+  else if(piece == 'b' && to <= SQ(RULES_WIDTH - 1, 0))
+    crowned = 'B';
+  if(crowned != piece) {
+    RULES(count_piece)(b, piece, -1);
+    RULES(count_piece)(b, crowned, 1);
+    piece = crowned;
+  }
+
+  b->squares[from] = EMPTY;
+  b->squares[to] = piece;
+  b->side = b->side == 'w' ? 'b' : 'w';
+}
+
+
+static unsigned long RULES(perft)(const Board *b, int depth) {
+  Move moves[MAX_MOVES];
+  if(depth == 0)
+    return 1;
+
+  int count = RULES(generate_moves)(b, moves);
+  if(depth == 1)
+    return count;
+
+  unsigned long nodes = 0;
+  for(int i = 0; i < count; i++) {
+    Board next = *b;
+    RULES(make_move)(&next, &moves[i]);
+    nodes += RULES(perft)(&next, depth - 1);
+  }
+  return nodes;
+}
+
+#undef STRIDE
+#undef SQ
+#undef EMPTY
+#undef CAPTURED
+
+#undef RULES
+#undef RULES_WIDTH
+#undef RULES_HEIGHT
+#undef RULES_RANKS
+#undef RULES_FORCED_CAPTURE
+#undef RULES_MAJORITY_CAPTURE
+#undef RULES_FLYING_KINGS
+#undef RULES_MEN_CAPTURE_BACK
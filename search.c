@@ -0,0 +1,200 @@
+#include "search.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// What doesn't change over one search
+typedef struct {
+  const Variant *variant;
+  int flags;
+  SearchStats stats;
+  SearchContext *context; // NULL without SEARCH_ORDERING
+} Search;
+
+// Random numbers for each piece on each square, and for black to move
+static uint64_t piece_keys[sizeof(((Board*)0)->squares)][4];
+static uint64_t black_key;
+
+
+// splitmix64, from a fixed seed so hashes are the same every run
+static uint64_t next_key(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+  return z ^ (z >> 31);
+}
+
+
+static void init_keys(void) {
+  uint64_t state = 1;
+  for(int s = 0; s < (int)(sizeof(piece_keys) / sizeof(piece_keys[0])); s++)
+    for(int p = 0; p < 4; p++)
+      piece_keys[s][p] = next_key(&state);
+  black_key = next_key(&state);
+}
+
+
+static uint64_t hash_board(const Board *b) {
+  uint64_t key = b->side == 'b' ? black_key : 0;
+  for(int s = 0; s < (int)sizeof(b->squares); s++) {
+    switch(b->squares[s]) {
+      case 'w': key ^= piece_keys[s][0]; break;
+      case 'W': key ^= piece_keys[s][1]; break;
+      case 'b': key ^= piece_keys[s][2]; break;
+      case 'B': key ^= piece_keys[s][3]; break;
+    }
+  }
+  return key;
+}
+
+
+// Built with CHECKERS_DEBUG_EVAL it checks the counts against
+// recount_pieces first.
+int evaluate(const Board *b) {
+#ifdef CHECKERS_DEBUG_EVAL
+  Board full = *b;
+  recount_pieces(&full);
+  assert(full.men == b->men && full.kings == b->kings);
+#endif
+
+  int score = b->men * MAN_VALUE + b->kings * KING_VALUE;
+  return b->side == 'w' ? score : -score;
+}
+
+
+// Searches captures until there are none left to make. Positions without a
+// capture are scored as they stand, without generating their moves.
+static int quiesce(Search *s, const Board *b, int alpha, int beta) {
+  if(!s->variant->has_capture(b))
+    return evaluate(b);
+
+  // Where captures are optional the side to move can stand pat instead
+  int best = -WIN_SCORE;
+  if(!s->variant->forced_capture) {
+    best = evaluate(b);
+    if(best >= beta)
+      return best;
+    if(best > alpha)
+      alpha = best;
+  }
+
+  Move moves[MAX_MOVES];
+  int count = s->variant->generate_moves(b, moves);
+  for(int i = 0; i < count; i++) {
+    if(moves[i].capture_count == 0)
+      continue;
+
+    Board next = *b;
+    s->variant->make_move(&next, &moves[i]);
+    s->stats.quiescence_nodes++;
+    int score = -quiesce(s, &next, -beta, -alpha);
+    if(score > best)
+      best = score;
+    if(best >= beta)
+      break;
+    if(best > alpha)
+      alpha = best;
+  }
+  return best;
+}
+
+
+static int alpha_beta(Search *s, const Board *b, int depth, int alpha, int beta,
+    int ply, Move *best_move) {
+  s->stats.nodes++;
+  if(depth == 0)
+    return s->flags & SEARCH_QUIESCENCE ? quiesce(s, b, alpha, beta) : evaluate(b);
+
+  Move moves[MAX_MOVES];
+  int count = s->variant->generate_moves(b, moves);
+  if(count == 0)
+    return -WIN_SCORE + ply;
+
+  // Forced moves are common, and there's nothing to order with only one
+  uint64_t key = 0;
+  bool ordered = s->context && count > 1;
+  if(ordered) {
+    // A copy, since ordering moves them about
+    Move found;
+    const Move *hash_move = NULL;
+    key = hash_board(b);
+    const HashEntry *entry = &s->context->table[key & (HASH_SIZE - 1)];
+    for(int i = 0; i < count && entry->key == key && !hash_move; i++) {
+      if(moves[i].path[0] == entry->from && moves[i].path[moves[i].path_length - 1] == entry->to) {
+        found = moves[i];
+        hash_move = &found;
+      }
+    }
+    order_moves(&s->context->ordering, moves, count, ply, hash_move);
+  }
+
+  int best = -WIN_SCORE, best_index = 0;
+  for(int i = 0; i < count; i++) {
+    Board next = *b;
+    s->variant->make_move(&next, &moves[i]);
+    int score = -alpha_beta(s, &next, depth - 1, -beta, -alpha, ply + 1, NULL);
+    if(score > best) {
+      best = score;
+      best_index = i;
+    }
+    if(best >= beta) {
+      s->stats.cutoffs += count > 1;
+      s->stats.first_move_cutoffs += count > 1 && i == 0;
+      if(s->context)
+        ordering_cutoff(&s->context->ordering, &moves[i], ply, depth);
+      break;
+    }
+    if(best > alpha)
+      alpha = best;
+  }
+
+  const Move *m = &moves[best_index];
+  if(best_move)
+    *best_move = *m;
+  if(ordered) {
+    HashEntry *entry = &s->context->table[key & (HASH_SIZE - 1)];
+    *entry = (HashEntry){ key, m->path[0], m->path[m->path_length - 1] };
+  }
+  return best;
+}
+
+
+void search_clear(SearchContext *context, const Variant *v) {
+  static bool keys_ready = false;
+  if(!keys_ready) {
+    init_keys();
+    keys_ready = true;
+  }
+
+  ordering_clear(&context->ordering, v);
+  memset(context->table, 0, sizeof(context->table));
+}
+
+
+int search(const Variant *v, const Board *b, int depth, int flags,
+    SearchContext *context, Move *best, SearchStats *stats) {
+  Search s = { v, flags, { 0, 0, 0, 0 }, NULL };
+  int score;
+
+  if(flags & SEARCH_ORDERING) {
+    if(context->ordering.variant != v)
+      search_clear(context, v);
+    s.context = context;
+
+    // Each pass leaves its best moves in the table for the next to try first
+    int d = flags & SEARCH_DEEPENING && depth > 0 ? 1 : depth;
+    do
+      score = alpha_beta(&s, b, d, -WIN_SCORE, WIN_SCORE, 0, best);
+    while(++d <= depth);
+  } else {
+    score = alpha_beta(&s, b, depth, -WIN_SCORE, WIN_SCORE, 0, best);
+  }
+
+  if(stats) {
+    stats->nodes += s.stats.nodes;
+    stats->quiescence_nodes += s.stats.quiescence_nodes;
+    stats->cutoffs += s.stats.cutoffs;
+    stats->first_move_cutoffs += s.stats.first_move_cutoffs;
+  }
+  return score;
+}
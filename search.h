@@ -0,0 +1,72 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+#include "variants.h"
+#include "ordering.h"
+#include <stdint.h>
+
+// Fixed depth alpha-beta search over a variant's rules.
+//
+// Stopping halfway through an exchange gets the position badly wrong, so
+// with quiescence on the search carries on past its depth through capture
+// sequences only, until the side to move has nothing to take.
+//
+// With ordering on, moves are ordered with ordering.c, and the best move
+// from each position is kept in a hash table to try first when the position
+// comes round again. Deepening as well searches one ply deeper at a time,
+// so each pass fills the table for the next. Scores are the same either
+// way, only the nodes it takes to get them change. The table and what
+// ordering has learnt are kept in a SearchContext from one search to the
+// next, so a search doesn't start by setting them up.
+
+#define MAN_VALUE 100
+#define KING_VALUE 150
+#define WIN_SCORE 1000000 // less the plies it takes, so quicker wins score more
+
+// Flags for search
+#define SEARCH_QUIESCENCE 1
+#define SEARCH_ORDERING 2
+#define SEARCH_DEEPENING 4 // only with SEARCH_ORDERING
+
+#define HASH_SIZE (1 << 14) // entries, a power of two
+
+// The best move found from a position, kept by where it starts and ends
+typedef struct {
+  uint64_t key;
+  unsigned char from, to;
+} HashEntry;
+
+// What ordered searches keep from one to the next, about 300K so best not
+// on the stack
+typedef struct {
+  MoveOrdering ordering;
+  HashEntry table[HASH_SIZE];
+} SearchContext;
+
+// first_move_cutoffs / cutoffs is how often the move that failed high was
+// the first one tried, and nodes ^ (1 / depth) the effective branching
+// factor. In the minimal tree they'd be 1 and about the square root of
+// the number of moves. Positions with only one move, forced captures
+// mostly, have nothing to order and aren't counted as cutoffs.
+typedef struct {
+  unsigned long nodes;              // positions within the search depth
+  unsigned long quiescence_nodes;   // and past it, reached by captures
+  unsigned long cutoffs;            // positions where a move failed high
+  unsigned long first_move_cutoffs; // where it was the first move tried
+} SearchStats;
+
+// Material for the side to move less the other side's, from the piece
+// counts the board keeps
+int evaluate(const Board *b);
+
+// Forget everything learnt, ready to search positions in v. search clears
+// it too if it was last used with another variant.
+void search_clear(SearchContext *context, const Variant *v);
+
+// Score of the board for the side to move, looking depth moves ahead.
+// context is only used with SEARCH_ORDERING and can be NULL without it.
+// best is set to the move to play, unless there's no move at all, and
+// stats has the nodes searched added to it. Both can be NULL.
+int search(const Variant *v, const Board *b, int depth, int flags,
+    SearchContext *context, Move *best, SearchStats *stats);
+
+#endif
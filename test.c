@@ -2,6 +2,10 @@
 
 #include "munit.h"
 #include "checkers.c"
+#include "variants.h"
+#include "draughts.h"
+#include "search.h"
+#include "ordering.h"
 
 #define test(name) \
   MunitResult test_##name(const MunitParameter p[], void *data)
@@ -282,6 +286,15 @@ test(is_move_valid_diagonal) {
   return MUNIT_OK;
 }
 
+test(is_move_valid_too_far) {
+  clear_board();
+  set_piece(1,0,'w');
+  munit_assert_string_contains(
+      is_move_valid(1,0,4,3,'w'),
+      "must be diagonal");
+  return MUNIT_OK;
+}
+
 test(is_move_valid_must_jump) {
   clear_board();
   set_piece(1,0,'w');
@@ -310,6 +323,383 @@ test(is_move_valid_cant_jump_own) {
 }
 
 
+//
+// Evaluation
+//
+test(evaluation_init_board_even) {
+  init_board();
+  munit_assert_int(get_evaluation().material,==,0);
+  munit_assert_int(evaluate_board('w'),==,0);
+  munit_assert_int(evaluate_board('b'),==,0);
+  return MUNIT_OK;
+}
+
+// Black's tables are white's turned round
+test(evaluation_terms) {
+  clear_board();
+  set_piece(1, 0, 'w');
+  munit_assert_int(get_evaluation().material,==,MAN_WORTH);
+  munit_assert_int(get_evaluation().back_rank,>,0);
+  munit_assert_int(get_evaluation().advancement,==,0);
+  munit_assert_int(evaluate_board('b'),==,-evaluate_board('w'));
+
+  set_piece(BOARD_WIDTH-2, BOARD_HEIGHT-1, 'b');
+  munit_assert_int(evaluate_board('w'),==,0);
+
+  move_piece(1, 0, 2, 1);
+  munit_assert_int(get_evaluation().back_rank,<,0);
+  munit_assert_int(get_evaluation().advancement,>,0);
+
+  set_piece(BOARD_WIDTH-2, BOARD_HEIGHT-1, 'B');
+  munit_assert_int(get_evaluation().kings,==,-KING_WORTH);
+  return MUNIT_OK;
+}
+
+// Checks the terms set_piece and move_piece keep against adding up the
+// board after each of a run of random calls
+test(evaluation_matches_recompute) {
+  const char pieces[] = " wWbB";
+  init_board();
+  srand(1);
+
+  for(int i = 0; i < 10000; i++) {
+    int x = rand() % BOARD_WIDTH, y = rand() % BOARD_HEIGHT;
+    if(rand() % 2)
+      set_piece(x, y, pieces[rand() % 5]);
+    else
+      move_piece(x, y, x + rand() % 5 - 2, y + rand() % 5 - 2);
+
+    Evaluation e = get_evaluation(), full = recompute_evaluation();
+    munit_assert_memory_equal(sizeof(e), &e, &full);
+    munit_assert_int(evaluate_board('w'),==,
+        full.material + full.kings + full.advancement + full.centre + full.back_rank);
+  }
+  return MUNIT_OK;
+}
+
+
+//
+// Rule variants
+//
+static const unsigned long english_perft[] = { 1, 7, 49, 302, 1469, 7361 };
+static const unsigned long international_perft[] = { 1, 9, 81, 658, 4265, 27117 };
+
+// Start position of a variant with every piece taken off
+static Board empty_board(const Variant *v, char side) {
+  Board b;
+  v->init_board(&b);
+  for(int y = 0; y < v->height; y++)
+    for(int x = 0; x < v->width; x++)
+      b.squares[variant_square(v, x, y)] = ' ';
+  b.side = side;
+  recount_pieces(&b);
+  return b;
+}
+
+static void put(const Variant *v, Board *b, int x, int y, char piece) {
+  b->squares[variant_square(v, x, y)] = piece;
+  recount_pieces(b);
+}
+
+test(perft_english) {
+  Board b;
+  variants[VARIANT_ENGLISH].init_board(&b);
+  for(int depth = 0; depth <= 5; depth++)
+    munit_assert_ulong(variants[VARIANT_ENGLISH].perft(&b, depth),==,english_perft[depth]);
+  return MUNIT_OK;
+}
+
+test(perft_international) {
+  Board b;
+  variants[VARIANT_INTERNATIONAL].init_board(&b);
+  for(int depth = 0; depth <= 5; depth++)
+    munit_assert_ulong(variants[VARIANT_INTERNATIONAL].perft(&b, depth),==,international_perft[depth]);
+  return MUNIT_OK;
+}
+
+test(find_variant) {
+  munit_assert_ptr_equal(find_variant("pool"), &variants[VARIANT_POOL]);
+  munit_assert_null(find_variant("chess"));
+  return MUNIT_OK;
+}
+
+test(variant_forced_capture) {
+  Move moves[MAX_MOVES];
+  const Variant *v = &variants[VARIANT_ENGLISH];
+  Board b = empty_board(v, 'b');
+  put(v, &b, 2, 5, 'b');
+  put(v, &b, 6, 5, 'b');
+  put(v, &b, 3, 4, 'w');
+  munit_assert_int(v->generate_moves(&b, moves),==,1);
+  munit_assert_int(moves[0].capture_count,==,1);
+  munit_assert_int(moves[0].captured[0],==,variant_square(v, 3, 4));
+
+  v = &variants[VARIANT_CASUAL];
+  munit_assert_int(v->generate_moves(&b, moves),==,4);
+  return MUNIT_OK;
+}
+
+test(variant_multiple_jump) {
+  Move moves[MAX_MOVES];
+  const Variant *v = &variants[VARIANT_ENGLISH];
+  Board b = empty_board(v, 'b');
+  put(v, &b, 0, 7, 'b');
+  put(v, &b, 1, 6, 'w');
+  put(v, &b, 3, 4, 'w');
+  munit_assert_int(v->generate_moves(&b, moves),==,1);
+  munit_assert_int(moves[0].path_length,==,3);
+  munit_assert_int(moves[0].path[2],==,variant_square(v, 4, 3));
+
+  v->make_move(&b, &moves[0]);
+  munit_assert_char(b.squares[variant_square(v, 1, 6)],==,' ');
+  munit_assert_char(b.squares[variant_square(v, 3, 4)],==,' ');
+  munit_assert_char(b.squares[variant_square(v, 4, 3)],==,'b');
+  return MUNIT_OK;
+}
+
+test(variant_men_capture_backwards) {
+  Move moves[MAX_MOVES];
+  Board b = empty_board(&variants[VARIANT_ENGLISH], 'b');
+  put(&variants[VARIANT_ENGLISH], &b, 3, 4, 'b');
+  put(&variants[VARIANT_ENGLISH], &b, 4, 5, 'w');
+  munit_assert_int(variants[VARIANT_ENGLISH].generate_moves(&b, moves),==,2);
+  munit_assert_int(variants[VARIANT_POOL].generate_moves(&b, moves),==,1);
+  munit_assert_int(moves[0].capture_count,==,1);
+  return MUNIT_OK;
+}
+
+test(variant_flying_king) {
+  Move moves[MAX_MOVES];
+  const Variant *v = &variants[VARIANT_POOL];
+  Board b = empty_board(v, 'b');
+  put(v, &b, 0, 7, 'B');
+  put(v, &b, 3, 4, 'w');
+
+  // Lands on any of the four squares past the piece
+  munit_assert_int(v->generate_moves(&b, moves),==,4);
+  for(int i = 0; i < 4; i++)
+    munit_assert_int(moves[i].captured[0],==,variant_square(v, 3, 4));
+
+  // Moves any distance along a diagonal when there's nothing to take
+  put(v, &b, 3, 4, ' ');
+  munit_assert_int(v->generate_moves(&b, moves),==,7);
+  munit_assert_int(variants[VARIANT_ENGLISH].generate_moves(&b, moves),==,1);
+  return MUNIT_OK;
+}
+
+test(variant_majority_capture) {
+  Move moves[MAX_MOVES];
+  const Variant *v = &variants[VARIANT_INTERNATIONAL];
+  Board b = empty_board(v, 'b');
+  put(v, &b, 4, 7, 'b');
+  put(v, &b, 3, 6, 'w');
+  put(v, &b, 5, 6, 'w');
+  put(v, &b, 5, 4, 'w');
+  munit_assert_int(v->generate_moves(&b, moves),==,1);
+  munit_assert_int(moves[0].capture_count,==,2);
+  munit_assert_int(moves[0].captured[0],==,variant_square(v, 5, 6));
+  return MUNIT_OK;
+}
+
+// has_capture agrees with generate_moves over random games of every variant
+test(variant_has_capture) {
+  Move moves[MAX_MOVES];
+  srand(1);
+
+  for(int v = 0; v < VARIANT_COUNT; v++) {
+    for(int game = 0; game < 10; game++) {
+      Board b;
+      variants[v].init_board(&b);
+      for(int ply = 0; ply < 200; ply++) {
+        int count = variants[v].generate_moves(&b, moves), captures = 0;
+        for(int i = 0; i < count; i++)
+          captures += moves[i].capture_count > 0;
+        munit_assert_int(variants[v].has_capture(&b),==,captures > 0);
+
+        if(count == 0)
+          break;
+        variants[v].make_move(&b, &moves[rand() % count]);
+      }
+    }
+  }
+  return MUNIT_OK;
+}
+
+// make_move keeps the piece counts the same as counting them afresh,
+// through captures and crowning, over random games of every variant
+test(variant_piece_counts) {
+  Move moves[MAX_MOVES];
+  srand(1);
+
+  for(int v = 0; v < VARIANT_COUNT; v++) {
+    for(int game = 0; game < 10; game++) {
+      Board b;
+      variants[v].init_board(&b);
+      for(int ply = 0; ply < 200; ply++) {
+        Board full = b;
+        recount_pieces(&full);
+        munit_assert_int(b.men,==,full.men);
+        munit_assert_int(b.kings,==,full.kings);
+
+        int count = variants[v].generate_moves(&b, moves);
+        if(count == 0)
+          break;
+        variants[v].make_move(&b, &moves[rand() % count]);
+      }
+    }
+  }
+  return MUNIT_OK;
+}
+
+
+//
+// Search
+//
+test(search_quiet_position) {
+  const Variant *v = &variants[VARIANT_ENGLISH];
+  SearchStats stats = { 0, 0 };
+  Board b;
+  v->init_board(&b);
+  munit_assert_int(search(v, &b, 0, SEARCH_QUIESCENCE, NULL, NULL, &stats),==,0);
+  munit_assert_ulong(stats.nodes,==,1);
+  munit_assert_ulong(stats.quiescence_nodes,==,0);
+  return MUNIT_OK;
+}
+
+// Black's only move gives the man away, which a one move search only
+// sees with quiescence
+test(search_quiescence_sees_capture) {
+  const Variant *v = &variants[VARIANT_ENGLISH];
+  SearchStats stats = { 0, 0 };
+  Board b = empty_board(v, 'b');
+  put(v, &b, 0, 5, 'b');
+  put(v, &b, 2, 3, 'w');
+
+  munit_assert_int(search(v, &b, 1, 0, NULL, NULL, &stats),==,0);
+  munit_assert_ulong(stats.quiescence_nodes,==,0);
+  munit_assert_int(search(v, &b, 1, SEARCH_QUIESCENCE, NULL, NULL, &stats),==,-MAN_VALUE);
+  munit_assert_ulong(stats.quiescence_nodes,==,1);
+  return MUNIT_OK;
+}
+
+test(search_finds_win) {
+  const Variant *v = &variants[VARIANT_ENGLISH];
+  Move best;
+  Board b = empty_board(v, 'b');
+  put(v, &b, 3, 4, 'b');
+  put(v, &b, 6, 5, 'b');
+  put(v, &b, 2, 3, 'w');
+
+  munit_assert_int(search(v, &b, 2, 0, NULL, &best, NULL),==,WIN_SCORE - 1);
+  munit_assert_int(best.capture_count,==,1);
+  munit_assert_int(best.captured[0],==,variant_square(v, 2, 3));
+  return MUNIT_OK;
+}
+
+// Ordering moves only changes how many nodes it takes to get the score,
+// however much the context has kept from earlier searches
+test(search_ordering_same_score) {
+  const Variant *v = &variants[VARIANT_ENGLISH];
+  static SearchContext context;
+  Move moves[MAX_MOVES];
+  Board b;
+  v->init_board(&b);
+  search_clear(&context, v);
+  srand(1);
+
+  for(int ply = 0; ply < 40; ply++) {
+    int score = search(v, &b, 5, SEARCH_QUIESCENCE, NULL, NULL, NULL);
+    munit_assert_int(search(v, &b, 5, SEARCH_QUIESCENCE | SEARCH_ORDERING, &context,
+        NULL, NULL),==,score);
+    munit_assert_int(search(v, &b, 5, SEARCH_QUIESCENCE | SEARCH_ORDERING | SEARCH_DEEPENING,
+        &context, NULL, NULL),==,score);
+
+    int count = v->generate_moves(&b, moves);
+    if(count == 0)
+      break;
+    v->make_move(&b, &moves[rand() % count]);
+  }
+  return MUNIT_OK;
+}
+
+// Hash move, then captures, then killers, then by history
+test(order_moves) {
+  const Variant *v = &variants[VARIANT_CASUAL];
+  MoveOrdering o;
+  Move moves[MAX_MOVES];
+  Board b = empty_board(v, 'b');
+  put(v, &b, 3, 4, 'b');
+  put(v, &b, 6, 5, 'b');
+  put(v, &b, 2, 3, 'w');
+  int count = v->generate_moves(&b, moves);
+  munit_assert_int(count,==,4);
+
+  Move hash_move = { { variant_square(v, 6, 5), variant_square(v, 5, 4) }, { 0 }, 2, 0 };
+  Move killer = { { variant_square(v, 6, 5), variant_square(v, 7, 4) }, { 0 }, 2, 0 };
+  ordering_clear(&o, v);
+  ordering_cutoff(&o, &killer, 0, 3);
+
+  order_moves(&o, moves, count, 0, &hash_move);
+  munit_assert_true(same_move(&moves[0], &hash_move));
+  munit_assert_int(moves[1].capture_count,==,1);
+  munit_assert_true(same_move(&moves[2], &killer));
+
+  // No killers a ply further on, but the history's still there
+  order_moves(&o, moves, count, 1, NULL);
+  munit_assert_int(moves[0].capture_count,==,1);
+  munit_assert_true(same_move(&moves[1], &killer));
+  return MUNIT_OK;
+}
+
+
+//
+// International draughts on bitboards
+//
+test(perft_draughts) {
+  DraughtsBoard b;
+  draughts_init_board(&b);
+  for(int depth = 0; depth <= 5; depth++)
+    munit_assert_ulong(draughts_perft(&b, depth),==,international_perft[depth]);
+  return MUNIT_OK;
+}
+
+test(draughts_set_piece) {
+  DraughtsBoard b = { 0, 0, 0, 'b' };
+  munit_assert_true(draughts_set_piece(&b, 0, 9, 'B'));
+  munit_assert_char(draughts_get_piece(&b, 0, 9),==,'B');
+  munit_assert_false(draughts_set_piece(&b, 0, 0, 'w'));
+  munit_assert_char(draughts_get_piece(&b, 0, 0),==,' ');
+  munit_assert_int(draughts_get_piece(&b, 10, 0),==,-1);
+  return MUNIT_OK;
+}
+
+// Follows random games with the variant generator and checks the
+// bitboards agree on every position along the way
+test(draughts_matches_variant) {
+  const Variant *v = &variants[VARIANT_INTERNATIONAL];
+  Move moves[MAX_MOVES];
+  srand(1);
+
+  for(int game = 0; game < 20; game++) {
+    Board b;
+    v->init_board(&b);
+    for(int ply = 0; ply < 200; ply++) {
+      DraughtsBoard d = { 0, 0, 0, b.side };
+      for(int y = 0; y < DRAUGHTS_SIZE; y++)
+        for(int x = 0; x < DRAUGHTS_SIZE; x++)
+          draughts_set_piece(&d, x, y, b.squares[variant_square(v, x, y)]);
+      munit_assert_ulong(draughts_perft(&d, 2),==,v->perft(&b, 2));
+
+      int count = v->generate_moves(&b, moves);
+      if(count == 0)
+        break;
+      v->make_move(&b, &moves[rand() % count]);
+    }
+  }
+  return MUNIT_OK;
+}
+
+
 #undef test
 #define test(t) {#t, test_##t},
 #define TESTS_BEGIN
@@ -0,0 +1,89 @@
+#include "variants.h"
+#include <string.h>
+
+#define RULES(name) english_##name
+#define RULES_WIDTH 8
+#define RULES_HEIGHT 8
+#define RULES_RANKS 3
+#define RULES_FORCED_CAPTURE 1
+#define RULES_MAJORITY_CAPTURE 0
+#define RULES_FLYING_KINGS 0
+#define RULES_MEN_CAPTURE_BACK 0
+#include "rules.h"
+
+#define RULES(name) casual_##name
+#define RULES_WIDTH 8
+#define RULES_HEIGHT 8
+#define RULES_RANKS 3
+#define RULES_FORCED_CAPTURE 0
+#define RULES_MAJORITY_CAPTURE 0
+#define RULES_FLYING_KINGS 0
+#define RULES_MEN_CAPTURE_BACK 0
+#include "rules.h"
+
+#define RULES(name) pool_##name
+#define RULES_WIDTH 8
+#define RULES_HEIGHT 8
+#define RULES_RANKS 3
+#define RULES_FORCED_CAPTURE 1
+#define RULES_MAJORITY_CAPTURE 0
+#define RULES_FLYING_KINGS 1
+#define RULES_MEN_CAPTURE_BACK 1
+#include "rules.h"
+
+#define RULES(name) international_##name
+#define RULES_WIDTH 10
+#define RULES_HEIGHT 10
+#define RULES_RANKS 4
+#define RULES_FORCED_CAPTURE 1
+#define RULES_MAJORITY_CAPTURE 1
+#define RULES_FLYING_KINGS 1
+#define RULES_MEN_CAPTURE_BACK 1
+#include "rules.h"
+
+#define VARIANT(name) \
+  { #name, name##_width, name##_height, \
+    name##_forced_capture, name##_majority_capture, \
+    name##_flying_kings, name##_men_capture_backwards, \
+    name##_init_board, name##_generate_moves, name##_has_capture, \
+    name##_make_move, name##_perft }
+
+const Variant variants[VARIANT_COUNT] = {
+  VARIANT(english),
+  VARIANT(casual),
+  VARIANT(pool),
+  VARIANT(international),
+};
+
+
+// Returns NULL if there's no variant by that name
+const Variant *find_variant(const char *name) {
+  for(int i = 0; i < VARIANT_COUNT; i++)
+    if(strcmp(variants[i].name, name) == 0)
+      return &variants[i];
+  return NULL;
+}
+
+
+void recount_pieces(Board *b) {
+  b->men = b->kings = 0;
+  for(int s = 0; s < (int)sizeof(b->squares); s++) {
+    switch(b->squares[s]) {
+      case 'w': b->men++; break;
+      case 'W': b->kings++; break;
+      case 'b': b->men--; break;
+      case 'B': b->kings--; break;
+    }
+  }
+}
+
+
+int variant_square(const Variant *v, int x, int y) {
+  return (y + 1) * (v->width + 2) + x + 1;
+}
+
+
+void variant_location(const Variant *v, int square, int *x, int *y) {
+  *x = square % (v->width + 2) - 1;
+  *y = square / (v->width + 2) - 1;
+}
@@ -0,0 +1,75 @@
+#ifndef VARIANTS_H
+#define VARIANTS_H
+#include <stdbool.h>
+
+// Rule variants, each with its own move generator built from rules.h with
+// the rules fixed at compile time. Pick one at runtime through variants[].
+
+#define MAX_BOARD_WIDTH 10
+#define MAX_BOARD_HEIGHT 10
+#define MAX_CAPTURES 20 // every piece the other side starts with
+#define MAX_MOVES 256
+
+typedef enum {
+  VARIANT_ENGLISH,       // 8x8, captures forced, kings move one square
+  VARIANT_CASUAL,        // English with captures optional
+  VARIANT_POOL,          // 8x8, flying kings, men capture backwards too
+  VARIANT_INTERNATIONAL, // 10x10 pool checkers, taking the most pieces is forced
+  VARIANT_COUNT
+} VariantId;
+
+// The board with a border of '#' all round, square x,y is at
+// (y + 1) * (width + 2) + x + 1 for the variant's width. Pieces are the
+// same as in checkers.c, ' ' for empty squares and w, W, b, B.
+//
+// init_board and make_move keep count of the pieces, so search can score a
+// position without looking at the squares. Anything that writes squares
+// itself has to call recount_pieces after.
+typedef struct {
+  char squares[(MAX_BOARD_WIDTH + 2) * (MAX_BOARD_HEIGHT + 2)];
+  char side; // 'w' or 'b', whoever moves next
+  int men, kings; // white's less black's
+} Board;
+
+// A move as the squares the piece visits, starting with the one it moves
+// from, and the squares of the pieces it captures
+typedef struct {
+  unsigned char path[MAX_CAPTURES + 1];
+  unsigned char captured[MAX_CAPTURES];
+  unsigned char path_length, capture_count;
+} Move;
+
+typedef struct {
+  const char *name;
+  int width, height;
+  bool forced_capture, majority_capture, flying_kings, men_capture_backwards;
+
+  // Set up the board for a new game, black to move
+  void (*init_board)(Board *b);
+
+  // Fill moves with every legal move for the side to move, returns how many
+  int (*generate_moves)(const Board *b, Move *moves);
+
+  // Whether the side to move has a capture, cheaper than generate_moves
+  bool (*has_capture)(const Board *b);
+
+  // Make a move from generate_moves and pass the turn
+  void (*make_move)(Board *b, const Move *m);
+
+  // Count the positions depth moves ahead
+  unsigned long (*perft)(const Board *b, int depth);
+} Variant;
+
+extern const Variant variants[VARIANT_COUNT];
+
+// Returns NULL if there's no variant by that name
+const Variant *find_variant(const char *name);
+
+// Count the pieces on the board from scratch
+void recount_pieces(Board *b);
+
+// Square number of x,y on the variant's board, and back again
+int variant_square(const Variant *v, int x, int y);
+void variant_location(const Variant *v, int square, int *x, int *y);
+
+#endif